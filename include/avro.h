@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "hex.h"
+
+// Just enough of Avro's binary encoding to write our records. Longs are
+// zig-zag varints; strings and bytes are a long length and the raw bytes.
+// Union branches and array blocks are written by the caller, as the schema
+// dictates.
+class AvroWriter {
+public:
+  static const unsigned int MAX_LONG_SIZE = 10;
+
+  AvroWriter(size_t reserve = 64 * 1024): Buf(reserve ? reserve: 1), Len(0) {}
+
+  void clear() { Len = 0; }
+
+  const unsigned char* data() const { return Buf.data(); }
+  size_t               size() const { return Len; }
+
+  unsigned char* reserve(size_t n) {
+    if (Len + n > Buf.size()) {
+      size_t newSize = Buf.size() * 2;
+      while (newSize < Len + n) {
+        newSize *= 2;
+      }
+      Buf.resize(newSize);
+    }
+    return &Buf[Len];
+  }
+
+  void commit(size_t n) { Len += n; }
+
+  AvroWriter& num(int64_t v) {
+    Len += encodeLong(reserve(MAX_LONG_SIZE), v);
+    return *this;
+  }
+
+  // Avro has no unsigned types; 64-bit unsigned fields keep their bits
+  template<class T>
+  typename std::enable_if<std::is_integral<T>::value, AvroWriter&>::type
+  num(T v) {
+    return num(static_cast<int64_t>(v));
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_enum<T>::value, AvroWriter&>::type
+  num(T v) {
+    return num(static_cast<int64_t>(v));
+  }
+
+  AvroWriter& boolean(bool b) {
+    *reserve(1) = b ? 1: 0;
+    ++Len;
+    return *this;
+  }
+
+  AvroWriter& bytes(const void* p, size_t len) {
+    num(len);
+    std::memcpy(reserve(len), p, len);
+    Len += len;
+    return *this;
+  }
+
+  AvroWriter& str(const char* s, size_t len) { return bytes(s, len); }
+  AvroWriter& str(const char* s) { return bytes(s ? s: "", s ? std::strlen(s): 0); }
+  AvroWriter& str(const std::string& s) { return bytes(s.data(), s.size()); }
+  AvroWriter& str(boost::string_ref s) { return bytes(s.data(), s.size()); }
+
+  // bytes as a string of hex digits
+  AvroWriter& hex(const unsigned char* p, size_t len) {
+    num(2 * len);
+    hexEncode(reinterpret_cast<char*>(reserve(2 * len)), p, p + len);
+    Len += 2 * len;
+    return *this;
+  }
+
+  AvroWriter& hex(const std::string& bytes) {
+    return hex(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+  }
+
+  // index of the union branch that follows
+  AvroWriter& branch(unsigned int i) { return num(i); }
+
+  // arrays are written as one block of n items, then the empty block
+  AvroWriter& beginArray(size_t n) { return n ? num(n): *this; }
+  AvroWriter& endArray() { return num(int64_t(0)); }
+
+  static unsigned int encodeLong(unsigned char* buf, int64_t v);
+
+private:
+  std::vector<unsigned char> Buf;
+  size_t                     Len;
+};
+
+// Writes an Avro object container file: the header with the schema and a
+// random sync marker, then blocks of records. Records accumulate in memory
+// until a block reaches blockSize, so that the stream sees few large writes.
+class AvroContainer {
+public:
+  static const size_t DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+
+  AvroContainer(std::ostream& out, const std::string& schema, size_t blockSize = DEFAULT_BLOCK_SIZE);
+  // writes no header, and blocks with head's sync marker, so that the output
+  // can be appended to head's
+  AvroContainer(std::ostream& out, const AvroContainer& head, size_t blockSize = DEFAULT_BLOCK_SIZE);
+  ~AvroContainer();
+
+  // encode one record into record(), then call endRecord()
+  AvroWriter& record() { return Block; }
+
+  void endRecord() {
+    ++Count;
+    if (Block.size() >= BlockSize) {
+      flush();
+    }
+  }
+
+  // writes out any pending records as a block
+  void flush();
+
+private:
+  std::ostream& Out;
+  AvroWriter    Block;
+  size_t        BlockSize;
+  uint64_t      Count;
+  unsigned char Sync[16];
+};
+
+// schemas for dumpfs records, with the given Fields::Group bits, and for the
+// disk and inode map rows
+std::string dirEntrySchema(unsigned int fields);
+extern const char DISK_MAP_SCHEMA[];
+extern const char INODE_MAP_SCHEMA[];
@@ -0,0 +1,370 @@
+#pragma once
+
+// Decoder for "dumpfs --format=binary". It is header-only, so ingest code
+// needs only this file and util.h.
+//
+// The stream is a sequence of records, each a varint payload length followed
+// by the payload. Integers are vintEncode() varints, with signed fields stored
+// as their two's-complement uint64_t. Strings and byte blobs are a varint
+// length and the raw bytes. IDs are their raw bytes; the JSON output has them
+// in hex. Fields in [brackets] are present only when the preceding contents
+// bits say so.
+//
+// FS record, written whenever the walk moves to another filesystem:
+//   type, byteOffset, blockSize, fsID, volName, volIndex
+//
+// FILE record, for the filesystem of the last FS record:
+//   type, id, parent, children, path, contents, [name], [meta]
+// name:
+//   flags, meta_addr, meta_seq, name, par_addr, par_seq, shrt_name, type
+// meta:
+//   addr, contents, [fields], [times], [attr count, attrs]
+// fields:
+//   content_len, flags, gid, [link], mode, nlink, seq, size, type, uid
+// times:
+//   atime, atime_nano, crtime, crtime_nano, ctime, ctime_nano,
+//   [time2, time2_nano], mtime, mtime_nano
+// attr:
+//   flags, id, name, size, type, rd_buf_size, nrd_allocsize, nrd_compsize,
+//   nrd_initsize, nrd_skiplen, contents, [rd_buf], [run count, runs, slack_size]
+// run:
+//   addr, flags, len, offset
+//
+// TOMBSTONE record, with --since, for an inode in the previous dump's index
+// that this dump didn't find; written after all the others:
+//   type, volIndex, addr, seq
+//
+// Groups left out with --fields are simply absent, their contents bits clear.
+//
+// Flags and types are TSK's numeric values; metaFlags() and friends in
+// enums.h turn them into the strings the JSON output has.
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+namespace BinRecord {
+  enum Type {
+    FS        = 0,
+    FILE      = 1,
+    TOMBSTONE = 2
+  };
+
+  enum FileContents {
+    HAS_NAME = 1,
+    HAS_META = 2
+  };
+
+  enum MetaContents {
+    HAS_LINK      = 1,
+    HAS_DTIME     = 2, // ext2/3/4
+    HAS_BKUP_TIME = 4, // HFS
+    HAS_FIELDS    = 8,
+    HAS_TIMES     = 16,
+    HAS_ATTRS     = 32
+  };
+
+  enum AttrContents {
+    HAS_RD_BUF = 1,
+    HAS_RUNS   = 2
+  };
+
+  struct FsInfo {
+    uint64_t    ByteOffset,
+                BlockSize;
+    std::string FsID; // raw bytes
+    std::string VolName;
+    uint64_t    VolIndex;
+  };
+
+  struct NameInfo {
+    uint64_t    Flags,
+                MetaAddr,
+                MetaSeq;
+    std::string Name;
+    uint64_t    ParAddr,
+                ParSeq;
+    std::string ShrtName;
+    uint64_t    Type;
+  };
+
+  struct RunInfo {
+    uint64_t Addr,
+             Flags,
+             Len,
+             Offset;
+  };
+
+  struct AttrInfo {
+    uint64_t             Flags,
+                         ID;
+    std::string          Name;
+    uint64_t             Size,
+                         Type,
+                         RdBufSize,
+                         NrdAllocSize,
+                         NrdCompSize,
+                         NrdInitSize,
+                         NrdSkipLen,
+                         Contents;
+    std::string          RdBuf;
+    std::vector<RunInfo> Runs;
+    uint64_t             SlackSize;
+  };
+
+  struct MetaInfo {
+    uint64_t              Addr,
+                          Atime,
+                          AtimeNano,
+                          ContentLen,
+                          Crtime,
+                          CrtimeNano,
+                          Ctime,
+                          CtimeNano,
+                          Flags,
+                          Gid,
+                          Contents;
+    std::string           Link;
+    uint64_t              Time2,
+                          Time2Nano,
+                          Mode,
+                          Mtime,
+                          MtimeNano,
+                          Nlink,
+                          Seq,
+                          Size,
+                          Type,
+                          Uid;
+    std::vector<AttrInfo> Attrs;
+  };
+
+  struct FileInfo {
+    std::string ID,
+                Parent,
+                Children,
+                Path;
+    uint64_t    Contents;
+    NameInfo    Name;
+    MetaInfo    Meta;
+  };
+
+  struct TombstoneInfo {
+    uint64_t VolIndex,
+             Addr,
+             Seq;
+  };
+
+  // Walks a buffer of records. The FsInfo and FileInfo it hands back are
+  // reused from record to record, so decoding doesn't allocate once they've grown.
+  class Reader {
+  public:
+    Reader(const void* data, size_t len):
+      Cur(static_cast<const unsigned char*>(data)), End(Cur + len), CurType(FS), CurFs(), CurFile(), CurTombstone() {}
+
+    // false at the end of the input or if a record is malformed
+    bool next() {
+      uint64_t len;
+      if (!varint(Cur, End, len) || len > uint64_t(End - Cur)) {
+        return false;
+      }
+      const unsigned char* beg = Cur;
+      const unsigned char* end = Cur + len;
+      Cur = end;
+      uint64_t type;
+      if (!varint(beg, end, type)) {
+        return false;
+      }
+      CurType = static_cast<Type>(type);
+      switch (type) {
+        case FS:
+          return readFs(beg, end);
+        case FILE:
+          return readFile(beg, end);
+        case TOMBSTONE:
+          return readTombstone(beg, end);
+        default:
+          return false;
+      }
+    }
+
+    Type                 type() const { return CurType; }
+    const FsInfo&        fs() const { return CurFs; }
+    const FileInfo&      file() const { return CurFile; }
+    const TombstoneInfo& tombstone() const { return CurTombstone; }
+
+  private:
+    static bool varint(const unsigned char*& cur, const unsigned char* end, uint64_t& val) {
+      if (cur >= end) {
+        return false;
+      }
+      const unsigned int first = *cur;
+      const unsigned int size = first < 241 ? 1: (first < 249 ? 2: (first == 249 ? 3: first - 246));
+      if (size > unsigned(end - cur)) {
+        return false;
+      }
+      cur += vintDecode(val, cur);
+      return true;
+    }
+
+    static bool str(const unsigned char*& cur, const unsigned char* end, std::string& s) {
+      uint64_t len;
+      if (!varint(cur, end, len) || len > uint64_t(end - cur)) {
+        return false;
+      }
+      s.assign(reinterpret_cast<const char*>(cur), len);
+      cur += len;
+      return true;
+    }
+
+    bool readFs(const unsigned char* cur, const unsigned char* end) {
+      return varint(cur, end, CurFs.ByteOffset)
+          && varint(cur, end, CurFs.BlockSize)
+          && str(cur, end, CurFs.FsID)
+          && str(cur, end, CurFs.VolName)
+          && varint(cur, end, CurFs.VolIndex);
+    }
+
+    static bool readName(const unsigned char*& cur, const unsigned char* end, NameInfo& n) {
+      return varint(cur, end, n.Flags)
+          && varint(cur, end, n.MetaAddr)
+          && varint(cur, end, n.MetaSeq)
+          && str(cur, end, n.Name)
+          && varint(cur, end, n.ParAddr)
+          && varint(cur, end, n.ParSeq)
+          && str(cur, end, n.ShrtName)
+          && varint(cur, end, n.Type);
+    }
+
+    static bool readAttr(const unsigned char*& cur, const unsigned char* end, AttrInfo& a) {
+      if (!(varint(cur, end, a.Flags)
+         && varint(cur, end, a.ID)
+         && str(cur, end, a.Name)
+         && varint(cur, end, a.Size)
+         && varint(cur, end, a.Type)
+         && varint(cur, end, a.RdBufSize)
+         && varint(cur, end, a.NrdAllocSize)
+         && varint(cur, end, a.NrdCompSize)
+         && varint(cur, end, a.NrdInitSize)
+         && varint(cur, end, a.NrdSkipLen)
+         && varint(cur, end, a.Contents)))
+      {
+        return false;
+      }
+      a.RdBuf.clear();
+      a.Runs.clear();
+      a.SlackSize = 0;
+      if ((a.Contents & HAS_RD_BUF) && !str(cur, end, a.RdBuf)) {
+        return false;
+      }
+      if (a.Contents & HAS_RUNS) {
+        uint64_t numRuns;
+        if (!varint(cur, end, numRuns) || numRuns > uint64_t(end - cur)) {
+          return false;
+        }
+        a.Runs.resize(numRuns);
+        for (RunInfo& r: a.Runs) {
+          if (!(varint(cur, end, r.Addr) && varint(cur, end, r.Flags) && varint(cur, end, r.Len) && varint(cur, end, r.Offset))) {
+            return false;
+          }
+        }
+        return varint(cur, end, a.SlackSize);
+      }
+      return true;
+    }
+
+    static bool readMeta(const unsigned char*& cur, const unsigned char* end, MetaInfo& m) {
+      if (!(varint(cur, end, m.Addr) && varint(cur, end, m.Contents))) {
+        return false;
+      }
+      m.ContentLen = m.Flags = m.Gid = m.Mode = m.Nlink = m.Seq = m.Size = m.Type = m.Uid = 0;
+      m.Atime = m.AtimeNano = m.Crtime = m.CrtimeNano = m.Ctime = m.CtimeNano = m.Mtime = m.MtimeNano = 0;
+      m.Time2 = m.Time2Nano = 0;
+      m.Link.clear();
+      m.Attrs.clear();
+      if (m.Contents & HAS_FIELDS) {
+        if (!(varint(cur, end, m.ContentLen)
+           && varint(cur, end, m.Flags)
+           && varint(cur, end, m.Gid)))
+        {
+          return false;
+        }
+        if ((m.Contents & HAS_LINK) && !str(cur, end, m.Link)) {
+          return false;
+        }
+        if (!(varint(cur, end, m.Mode)
+           && varint(cur, end, m.Nlink)
+           && varint(cur, end, m.Seq)
+           && varint(cur, end, m.Size)
+           && varint(cur, end, m.Type)
+           && varint(cur, end, m.Uid)))
+        {
+          return false;
+        }
+      }
+      if (m.Contents & HAS_TIMES) {
+        if (!(varint(cur, end, m.Atime)
+           && varint(cur, end, m.AtimeNano)
+           && varint(cur, end, m.Crtime)
+           && varint(cur, end, m.CrtimeNano)
+           && varint(cur, end, m.Ctime)
+           && varint(cur, end, m.CtimeNano)))
+        {
+          return false;
+        }
+        if ((m.Contents & (HAS_DTIME | HAS_BKUP_TIME)) && !(varint(cur, end, m.Time2) && varint(cur, end, m.Time2Nano))) {
+          return false;
+        }
+        if (!(varint(cur, end, m.Mtime) && varint(cur, end, m.MtimeNano))) {
+          return false;
+        }
+      }
+      if (m.Contents & HAS_ATTRS) {
+        uint64_t numAttrs;
+        if (!varint(cur, end, numAttrs) || numAttrs > uint64_t(end - cur)) {
+          return false;
+        }
+        m.Attrs.resize(numAttrs);
+        for (AttrInfo& a: m.Attrs) {
+          if (!readAttr(cur, end, a)) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    bool readFile(const unsigned char* cur, const unsigned char* end) {
+      if (!(str(cur, end, CurFile.ID)
+         && str(cur, end, CurFile.Parent)
+         && str(cur, end, CurFile.Children)
+         && str(cur, end, CurFile.Path)
+         && varint(cur, end, CurFile.Contents)))
+      {
+        return false;
+      }
+      if ((CurFile.Contents & HAS_NAME) && !readName(cur, end, CurFile.Name)) {
+        return false;
+      }
+      if ((CurFile.Contents & HAS_META) && !readMeta(cur, end, CurFile.Meta)) {
+        return false;
+      }
+      return cur == end;
+    }
+
+    bool readTombstone(const unsigned char* cur, const unsigned char* end) {
+      return varint(cur, end, CurTombstone.VolIndex)
+          && varint(cur, end, CurTombstone.Addr)
+          && varint(cur, end, CurTombstone.Seq)
+          && cur == end;
+    }
+
+    const unsigned char* Cur;
+    const unsigned char* End;
+
+    Type          CurType;
+    FsInfo        CurFs;
+    FileInfo      CurFile;
+    TombstoneInfo CurTombstone;
+  };
+}
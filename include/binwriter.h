@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+// Append-only buffer for encoding binary records (see binrecord.h). Like
+// JsonWriter, clear() keeps the capacity so it can be reused per record.
+class BinaryWriter {
+public:
+  BinaryWriter(size_t reserve = 64 * 1024): Buf(reserve ? reserve: 1), Len(0) {}
+
+  void clear() { Len = 0; }
+
+  const unsigned char* data() const { return Buf.data(); }
+  size_t               size() const { return Len; }
+
+  unsigned char* reserve(size_t n) {
+    if (Len + n > Buf.size()) {
+      size_t newSize = Buf.size() * 2;
+      while (newSize < Len + n) {
+        newSize *= 2;
+      }
+      Buf.resize(newSize);
+    }
+    return &Buf[Len];
+  }
+
+  void commit(size_t n) { Len += n; }
+
+  BinaryWriter& varint(uint64_t v) {
+    Len += vintEncode(reserve(MAX_VINT_SIZE), v);
+    return *this;
+  }
+
+  BinaryWriter& bytes(const void* p, size_t len) {
+    varint(len);
+    std::memcpy(reserve(len), p, len);
+    Len += len;
+    return *this;
+  }
+
+  BinaryWriter& str(const char* s) {
+    return bytes(s ? s: "", s ? std::strlen(s): 0);
+  }
+
+  BinaryWriter& str(const std::string& s) {
+    return bytes(s.data(), s.size());
+  }
+
+private:
+  std::vector<unsigned char> Buf;
+  size_t                     Len;
+};
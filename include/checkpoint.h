@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Where a dumpfs had got to, saved every so often to a small text file so
+// that an interrupted dump can be resumed after the last record it saved.
+struct Checkpoint {
+  uint64_t    Records,     // entries walked, written or not
+              DataWritten,
+              Offset;      // bytes of output, up to the end of the last record
+  uint32_t    NumVols;     // of the last record
+  std::string LastID,      // binary, as DirInfo::appendLastChild() made it
+              Path;        // of the last record's directory, within its filesystem
+  std::vector<std::pair<std::string, uint32_t>> Dirs; // path and count of each directory on the stack
+
+  Checkpoint(): Records(0), DataWritten(0), Offset(0), NumVols(0) {}
+
+  // writes to a temporary file and renames it over file, so that there is
+  // always a whole checkpoint there
+  bool save(const std::string& file) const;
+
+  bool load(const std::string& file);
+};
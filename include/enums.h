@@ -1,16 +1,19 @@
 #pragma once
 
-#include <string>
+#include <boost/utility/string_ref.hpp>
 
-std::string metaType(unsigned int type);
+// These return views of static tables, so they're cheap enough to call for
+// every record and can be copied straight into an output buffer.
 
-std::string nameType(unsigned int type);
+boost::string_ref metaType(unsigned int type);
 
-std::string metaFlags(unsigned int flags);
+boost::string_ref nameType(unsigned int type);
 
-std::string nameFlags(unsigned int flags);
+boost::string_ref metaFlags(unsigned int flags);
 
-std::string attrFlags(unsigned int flags);
+boost::string_ref nameFlags(unsigned int flags);
+
+boost::string_ref attrFlags(unsigned int flags);
 
 namespace RecordTypes {
   enum RecordTypes {
@@ -0,0 +1,16 @@
+#pragma once
+
+// Groups of dumpfs record fields, for --fields. Leaving a group out skips
+// the work of producing it as well as the output. The id, parent, children,
+// fs, and path fields, meta's addr, and the __link are always written.
+namespace Fields {
+  enum Group {
+    NAME   = 1,  // the name record
+    META   = 2,  // meta's size, mode, owner, flags, and the like
+    TIMES  = 4,  // meta's timestamps
+    ATTRS  = 8,  // meta's attrs; without them, TSK need not load attributes
+    RUNS   = 16, // attrs' nrd_runs and slack_size
+    RD_BUF = 32, // attrs' resident data
+    ALL    = 63
+  };
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <tsk/libtsk.h>
+
+// Decides which directory entries dumpfs writes. It looks only at the
+// TSK_FS_FILE, so entries that don't pass are never formatted, and a path
+// glob can rule out whole directories before they are read.
+class RecordFilter {
+public:
+  enum TYPES {
+    FILES  = 1,
+    DIRS   = 2,
+    LINKS  = 4,
+    OTHERS = 8,
+    ALL_TYPES = 15
+  };
+
+  enum ALLOC_STATE {
+    ANY_STATE,
+    ALLOCATED,
+    UNALLOCATED
+  };
+
+  enum TIME_FIELD {
+    MODIFIED,
+    ACCESSED,
+    CREATED,
+    METADATA,
+    ANY_TIME
+  };
+
+  RecordFilter();
+
+  // '*' and '?' match within a path component, "**" across components, and
+  // [...] is a set. A glob with no '/' is matched against the name alone,
+  // otherwise against the whole path within the filesystem.
+  void setPathGlob(const std::string& glob);
+  void setTypes(unsigned int types); // TYPES bits
+  void setSizeRange(uint64_t min, uint64_t max); // inclusive
+  void setTimeWindow(TIME_FIELD field, int64_t after, int64_t before); // after <= t < before
+  void setAllocState(ALLOC_STATE state);
+
+  bool empty() const { return Empty; }
+
+  // whether mayMatchBelow() can ever be false
+  bool prunesPaths() const { return !Glob.empty() && !NameOnly; }
+
+  // path is that of the entry's directory, as TSK gives it, e.g. "a/b/"
+  bool matches(const TSK_FS_FILE* file, const char* path) const;
+
+  // false if no entry under dirPath, which ends in '/', can match
+  bool mayMatchBelow(const std::string& dirPath) const;
+
+  // if prefix, whether some string starting with str could match
+  static bool globMatch(const char* glob, const char* str, bool prefix = false);
+
+  // "file,dir,link,other"
+  static bool parseTypes(const std::string& spec, unsigned int& types);
+
+  // seconds since the epoch, or UTC as 2012-06-27 or 2012-06-27T20:24:12[Z]
+  static bool parseTime(const std::string& spec, int64_t& t);
+
+private:
+  void update();
+
+  bool typeMatches(const TSK_FS_FILE* file) const;
+  bool timeMatches(const TSK_FS_META* meta) const;
+
+  bool         Empty,
+               NameOnly;
+  std::string  Glob;
+  unsigned int Types;
+  uint64_t     MinSize,
+               MaxSize;
+  TIME_FIELD   TimeField;
+  int64_t      After,
+               Before;
+  ALLOC_STATE  Alloc;
+
+  mutable std::string Scratch; // path + name, reused
+};
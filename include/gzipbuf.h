@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+class GzipDeflater;
+
+// A streambuf that gzips what's written to it and passes the result on to
+// another streambuf. The data is cut into blocks that are compressed
+// independently, each as its own gzip member, so that several threads can
+// work at once. Members are written out in order, and gunzip reads the
+// concatenation as a single stream.
+class ParallelGzipBuf: public std::streambuf {
+public:
+  static const size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+  // level is zlib's, 0-9 or -1 for the default; with threads <= 1,
+  // blocks are compressed on the writing thread
+  ParallelGzipBuf(std::streambuf* dest, int level, unsigned int threads, size_t blockSize = DEFAULT_BLOCK_SIZE);
+  virtual ~ParallelGzipBuf();
+
+protected:
+  virtual int_type overflow(int_type c);
+  virtual int sync();
+
+private:
+  struct Block {
+    std::vector<char>          In;
+    std::vector<unsigned char> Out;
+    size_t                     InLen,
+                               OutLen;
+    bool                       Done,
+                               Ok;
+  };
+
+  void submit();
+  void startBlock();
+  void writeBlock(Block* b);
+  void writeFinished(bool all);
+  void compress(GzipDeflater& deflater, Block* b);
+  void work(GzipDeflater* deflater);
+
+  std::streambuf* Dest;
+  size_t          BlockSize,
+                  MaxPending;
+  bool            Failed;
+
+  Block* Cur;
+  std::vector<std::unique_ptr<Block>> Blocks; // owns them all
+  std::vector<Block*> Free;
+  std::deque<Block*>  Pending, // submitted, in output order
+                      Queue;   // not yet picked up by a worker
+
+  std::vector<std::unique_ptr<GzipDeflater>> Deflaters; // one per worker
+  std::vector<std::thread>      Workers;
+  std::mutex                    Mutex;
+  std::condition_variable       WorkReady,
+                                BlockDone;
+  bool                          Stop;
+};
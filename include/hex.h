@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+
+// Writes 2 * (end - beg) lowercase hex digits to out, which must have room
+// for them; no terminator is added. Uses AVX2 or SSE2 when the CPU has them.
+void hexEncode(char* out, const unsigned char* beg, const unsigned char* end);
+
+// Portable version, which the SIMD paths use for their tails.
+void hexEncodeScalar(char* out, const unsigned char* beg, const unsigned char* end);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Each inode's seq, times and size, as one dump saw them, sorted by volume
+// index and address so that a later dump can look them up in place and
+// write only what changed. The file is an 8-byte magic, a 64-bit count and
+// then the Entries, in the writing machine's byte order. It is mapped into
+// memory rather than read, so it can be much bigger than the heap.
+class InodeIndex {
+public:
+  struct Entry {
+    uint64_t Addr;
+    uint32_t Vol,
+             Seq;
+    int64_t  MTime,
+             CTime;
+    uint64_t Size;
+
+    bool operator<(const Entry& other) const {
+      return Vol < other.Vol || (Vol == other.Vol && Addr < other.Addr);
+    }
+  };
+
+  InodeIndex();
+  ~InodeIndex();
+
+  bool open(const std::string& path);
+
+  const Entry* begin() const { return Entries; }
+  const Entry* end() const { return Entries + Count; }
+  size_t size() const { return Count; }
+
+  const Entry* find(uint32_t vol, uint64_t addr) const; // nullptr if it isn't there
+
+  // sorts entries and drops all but the first of each inode
+  static bool write(const std::string& path, std::vector<Entry>& entries);
+
+private:
+  InodeIndex(const InodeIndex&);
+  InodeIndex& operator=(const InodeIndex&);
+
+  void close();
+
+  const Entry* Entries;
+  size_t       Count;
+  void*        Map;
+  size_t       MapSize;
+  std::vector<Entry> Copy; // where there's no mmap()
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "hex.h"
+
+// Append-only buffer for formatting JSON records. clear() keeps the
+// allocated capacity, so a single writer can be reused for every record
+// without touching the heap once it has grown to the largest record.
+class JsonWriter {
+public:
+  JsonWriter(size_t reserve = 64 * 1024);
+
+  void clear() { Len = 0; }
+
+  const char* data() const { return Buf.data(); }
+  size_t      size() const { return Len; }
+
+  // reserves n more bytes and returns a pointer to them; call commit() with
+  // the number actually used
+  char* reserve(size_t n) {
+    if (Len + n > Buf.size()) {
+      grow(n);
+    }
+    return &Buf[Len];
+  }
+
+  void commit(size_t n) { Len += n; }
+
+  JsonWriter& raw(char c) {
+    *reserve(1) = c;
+    ++Len;
+    return *this;
+  }
+
+  JsonWriter& raw(const char* s, size_t len) {
+    std::memcpy(reserve(len), s, len);
+    Len += len;
+    return *this;
+  }
+
+  template<size_t N>
+  JsonWriter& raw(const char (&s)[N]) {
+    return raw(s, N - 1);
+  }
+
+  JsonWriter& raw(const std::string& s) {
+    return raw(s.data(), s.size());
+  }
+
+  JsonWriter& beginObject() { return raw('{'); }
+  JsonWriter& endObject() { return raw('}'); }
+
+  // writes the leading comma (unless first) and the quoted key with its colon
+  template<size_t N>
+  JsonWriter& key(const char (&k)[N], bool first = false) {
+    char* p = reserve(N + 3);
+    char* cur = p;
+    if (!first) {
+      *cur++ = ',';
+    }
+    *cur++ = '"';
+    std::memcpy(cur, k, N - 1);
+    cur += N - 1;
+    *cur++ = '"';
+    *cur++ = ':';
+    Len += cur - p;
+    return *this;
+  }
+
+  // strings are quoted but, as with j(), not escaped
+  JsonWriter& value(const char* s, size_t len) {
+    char* p = reserve(len + 2);
+    *p = '"';
+    std::memcpy(p + 1, s, len);
+    p[len + 1] = '"';
+    Len += len + 2;
+    return *this;
+  }
+
+  JsonWriter& value(const char* s) {
+    return value(s ? s: "", s ? std::strlen(s): 0);
+  }
+
+  JsonWriter& value(const std::string& s) {
+    return value(s.data(), s.size());
+  }
+
+  JsonWriter& value(boost::string_ref s) {
+    return value(s.data(), s.size());
+  }
+
+  // bytes, quoted as hex digits
+  JsonWriter& hex(const unsigned char* p, size_t len) {
+    char* out = reserve(2 * len + 2);
+    out[0] = '"';
+    hexEncode(out + 1, p, p + len);
+    out[2 * len + 1] = '"';
+    Len += 2 * len + 2;
+    return *this;
+  }
+
+  JsonWriter& hex(const std::string& bytes) {
+    return hex(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+  }
+
+  JsonWriter& value(unsigned long long v);
+  JsonWriter& value(long long v);
+
+  template<class T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, JsonWriter&>::type
+  value(T v) {
+    return value(static_cast<long long>(v));
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, JsonWriter&>::type
+  value(T v) {
+    return value(static_cast<unsigned long long>(v));
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_enum<T>::value, JsonWriter&>::type
+  value(T v) {
+    return value(static_cast<typename std::underlying_type<T>::type>(v));
+  }
+
+  template<size_t N, class T>
+  JsonWriter& pair(const char (&k)[N], const T& v, bool first = false) {
+    key(k, first);
+    return value(v);
+  }
+
+  template<size_t N>
+  JsonWriter& pair(const char (&k)[N], const char* s, size_t len, bool first = false) {
+    key(k, first);
+    return value(s, len);
+  }
+
+private:
+  void grow(size_t n);
+
+  std::vector<char> Buf;
+  size_t            Len;
+};
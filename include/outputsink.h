@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// A streambuf that writes to a file descriptor through a few large buffers,
+// so that the many small writes of record output turn into a handful of
+// system calls. Writes bigger than the buffer go straight to the descriptor
+// along with whatever was buffered, in a single writev().
+//
+// On Linux, when the descriptor is a pipe, full buffers are handed to the
+// kernel with vmsplice() instead of being copied. The pipe is grown to the
+// buffer size if it can be, and a buffer is only reused once a whole pipe's
+// worth of data has been spliced after it, which means the reader has
+// consumed it.
+class OutputSink: public std::streambuf {
+public:
+  static const size_t DEFAULT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+  // does not take ownership of fd
+  OutputSink(int fd, size_t bufSize = DEFAULT_BUFFER_SIZE);
+
+  // creates or truncates path; throws std::runtime_error if it can't
+  OutputSink(const std::string& path, size_t bufSize = DEFAULT_BUFFER_SIZE);
+
+  virtual ~OutputSink();
+
+  uint64_t bytesWritten() const { return BytesWritten; }
+
+  bool usingSplice() const { return Splice; }
+
+protected:
+  virtual int_type overflow(int_type c);
+  virtual std::streamsize xsputn(const char* s, std::streamsize n);
+  virtual int sync();
+
+private:
+  void init();
+  bool flushBuffer();
+  bool writeAll(const char* s, size_t n);
+  bool writeAll(const char* s1, size_t n1, const char* s2, size_t n2);
+  bool spliceAll(char* s, size_t n);
+
+  int    Fd;
+  bool   OwnFd,
+         Splice,
+         Failed;
+  size_t BufSize;
+
+  std::vector<char*> Buffers; // two when splicing, otherwise one
+  unsigned int       CurBuf;
+
+  uint64_t BytesWritten;
+};
+
+// An anonymous temporary file, written through an OutputSink, for output
+// that has to wait for what comes before it. copyTo() appends all of it to
+// where it belongs; the file is gone once the SpoolFile is.
+class SpoolFile {
+public:
+  // throws std::runtime_error if the file can't be created
+  explicit SpoolFile(size_t bufSize = OutputSink::DEFAULT_BUFFER_SIZE);
+
+  ~SpoolFile();
+
+  std::ostream& out() { return *Out; }
+
+  void copyTo(std::ostream& dest);
+
+private:
+  SpoolFile(const SpoolFile&);
+  SpoolFile& operator=(const SpoolFile&);
+
+  size_t                        BufSize;
+  std::FILE*                    File;
+  std::unique_ptr<OutputSink>   Sink;
+  std::unique_ptr<std::ostream> Out;
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// The disk map's fragments and their owners, in disk map order, so that the
+// files owning a byte can be found without reading the whole map. Each
+// volume's fragments are in offset order and don't overlap, but volumes'
+// fragments can overlap one another's, so each volume is searched on its
+// own. The file is a header, the Fragments, the Owners and then a Volume
+// for each volume, in the writing machine's byte order. A fragment's owners
+// are consecutive Owners. As with InodeIndex, the file is mapped into memory
+// rather than read.
+class OwnerIndex {
+public:
+  struct Fragment {
+    uint64_t Beg,
+             End,
+             FirstOwner; // index into the Owners
+    uint32_t Vol,
+             NumOwners;
+  };
+
+  struct Owner {
+    uint64_t Addr,
+             DrBeg,  // where its data run begins on disk
+             Offset; // of DrBeg, in the file
+    uint32_t AttrID,
+             Slack;
+  };
+
+  struct Volume {
+    uint64_t FirstFragment,
+             NumFragments;
+    uint32_t Vol,
+             Reserved;
+  };
+
+  OwnerIndex();
+  ~OwnerIndex();
+
+  bool open(const std::string& path);
+
+  uint32_t sectorSize() const { return SectorSize; }
+  size_t size() const { return NumFragments; }
+
+  const Owner* ownersBegin(const Fragment& f) const { return Owners + f.FirstOwner; }
+  const Owner* ownersEnd(const Fragment& f) const { return Owners + f.FirstOwner + f.NumOwners; }
+
+  // replaces found with the fragments containing offset, at most one per volume
+  void find(uint64_t offset, std::vector<const Fragment*>& found) const;
+
+  // Writes an index a fragment at a time, in disk map order: fragment(), then
+  // owner() for each of its owners. The owners wait in a temporary file
+  // until close(), as they're written after all the fragments.
+  class Writer {
+  public:
+    Writer(const std::string& path, uint32_t sectorSize); // throws std::runtime_error if it can't create its files
+    ~Writer();
+
+    void fragment(uint32_t vol, uint64_t beg, uint64_t end);
+    void owner(const Owner& o);
+
+    bool close(); // false if anything couldn't be written
+
+  private:
+    Writer(const Writer&);
+    Writer& operator=(const Writer&);
+
+    void flushFragment();
+
+    std::string         Path;
+    std::FILE*          Out;
+    std::FILE*          OwnerFile;
+    uint32_t            SectorSize;
+    Fragment            Cur;
+    bool                HaveCur,
+                        Failed;
+    uint64_t            NumFragments,
+                        NumOwners;
+    std::vector<Volume> Volumes;
+  };
+
+private:
+  OwnerIndex(const OwnerIndex&);
+  OwnerIndex& operator=(const OwnerIndex&);
+
+  void close();
+
+  const Fragment* Fragments;
+  const Owner*    Owners;
+  const Volume*   Volumes;
+  size_t          NumFragments,
+                  NumVolumes;
+  uint32_t        SectorSize;
+  void*           Map;
+  size_t          MapSize;
+  std::vector<char> Copy; // where there's no mmap()
+};
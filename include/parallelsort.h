@@ -0,0 +1,20 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+
+// std::sort, with the halves sorted on separate threads and then merged,
+// down to pieces too small to be worth a thread.
+template<class Itr, class Less>
+void parallelSort(Itr beg, Itr end, Less less, unsigned int threads) {
+  const auto n = end - beg;
+  if (threads < 2 || n < 1 << 16) {
+    std::sort(beg, end, less);
+    return;
+  }
+  const Itr mid = beg + n / 2;
+  auto left = std::async(std::launch::async, [=]() { parallelSort(beg, mid, less, threads / 2); });
+  parallelSort(mid, end, less, threads - threads / 2);
+  left.get();
+  std::inplace_merge(beg, mid, end, less);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+// With --max-memory, the disk map's runs and the inode map's IDs are written
+// to temporary files whenever they grow past the limit, each file sorted as
+// its map was, and merged back together when the maps are output.
+
+// a data run of a file's attribute, as the disk map keeps it
+struct RunRecord {
+  uint64_t Beg,
+           End,
+           Addr,
+           DrBeg,
+           Offset;
+  uint32_t Vol,
+           AttrID;
+  bool     Slack;
+};
+
+inline bool operator==(const RunRecord& a, const RunRecord& b) {
+  return a.Beg == b.Beg && a.End == b.End && a.Addr == b.Addr && a.DrBeg == b.DrBeg &&
+         a.Offset == b.Offset && a.Vol == b.Vol && a.AttrID == b.AttrID && a.Slack == b.Slack;
+}
+
+struct InodeRecord {
+  uint32_t    Vol;
+  uint64_t    Addr;
+  std::string ID; // binary, as the file's record ID before it's hex-encoded
+};
+
+inline bool operator==(const InodeRecord& a, const InodeRecord& b) {
+  return a.Vol == b.Vol && a.Addr == b.Addr && a.ID == b.ID;
+}
+
+struct RunOrder {
+  bool operator()(const RunRecord& a, const RunRecord& b) const {
+    return a.Vol < b.Vol || (a.Vol == b.Vol && a.Beg < b.Beg);
+  }
+};
+
+struct InodeOrder {
+  bool operator()(const InodeRecord& a, const InodeRecord& b) const {
+    return a.Vol < b.Vol || (a.Vol == b.Vol && a.Addr < b.Addr);
+  }
+};
+
+// An anonymous temporary file, gone once it's closed. Records are written,
+// then read back after rewind(), as often as need be.
+class SpillFile {
+public:
+  explicit SpillFile(unsigned int level = 0); // throws std::runtime_error if there's no temporary file to be had
+  ~SpillFile();
+
+  unsigned int level() const { return Level; } // how many merges its records have been through
+
+  void write(const RunRecord& r);
+  void write(const InodeRecord& r);
+
+  void rewind();
+
+  bool read(RunRecord& r); // false at the end
+  bool read(InodeRecord& r);
+
+private:
+  SpillFile(const SpillFile&);
+  SpillFile& operator=(const SpillFile&);
+
+  void write(const void* data, size_t len);
+
+  std::FILE*   File;
+  unsigned int Level;
+};
+
+typedef std::vector<std::unique_ptr<SpillFile>> SpillFiles; // in the order they were written
+
+// Reads files[beg, end) as one sorted stream. Records that are equal by Less
+// come out in file order, and within a file in the order they were written.
+template<class Record, class Less>
+class SpillMerge {
+public:
+  SpillMerge(const SpillFiles& files, size_t beg, size_t end): Files(files) {
+    for (size_t i = beg; i < end; ++i) {
+      Files[i]->rewind();
+      advance(i);
+    }
+  }
+
+  bool empty() const { return Heads.empty(); }
+  const Record& top() const { return Heads.top().first; }
+
+  void pop() {
+    const size_t i = Heads.top().second;
+    Heads.pop();
+    advance(i);
+  }
+
+private:
+  typedef std::pair<Record, size_t> Head; // and its file
+
+  struct Later {
+    bool operator()(const Head& a, const Head& b) const {
+      Less less;
+      return less(b.first, a.first) || (!less(a.first, b.first) && a.second > b.second);
+    }
+  };
+
+  void advance(size_t i) {
+    Record r;
+    if (Files[i]->read(r)) {
+      Heads.emplace(std::move(r), i);
+    }
+  }
+
+  const SpillFiles& Files;
+  std::priority_queue<Head, std::vector<Head>, Later> Heads;
+};
+
+// Whenever the last few files are of the same level, merges them into one
+// of the next, so that there are only ever a few files per level.
+void compactRuns(SpillFiles& files);
+void compactInodes(SpillFiles& files);
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "walkers.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+// Threads that tree walks may still start, shared by all of a dump's walkers.
+class ThreadBudget {
+public:
+  explicit ThreadBudget(unsigned int threads): Free(threads) {}
+
+  bool available() const { return Free.load(std::memory_order_relaxed) > 0; }
+
+  bool take();
+  void give(unsigned int threads) { Free += threads; }
+
+private:
+  std::atomic<unsigned int> Free;
+};
+
+// A worker's output, kept in memory until there's more than limit of it in
+// the current segment, and then spooled to a temporary file, so that the
+// segments waiting on those before them don't pile up in memory.
+class SegmentBuf: public std::streambuf {
+public:
+  explicit SegmentBuf(size_t limit): Limit(limit) {}
+
+  // hands over the segment's output, in data or, if spooled, in spool
+  void take(std::string& data, std::unique_ptr<SpoolFile>& spool);
+
+protected:
+  virtual int_type overflow(int_type c);
+  virtual std::streamsize xsputn(const char* s, std::streamsize n);
+
+private:
+  size_t                     Limit;
+  std::string                Data;
+  std::unique_ptr<SpoolFile> Spool;
+};
+
+// Walks one filesystem's directory tree with several threads. Each worker has
+// its own MetadataWriter and TSK_FS_INFO. Rather than descend into a
+// subdirectory, a worker hands it to an idle worker, or to a new one if the
+// budget allows. A hand-off splits the worker's output, so output is kept in
+// segments, which go to the parent walker in the order a serial walk would
+// have written them. IDs come out the same, since each subdirectory is walked
+// with a copy of the DirInfo stack it would have had.
+class TreeWalk {
+public:
+  TreeWalk(MetadataWriter& parent, TSK_FS_INFO* fs, ThreadBudget& budget);
+
+  void run(); // returns when the walk is done and written
+
+private:
+  struct Segment {
+    std::string Data;
+    std::unique_ptr<SpoolFile> Spool; // the output instead of Data, if it was big
+    MetadataWriter::ReverseInodeMapType Inodes;
+    SpillFiles InodeSpills; // spilled IDs, which come before Inodes
+    std::vector<InodeRecord> SinkRows;
+    bool Done;
+
+    Segment(): Done(false) {}
+  };
+
+  typedef std::list<Segment>::iterator SegmentItr;
+
+  struct Task {
+    TSK_INUM_T              Addr;
+    std::string             Path;
+    std::vector<TSK_INUM_T> Seen; // directories from the root to this one, for catching loops
+    std::vector<DirInfo>    Dirs;
+    SegmentItr              Seg;
+    bool                    Root;
+  };
+
+  struct Worker {
+    SegmentBuf                      Buf;
+    std::ostream                    Out;
+    std::unique_ptr<MetadataWriter> Walker;
+    TSK_FS_INFO*                    Fs;
+    bool                            OwnsFs;
+    SegmentItr                      Seg;
+    std::thread                     Thread;
+
+    Worker(): Buf(SPOOL_SIZE), Out(&Buf) {}
+  };
+
+  static const size_t SPOOL_SIZE = 1024 * 1024;
+
+  void startWorker(TSK_FS_INFO* fs); // call with Lock held
+  void work(Worker& w);
+  bool handOff(Worker& w, TSK_INUM_T addr, const std::string& path, const std::vector<TSK_INUM_T>& seen);
+  void finishSegment(Worker& w, SegmentItr seg);
+  void write(std::list<Segment>& ready);
+
+  MetadataWriter& Parent;
+  TSK_FS_INFO*    Fs;
+  ThreadBudget&   Budget;
+
+  std::mutex              Lock;
+  std::condition_variable Work,  // for workers: a task is queued, or the walk is done
+                          Ready; // for run(): the first segment is done, or the walk is
+  std::list<Segment>      Segments;
+  std::deque<Task>        Queue;
+  std::list<Worker>       Workers;
+  std::atomic<unsigned int> Idle;
+  unsigned int            Pending; // tasks queued or being walked
+  bool                    Finished;
+  std::vector<DirInfo>    RootDirs; // the parent's Dirs, as the root's walk left them
+};
@@ -6,14 +6,105 @@
 static const unsigned int MAX_VINT_SIZE = 9;
 
 unsigned int vintEncode(unsigned char* buf, uint64_t val);
-unsigned int vintDecode(uint64_t& val, const unsigned char* buf);
+
+// vintDecode is inline so that the binary record decoder can be header-only
+template<unsigned int N>
+inline void readBigEndian(const unsigned char* buf, uint64_t& val) {
+  constexpr unsigned int shift = (N - 1) * 8;
+  val |= (uint64_t)*buf << shift;
+  readBigEndian<N-1>(buf + 1, val);
+}
+
+template<>
+inline void readBigEndian<1>(const unsigned char* buf, uint64_t& val) {
+  val |= *buf;
+}
+
+inline unsigned int vintDecode(uint64_t& val, const unsigned char* buf) {
+  if (buf == nullptr) {
+    return 0;
+  }
+  val = 0;
+  int diff = buf[0] - 241;
+  switch (diff) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+    case 5:
+    case 6:
+    case 7: // 241-248
+      val = 256*diff + buf[1] + 240;
+      return 2;
+      break;
+    case 8: // 249
+      val = 2288 + 256*buf[1] + buf[2];
+      return 3;
+      break;
+    case 9: // 250
+      readBigEndian<3>(&buf[1], val);
+      return 4;
+      break;
+    case 10:
+      readBigEndian<4>(&buf[1], val);
+      return 5;
+      break;
+    case 11:
+      readBigEndian<5>(&buf[1], val);
+      return 6;
+      break;
+    case 12:
+      readBigEndian<6>(&buf[1], val);
+      return 7;
+      break;
+    case 13:
+      readBigEndian<7>(&buf[1], val);
+      return 8;
+      break;
+    case 14:
+      readBigEndian<8>(&buf[1], val);
+      return 9;
+      break;
+    default:
+      val = buf[0];
+      return 1;
+  }
+}
 
 std::string appendVarint(const std::string& base, const unsigned int val);
 
 std::string formatTimestamp(uint32_t unix, uint32_t ns);
 
+// Writes the same ISO-8601 text as formatTimestamp() into a caller buffer of
+// at least MAX_SIZE bytes, without allocating. The "YYYY-MM-DDTHH:MM:SS"
+// prefix of the last second formatted is cached, since neighboring files
+// tend to share timestamps.
+class TimestampFormatter {
+public:
+  static const unsigned int MAX_SIZE = 29;
+
+  TimestampFormatter();
+
+  unsigned int format(char* buf, uint32_t unix, uint32_t ns);
+
+private:
+  void formatPrefix(uint32_t unix);
+
+  uint32_t LastSecond;
+  bool     HavePrefix;
+  char     Prefix[19];
+};
+
 
 std::string bytesAsString(const unsigned char* idBeg, const unsigned char* idEnd);
 
+// hex IDs: record type byte, then the big-endian fields
+static const unsigned int INODE_ID_SIZE = 26;
+static const unsigned int DISK_MAP_ID_SIZE = 18;
+
+void writeInodeID(char* buf, uint32_t volIndex, uint64_t inum);
+void writeDiskMapID(char* buf, uint64_t offset);
+
 std::string makeInodeID(uint32_t volIndex, uint64_t inum);
 std::string makeDiskMapID(uint64_t offset);
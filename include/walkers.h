@@ -1,13 +1,33 @@
 #pragma once
 
 #include "tsk.h"
-
-#include <boost/icl/interval_map.hpp>
-
+#include "jsonwriter.h"
+#include "binwriter.h"
+#include "checkpoint.h"
+#include "avro.h"
+#include "fields.h"
+#include "filter.h"
+#include "inodeindex.h"
+#include "outputsink.h"
+#include "spill.h"
+#include "util.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
 #include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include <vector>
 
 std::ostream& operator<<(std::ostream& out, const Image& img);
 
+class ThreadBudget;
+
 struct Extent {
   std::string FileID,
               StreamID;
@@ -30,10 +50,19 @@ public:
   std::string lastChild() const;
   uint32_t    childLevel() const;
   void        incCount();
+  void        setCount(uint32_t count) { Count = count; } // to return to an entry's place in the walk
+
+  // binary forms of id() and lastChild(), appended to buf; hex is for output
+  void appendID(std::string& buf) const { appendID(buf, Level, false); }
+  void appendLastChild(std::string& buf) const { appendID(buf, childLevel(), true); }
+  // newChild("").lastChild(), without making the child
+  void appendLastChildsChildren(std::string& buf) const { appendID(buf, childLevel() + 1, true); }
 
 private:
+  void appendID(std::string& buf, uint32_t level, bool lastChild) const;
+
   std::string Path;
-  std::string BareID;
+  std::string BareID; // varint child indices from the root, as bytes
   uint32_t    Level;
   uint32_t    Count;
 };
@@ -47,10 +76,39 @@ public:
     SINGLE
   };
 
+  enum OUTPUT_FORMAT {
+    JSON,
+    BINARY,
+    AVRO
+  };
+
+  enum SCAN_ORDER {
+    DIRECTORY, // records in the order of the directory walk
+    INODE      // records in inode order, read in one pass over the inodes
+  };
+
+  enum UNALLOCATED_SOURCE {
+    RUNS,  // the gaps between the data runs of the files walked
+    BITMAP // the blocks the filesystem has unallocated, from tsk_fs_block_walk()
+  };
+
   virtual ~LbtTskAuto() {}
 
+  virtual void setOutputFormat(const OUTPUT_FORMAT) {}
+  virtual void setFields(const unsigned int) {} // Fields::Group bits; set before the output format
+  virtual void setBuildDiskMap(const bool) {}
+  virtual void setBuildInodeMap(const bool) {}
+  virtual void setFilter(const RecordFilter&) {}
+  virtual void setThreads(const unsigned int) {}
+  virtual void setScanOrder(const SCAN_ORDER) {}
   virtual void setUnallocatedMode(const UNALLOCATED_HANDLING) {}
+  virtual void setUnallocatedSource(const UNALLOCATED_SOURCE) {}
   virtual void setMaxUnallocatedBlockSize(const uint64_t) {}
+  virtual void setCheckpoints(const std::string&, const uint64_t) {} // file, and records between checkpoints
+  virtual bool resume(const std::string&) { return false; } // from a checkpoint file
+  virtual void setIndexFile(const std::string&) {}
+  virtual bool setSince(const std::string&) { return false; } // a previous dump's index file
+  virtual void setMaxMemory(const uint64_t) {} // bytes for the disk and inode maps; 0 for no limit
 
   virtual uint8_t start();
 
@@ -58,10 +116,11 @@ public:
 
   virtual TSK_RETVAL_ENUM processFile(TSK_FS_FILE*, const char*) { return TSK_OK; }
 
-  virtual void startUnallocated() {}
-
   virtual void finishWalk() {}
 
+  // getErrorList(), and the errors of any walkers it ran on other threads
+  virtual std::vector<error_record> errors() { return getErrorList(); }
+
   std::shared_ptr<Image> getImage(const std::vector<std::string>& files) const;
 };
 
@@ -113,19 +172,42 @@ public:
   //                 addr,     attrID,   slack, drbeg     offset
   typedef std::tuple<uint64_t, uint32_t, bool,  uint64_t, uint64_t> AttrRunInfo;
   typedef std::set<AttrRunInfo> AttrSet;
-  typedef boost::icl::interval_map<uint64_t, AttrSet> FsMap;
-  typedef std::tuple<uint32_t, uint64_t, uint64_t, FsMap> FsMapInfo;
+  typedef std::vector<RunRecord> RunTable; // appended to during the walk, and sorted after
+  typedef std::tuple<uint32_t, uint64_t, uint64_t, RunTable> FsMapInfo;
   typedef std::map<uint32_t, FsMapInfo> DiskMap; // FS index as key
 
-  // FS index -> inode -> [IDs]
-  typedef std::map<uint32_t, std::map<uint64_t, std::vector<std::string>>> ReverseInodeMapType;
+  typedef std::vector<InodeRecord> InodeTable; // appended to during the walk, and sorted after
+  typedef std::map<uint32_t, InodeTable> ReverseInodeMapType; // FS index as key
+
+  typedef std::function<void(uint32_t vol, uint64_t beg, uint64_t end, const AttrSet& owners)> FragmentFn;
+  typedef std::function<void(uint32_t vol, uint64_t addr, const std::vector<std::string>& ids)> InodeFn;
+
+  static const uint32_t ALL_VOLS = std::numeric_limits<uint32_t>::max();
 
   MetadataWriter(std::ostream& out);
 
   virtual ~MetadataWriter() {}
 
+  virtual void setOutputFormat(const OUTPUT_FORMAT format);
+  virtual void setFields(const unsigned int fields) { RecordFields = fields; }
+  virtual void setBuildDiskMap(const bool build) { BuildDiskMap = build; }
+  virtual void setBuildInodeMap(const bool build) { BuildInodeMap = build; }
+  virtual void setFilter(const RecordFilter& filter) { Filter = filter; }
+  virtual void setThreads(const unsigned int threads);
+  virtual void setScanOrder(const SCAN_ORDER order) { ScanOrder = order; }
   virtual void setUnallocatedMode(const UNALLOCATED_HANDLING mode) { UCMode = mode; }
+  virtual void setUnallocatedSource(const UNALLOCATED_SOURCE source) { UCSource = source; }
   virtual void setMaxUnallocatedBlockSize(const uint64_t maxBlocks) { MaxUnallocatedBlockSize = maxBlocks; }
+  virtual void setCheckpoints(const std::string& file, const uint64_t every);
+  virtual bool resume(const std::string& file);
+  virtual void setIndexFile(const std::string& file) { IndexFile = file; }
+  virtual bool setSince(const std::string& file);
+  virtual void setMaxMemory(const uint64_t bytes) { MaxMemory = bytes; }
+
+  // Where inode map rows go during the walk, for inodes that can only have
+  // the one name: allocated, not directories, with nlink <= 1, found under
+  // an allocated name. Only the other inodes are kept until the walk is done.
+  void setInodeSink(const InodeFn& fn) { InodeSink = fn; StreamInodes = bool(fn); }
 
   virtual uint8_t start();
 
@@ -134,19 +216,40 @@ public:
 
   virtual TSK_RETVAL_ENUM processFile(TSK_FS_FILE *fs_file, const char *path);
 
-  virtual void startUnallocated();
-
   virtual void finishWalk();
 
-  const DiskMap& diskMap() const { return AllocatedRuns; }
+  virtual std::vector<error_record> errors();
+
+  const DiskMap& diskMap() const { return AllocatedRuns; } // only what hasn't been spilled
   const ReverseInodeMapType& reverseMap() const { return ReverseMap; }
 
+  // The disk map's fragments in order, and the inode map's inodes, merged
+  // from memory and whatever was spilled. Not for use during the walk.
+  void forEachFragment(const FragmentFn& fn, uint32_t vol = ALL_VOLS);
+  void forEachInode(const InodeFn& fn, uint32_t vol = ALL_VOLS);
+
+  // Whether the inode's row went to the inode sink, so that a row for it
+  // from forEachInode(), of deleted names found for it as well, is its
+  // second. Only for use in forEachInode()'s fn.
+  bool sunk(uint32_t vol, uint64_t addr) const;
+
+  // The volumes in each map, in order. Different volumes can be read at
+  // once, on different threads. A spilled map can only be read whole, so
+  // then it's just ALL_VOLS.
+  std::vector<uint32_t> diskMapVolumes() const;
+  std::vector<uint32_t> inodeMapVolumes() const;
+
   uint64_t diskSize() const { return DiskSize; }
   uint32_t sectorSize() const { return SectorSize; }
+  unsigned int threads() const { return Threads; }
 
   static bool makeUnallocatedDataRun(TSK_DADDR_T start, TSK_DADDR_T end, TSK_FS_ATTR_RUN& datarun);
 
 protected:
+  friend class TreeWalk;
+
+  MetadataWriter(std::ostream& out, const MetadataWriter& parent); // for walking one of parent's volumes or directories
+
   const TSK_VS_PART_INFO* Part;
   TSK_FS_INFO*      Fs;
 
@@ -163,25 +266,187 @@ protected:
   uint32_t    SectorSize,
               NumVols;
 
-  bool        InUnallocated;
+  bool        BuildDiskMap, // record runs in AllocatedRuns even when UCMode is NONE
+              BuildInodeMap; // record written entries' IDs in ReverseMap
 
   UNALLOCATED_HANDLING UCMode;
+  UNALLOCATED_SOURCE   UCSource;
+  OUTPUT_FORMAT        Format;
+  unsigned int         RecordFields;
+  RecordFilter         Filter;
+  unsigned int         Threads; // volumes walked at once
+  std::shared_ptr<ThreadBudget> Budget; // extra threads for walking directories, shared with child walkers; null if serial
+  SCAN_ORDER           ScanOrder;
+
+  std::string CheckpointFile; // empty if not checkpointing
+  uint64_t    CheckpointEvery,
+              NextCheckpoint, // NumFiles at which to save one, after the next written entry
+              OutputOffset;   // bytes written to Out
+  bool        Resuming;       // skipping the entries that were written before Resume
+  Checkpoint  Resume;
+
+  // For --index-file and --since. Child walkers share the previous index,
+  // and their entries are merged into ours.
+  struct SinceIndex {
+    InodeIndex                           Index;
+    std::unique_ptr<std::atomic<bool>[]> Seen; // by position in Index
+  };
 
-  DiskMap AllocatedRuns; // FS index->interval->inodes
-  std::map<uint32_t, unsigned int> NumRootEntries; // FS index->count
+  std::string                    IndexFile; // empty if not writing one
+  std::vector<InodeIndex::Entry> IndexEntries;
+  std::shared_ptr<SinceIndex>    Since; // null unless writing only what changed
+
+  DiskMap AllocatedRuns; // FS index->runs
   decltype(AllocatedRuns.begin()) CurAllocatedItr;
 
   ReverseInodeMapType ReverseMap;
 
+  // For --max-memory. The byte counts are estimates of what the maps hold.
+  uint64_t   MaxMemory, // 0 for no limit
+             RunBytes,
+             InodeBytes;
+  SpillFiles RunSpills,
+             InodeSpills;
+
+  std::vector<error_record> ChildErrors; // from mergeWalk()
+
+  bool                     StreamInodes; // whether mapInode() may give rows to InodeSink
+  InodeFn                  InodeSink;    // only set on the top walker
+  std::vector<InodeRecord> SinkRows;     // for InodeSink, in walk order, waiting on a walker without it
+  std::vector<std::string> SinkIDs;
+  std::map<uint32_t, std::vector<uint64_t>> Sunk; // by volume, the inodes InodeSink has had a row for; sorted by forEachInode()
+
+  bool needRuns() const { return BuildDiskMap || (NONE != UCMode && RUNS == UCSource); } // whether AllocatedRuns is kept
+
   void setCurDir(const char* path);
   void setFsInfo(TSK_FS_INFO* fs, uint64_t startSector, uint64_t endSector);
   void resetPartitionRange();
   void setPartitionRange(uint64_t begin, uint64_t end);
 
-  void writeFile(std::ostream& out, const TSK_FS_FILE* file);
-  void writeNameRecord(std::ostream& out, const TSK_FS_NAME* n);
-  void writeMetaRecord(std::ostream& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs);
-  void writeAttr(std::ostream& out, TSK_INUM_T addr, const TSK_FS_ATTR* attr);
+  void writeFile(JsonWriter& out, const TSK_FS_FILE* file);
+  void setRecordIDs(); // of the entry about to be written
+  void writeNameRecord(JsonWriter& out, const TSK_FS_NAME* n);
+  void writeMetaRecord(JsonWriter& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs);
+  void writeAttr(JsonWriter& out, TSK_INUM_T addr, const TSK_FS_ATTR* attr);
+
+  void writeFile(BinaryWriter& out, const TSK_FS_FILE* file);
+  void writeNameRecord(BinaryWriter& out, const TSK_FS_NAME* n);
+  void writeMetaRecord(BinaryWriter& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs);
+  void writeAttr(BinaryWriter& out, TSK_INUM_T addr, const TSK_FS_ATTR* attr);
+  void writeBinaryRecord();
+
+  void writeFile(AvroWriter& out, const TSK_FS_FILE* file);
+  void writeNameRecord(AvroWriter& out, const TSK_FS_NAME* n);
+  void writeMetaRecord(AvroWriter& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs);
+  void writeAttr(AvroWriter& out, TSK_INUM_T addr, const TSK_FS_ATTR* attr);
+
+  void collectAttrs(const TSK_FS_FILE* file);
+  uint64_t markAttrRuns(TSK_INUM_T addr, const TSK_FS_ATTR* a); // returns slack size
+  void markFileRuns(const TSK_FS_FILE* file); // for when the runs aren't written
+  void markCollectedRuns(TSK_INUM_T addr); // runs of the nonresident attrs in Attrs
+
+  bool canPrune() const; // whether walkDir() may skip directories the filter rules out
+  bool entersDir(TSK_FS_FILE* file); // whether walkDir() walks what's below it, if it's not in seen
+  bool entersDir(const TSK_FS_NAME* n, TSK_FS_META* m); // likewise, for n with m loaded for it regardless
+  void walkDir(TSK_FS_DIR* dir, std::string& path, std::vector<TSK_INUM_T>& seen); // closes dir
+  void walkFile(TSK_FS_FILE* file, std::string& path, std::vector<TSK_INUM_T>& seen); // and below it, if it's a directory
+
+  // How walkDir() and TreeWalk get at the filesystem. Virtual so that the
+  // tests can walk a made-up tree, without TSK.
+  virtual void walkDirAt(TSK_INUM_T addr, std::string& path, std::vector<TSK_INUM_T>& seen); // addr must be in seen
+  virtual MetadataWriter* newWorker(std::ostream& out) const { return new MetadataWriter(out, *this); }
+  virtual TSK_FS_INFO* openFs(TSK_OFF_T offset, TSK_FS_TYPE_ENUM type) const; // a handle of our own, for another thread
+  virtual void closeFs(TSK_FS_INFO* fs) const;
+
+  // set on TreeWalk workers; true if another worker took the directory
+  std::function<bool (TSK_INUM_T, const std::string&, const std::vector<TSK_INUM_T>&)> HandOff;
+
+  void shareFs(const MetadataWriter& walker, TSK_FS_INFO* fs); // as setFsInfo() left walker, but with fs
+
+  // For --scan-order=inode, the names are walked first, without loading
+  // their inodes, and then joined with the inodes in a tsk_fs_meta_walk().
+  struct NameEdge {
+    TSK_INUM_T Addr, // meta_addr, the join key
+               ParAddr;
+    size_t     Name; // offset in NameList::Strings of name and then shrt_name, each NUL-terminated
+    uint32_t   NameSize,
+               ShrtNameSize,
+               MetaSeq,
+               ParSeq,
+               Dir,   // index in NameList::Dirs
+               Count; // the directory's count() at the entry
+    TSK_FS_NAME_TYPE_ENUM Type;
+    TSK_FS_NAME_FLAG_ENUM Flags;
+  };
+
+  struct NameList {
+    MetadataWriter*       Walker;
+    std::vector<NameEdge> Edges;
+    std::string           Strings;
+    std::vector<DirInfo>  Dirs;
+    size_t                Next; // first edge not yet joined
+    std::vector<size_t>   Missed; // edges whose inodes the meta walk skipped
+  };
+
+  static const uint32_t NO_DIR = std::numeric_limits<uint32_t>::max();
+
+  bool scanInodes(TSK_FS_INFO* fs); // false if the root couldn't be opened
+  void walkNames(TSK_FS_DIR* dir, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names); // closes dir
+  void walkName(const TSK_FS_NAME* n, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names, uint32_t& dirIndex); // dirIndex is NO_DIR until the directory's first name
+  // as walkDirAt(), for the directory named n, or the root if n is null;
+  // false if it couldn't be opened
+  virtual bool walkNamesAt(TSK_INUM_T addr, const TSK_FS_NAME* n, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names);
+  virtual bool walkInodes(TSK_FS_INFO* fs, TSK_INUM_T first, TSK_INUM_T last, NameList& names); // joinInode()s them; false on error
+  static TSK_WALK_RET_ENUM joinInode(TSK_FS_FILE* file, void* ptr);
+  void writeJoined(TSK_FS_FILE* file, const NameEdge& edge, NameList& names);
+  void writeEntry(TSK_FS_FILE* file, const char* path); // processFile(), but for setCurDir()
+
+  void saveCheckpoint(const char* path);
+  bool skipResumed(TSK_FS_FILE* file, const char* path); // true at Resume's last record
+  bool resumeSkips(const std::string& dirPath) const; // whether all of dirPath was written before Resume
+
+  bool unchanged(const TSK_FS_FILE* file); // since the previous index; marks it seen
+  void writeTombstones(); // for the inodes in the previous index that weren't seen
+
+  // With Threads > 1, each volume gets its own walker, TSK_FS_INFO, and
+  // thread. A walk started with none ahead of it writes straight to Out;
+  // the others' output is spooled to a temporary file and then appended in
+  // volume order, so that it's the same as a serial walk's.
+  struct VolumeWalk {
+    std::unique_ptr<SpoolFile>      Spool; // null if writing straight to Out
+    std::unique_ptr<MetadataWriter> Walker;
+    TSK_VS_PART_INFO                Part; // TSK frees the original when done with the volume system
+    std::future<void>               Done; // invalid if the volume has no filesystem
+  };
+
+  void startVolumeWalk(const TSK_VS_PART_INFO* vs_part);
+  void walkVolumeFs(TSK_OFF_T offset, TSK_FS_TYPE_ENUM type); // on the volume's thread
+  void finishVolumeWalks(size_t maxPending); // appends finished walks' output, oldest first
+  void mergeWalk(MetadataWriter& walker);
+
+  void mapInode(const TSK_FS_FILE* file); // the current record's ID, to InodeSink or ReverseMap
+  void sinkInodes(std::vector<InodeRecord>& rows);
+  void mergeInodes(SpillFiles& spills, ReverseInodeMapType& inodes, std::vector<InodeRecord>& rows); // from a walk of what comes next
+  void limitMemory(); // spills the maps if they're over MaxMemory
+  void spillRuns();
+  void spillInodes();
+  void sortRuns(RunTable& runs) const;
+  void sortInodes(InodeTable& inodes) const;
+
+  template<size_t N>
+  void writeTimestamp(JsonWriter& out, const char (&key)[N], uint32_t unix, uint32_t ns) {
+    out.key(key);
+    char* buf = out.reserve(TimestampFormatter::MAX_SIZE + 2);
+    buf[0] = '"';
+    unsigned int len = Timestamps.format(buf + 1, unix, ns);
+    buf[len + 1] = '"';
+    out.commit(len + 2);
+  }
+
+  void writeTimestamp(AvroWriter& out, uint32_t unix, uint32_t ns) {
+    char buf[TimestampFormatter::MAX_SIZE];
+    out.str(buf, Timestamps.format(buf, unix, ns));
+  }
 
   void markDataRun(uint64_t beg, uint64_t end, uint64_t offset, TSK_INUM_T addr, uint32_t attrID, bool slack);
 
@@ -190,7 +455,16 @@ protected:
   void processUnallocatedFragment(TSK_DADDR_T start, TSK_DADDR_T end, unsigned int fieldWidth, std::string& name);
   void flushUnallocated();
 
-  bool atFSRootLevel(const std::string& path) const;
+  // for coalescing the blocks of a tsk_fs_block_walk() into fragments
+  struct GapWalk {
+    MetadataWriter* Walker;
+    unsigned int    FieldWidth;
+    std::string*    Name;
+    TSK_DADDR_T     Beg,
+                    End; // the gap so far, empty if Beg == End
+  };
+
+  static TSK_WALK_RET_ENUM addGapBlock(const TSK_FS_BLOCK* block, void* ptr);
 
   TSK_FS_FILE       DummyFile;
   TSK_FS_NAME       DummyName;
@@ -201,9 +475,21 @@ protected:
 
   std::vector<DirInfo> Dirs;
 
+  JsonWriter   Record; // reused for every record
+  BinaryWriter Binary; // likewise, for --format=binary
+  std::unique_ptr<AvroContainer> Avro; // for --format=avro
+  std::deque<std::unique_ptr<VolumeWalk>> VolumeWalks;
+
+  TimestampFormatter Timestamps;
+  std::vector<const TSK_FS_ATTR*> Attrs; // attributes of the current file
+  std::string  RecordID, // binary IDs of the current file
+               ParentID,
+               ChildrenID;
+
 private:
   std::string  FsInfo,
                FsID;
+  uint32_t     FsVolIndex;
 };
 
 class FileWriter: public MetadataWriter {
@@ -0,0 +1,189 @@
+#include "avro.h"
+#include "fields.h"
+
+#include <random>
+
+unsigned int AvroWriter::encodeLong(unsigned char* buf, int64_t v) {
+  uint64_t zz = (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+  unsigned int len = 0;
+  while (zz > 0x7f) {
+    buf[len++] = static_cast<unsigned char>(zz | 0x80);
+    zz >>= 7;
+  }
+  buf[len++] = static_cast<unsigned char>(zz);
+  return len;
+}
+
+AvroContainer::AvroContainer(std::ostream& out, const std::string& schema, size_t blockSize):
+  Out(out), Block(blockSize + blockSize / 4), BlockSize(blockSize), Count(0)
+{
+  std::random_device rd;
+  for (unsigned int i = 0; i < sizeof(Sync); i += 4) {
+    const uint32_t r = rd();
+    std::memcpy(Sync + i, &r, 4);
+  }
+
+  AvroWriter header(1024 + schema.size());
+  const char magic[] = {'O', 'b', 'j', 1};
+  std::memcpy(header.reserve(sizeof(magic)), magic, sizeof(magic));
+  header.commit(sizeof(magic));
+  // file metadata is a map<bytes>
+  header.beginArray(2)
+        .str("avro.schema").str(schema)
+        .str("avro.codec").str("null")
+        .endArray();
+  std::memcpy(header.reserve(sizeof(Sync)), Sync, sizeof(Sync));
+  header.commit(sizeof(Sync));
+  Out.write(reinterpret_cast<const char*>(header.data()), header.size());
+}
+
+AvroContainer::AvroContainer(std::ostream& out, const AvroContainer& head, size_t blockSize):
+  Out(out), Block(blockSize + blockSize / 4), BlockSize(blockSize), Count(0)
+{
+  std::memcpy(Sync, head.Sync, sizeof(Sync));
+}
+
+AvroContainer::~AvroContainer() {
+  flush();
+}
+
+void AvroContainer::flush() {
+  if (Count) {
+    unsigned char prefix[2 * AvroWriter::MAX_LONG_SIZE];
+    unsigned int len = AvroWriter::encodeLong(prefix, Count);
+    len += AvroWriter::encodeLong(prefix + len, Block.size());
+    Out.write(reinterpret_cast<const char*>(prefix), len);
+    Out.write(reinterpret_cast<const char*>(Block.data()), Block.size());
+    Out.write(reinterpret_cast<const char*>(Sync), sizeof(Sync));
+    Block.clear();
+    Count = 0;
+  }
+}
+
+// The schemas follow the JSON records field for field, including the
+// t/fsmd nesting, so that the same table mapping works for both. The dumpfs
+// schema leaves out whatever --fields does.
+
+std::string dirEntrySchema(unsigned int fields) {
+  const bool meta = fields & Fields::META,
+             times = fields & Fields::TIMES;
+  std::string s(R"({"type":"record","name":"DirEntry","namespace":"fsrip","fields":[
+{"name":"id","type":"string"},
+{"name":"parent","type":"string"},
+{"name":"children","type":"string"},
+{"name":"t","type":{"type":"record","name":"DirEntryTables","fields":[
+  {"name":"fsmd","type":{"type":"record","name":"FsMetadata","fields":[
+    {"name":"fs","type":{"type":"record","name":"Filesystem","fields":[
+      {"name":"byteOffset","type":"long"},
+      {"name":"blockSize","type":"long"},
+      {"name":"fsID","type":"string"},
+      {"name":"volName","type":"string"},
+      {"name":"volIndex","type":"long"}]}},
+    {"name":"path","type":"string"},)");
+  if (fields & Fields::NAME) {
+    s += R"(
+    {"name":"name","type":["null",{"type":"record","name":"Name","fields":[
+      {"name":"flags","type":"string"},
+      {"name":"meta_addr","type":"long"},
+      {"name":"meta_seq","type":"long"},
+      {"name":"name","type":"string"},
+      {"name":"par_addr","type":"long"},
+      {"name":"par_seq","type":"long"},
+      {"name":"shrt_name","type":"string"},
+      {"name":"type","type":"string"}]}],"default":null},)";
+  }
+  s += R"(
+    {"name":"meta","type":["null",{"type":"record","name":"Meta","fields":[
+      {"name":"addr","type":"long"})";
+  if (times) {
+    s += R"(,
+      {"name":"accessed","type":"string"})";
+  }
+  if (meta) {
+    s += R"(,
+      {"name":"content_len","type":"long"})";
+  }
+  if (times) {
+    s += R"(,
+      {"name":"created","type":"string"},
+      {"name":"metadata","type":"string"})";
+  }
+  if (meta) {
+    s += R"(,
+      {"name":"flags","type":"string"},
+      {"name":"gid","type":"long"},
+      {"name":"link","type":["null","string"],"default":null})";
+  }
+  if (times) {
+    s += R"(,
+      {"name":"dtime","type":["null","string"],"default":null},
+      {"name":"bkup_time","type":["null","string"],"default":null})";
+  }
+  if (meta) {
+    s += R"(,
+      {"name":"mode","type":"long"})";
+  }
+  if (times) {
+    s += R"(,
+      {"name":"modified","type":"string"})";
+  }
+  if (meta) {
+    s += R"(,
+      {"name":"nlink","type":"long"},
+      {"name":"seq","type":"long"},
+      {"name":"size","type":"long"},
+      {"name":"type","type":"string"},
+      {"name":"uid","type":"long"})";
+  }
+  if (fields & Fields::ATTRS) {
+    s += R"(,
+      {"name":"attrs","type":{"type":"array","items":{"type":"record","name":"Attr","fields":[
+        {"name":"flags","type":"string"},
+        {"name":"id","type":"long"},
+        {"name":"name","type":"string"},
+        {"name":"size","type":"long"},
+        {"name":"type","type":"long"},
+        {"name":"rd_buf_size","type":"long"},
+        {"name":"nrd_allocsize","type":"long"},
+        {"name":"nrd_compsize","type":"long"},
+        {"name":"nrd_initsize","type":"long"},
+        {"name":"nrd_skiplen","type":"long"})";
+    if (fields & Fields::RD_BUF) {
+      s += R"(,
+        {"name":"rd_buf","type":["null","bytes"],"default":null})";
+    }
+    if (fields & Fields::RUNS) {
+      s += R"(,
+        {"name":"nrd_runs","type":["null",{"type":"array","items":{"type":"record","name":"Run","fields":[
+          {"name":"addr","type":"long"},
+          {"name":"flags","type":"long"},
+          {"name":"len","type":"long"},
+          {"name":"offset","type":"long"}]}}],"default":null},
+        {"name":"slack_size","type":["null","long"],"default":null})";
+    }
+    s += "]}}}";
+  }
+  s += R"(]}],"default":null}]}},
+  {"name":"__link","type":["null","string"],"default":null}]}}]})";
+  return s;
+}
+
+const char DISK_MAP_SCHEMA[] = R"({"type":"record","name":"DiskMapEntry","namespace":"fsrip","fields":[
+{"name":"id","type":"string"},
+{"name":"t","type":{"type":"record","name":"DiskMapTables","fields":[
+  {"name":"i","type":{"type":"record","name":"Extent","fields":[
+    {"name":"b","type":"long"},
+    {"name":"l","type":"long"},
+    {"name":"f","type":{"type":"array","items":{"type":"record","name":"ExtentOwner","fields":[
+      {"name":"vol","type":"long"},
+      {"name":"inum","type":"long"},
+      {"name":"attrId","type":"long"},
+      {"name":"s","type":"boolean"},
+      {"name":"drbeg","type":"long"},
+      {"name":"fo","type":"long"}]}}}]}}]}}]})";
+
+const char INODE_MAP_SCHEMA[] = R"({"type":"record","name":"InodeMapEntry","namespace":"fsrip","fields":[
+{"name":"id","type":"string"},
+{"name":"t","type":{"type":"record","name":"InodeMapTables","fields":[
+  {"name":"hardlinks","type":{"type":"array","items":"string"}},
+  {"name":"continued","type":"boolean","default":false}]}}]})";
@@ -0,0 +1,99 @@
+#include "checkpoint.h"
+#include "hex.h"
+
+#include <cstdio>
+#include <fstream>
+
+namespace {
+  const char MAGIC[] = "fsrip-checkpoint 1";
+
+  // "<length>:<bytes>", so that any path can be read back
+  void writeStr(std::ostream& out, const std::string& s) {
+    out << s.size() << ':' << s;
+  }
+
+  bool readStr(std::istream& in, std::string& s) {
+    size_t len;
+    if (!(in >> len) || in.get() != ':') {
+      return false;
+    }
+    s.resize(len);
+    return len == 0 || in.read(&s[0], len);
+  }
+
+  bool readKey(std::istream& in, const char* key) {
+    std::string k;
+    return (in >> k) && k == key && in.get() == ' ';
+  }
+
+  int hexValue(char c) {
+    return c >= '0' && c <= '9' ? c - '0': (c >= 'a' && c <= 'f' ? c - 'a' + 10: -1);
+  }
+}
+
+bool Checkpoint::save(const std::string& file) const {
+  const std::string tmp(file + ".tmp");
+  {
+    std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    std::string id(LastID.size() * 2, '0');
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(LastID.data());
+    hexEncode(&id[0], p, p + LastID.size());
+
+    out << MAGIC << '\n'
+        << "records " << Records << '\n'
+        << "data " << DataWritten << '\n'
+        << "offset " << Offset << '\n'
+        << "vol " << NumVols << '\n'
+        << "last " << id << '\n'
+        << "path ";
+    writeStr(out, Path);
+    out << '\n'
+        << "dirs " << Dirs.size() << '\n';
+    for (const auto& dir: Dirs) {
+      out << dir.second << ' ';
+      writeStr(out, dir.first);
+      out << '\n';
+    }
+    out.close();
+    if (!out) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+  }
+  return std::rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+bool Checkpoint::load(const std::string& file) {
+  std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+  std::string magic, id;
+  size_t numDirs;
+  if (!std::getline(in, magic) || magic != MAGIC ||
+      !readKey(in, "records") || !(in >> Records) ||
+      !readKey(in, "data") || !(in >> DataWritten) ||
+      !readKey(in, "offset") || !(in >> Offset) ||
+      !readKey(in, "vol") || !(in >> NumVols) ||
+      !readKey(in, "last") || !(in >> id) || id.size() % 2 ||
+      !readKey(in, "path") || !readStr(in, Path) ||
+      !readKey(in, "dirs") || !(in >> numDirs))
+  {
+    return false;
+  }
+  LastID.clear();
+  for (size_t i = 0; i < id.size(); i += 2) {
+    const int hi = hexValue(id[i]), lo = hexValue(id[i + 1]);
+    if (hi < 0 || lo < 0) {
+      return false;
+    }
+    LastID += char(hi << 4 | lo);
+  }
+  Dirs.clear();
+  for (size_t i = 0; i < numDirs; ++i) {
+    uint32_t count;
+    std::string path;
+    if (!(in >> count) || in.get() != ' ' || !readStr(in, path)) {
+      return false;
+    }
+    Dirs.emplace_back(path, count);
+  }
+  return !LastID.empty();
+}
@@ -1,166 +1,134 @@
 #include "enums.h"
 
+#include <string>
+#include <utility>
 #include <vector>
-#include <sstream>
 
 #include <tsk/libtsk.h>
 
-std::string metaType(unsigned int type) {
-  static const std::vector<std::string> types({
-    "Undefined",
-    "File",
-    "Folder",
-    "Named Pipe",
-    "Character Device",
-    "Block Device",
-    "Symbolic Link",
-    "Shadow Inode",
-    "Domain Socket",
-    "Whiteout Inode",
-    "Virtual"
-  });
-  return type < types.size() ? types[type]: types[0];
-}
+typedef boost::string_ref StrRef;
 
-std::string nameType(unsigned int type) {
-  static const std::vector<std::string> types({
-    "Undefined",
-    "Named Pipe",
-    "Character Device",
-    "Folder",
-    "Block Device",
-    "File",
-    "Symbolic Link",
-    "Domain Socket",
-    "Shadow Inode",
-    "Whiteout Inode",
-    "Virtual"
-  });
-  return type < types.size() ? types[type]: types[0];
-}
+#define STR_REF(s) StrRef(s, sizeof(s) - 1)
 
-std::string metaFlags(unsigned int flags) {
-  std::string ret;
-  if (flags) {
-    bool has = false;
-    std::stringstream buf;
-    if (flags & TSK_FS_META_FLAG_ALLOC) {
-      buf << "Allocated";
-      has = true;
-    }
-    if (flags & TSK_FS_META_FLAG_UNALLOC) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Deleted";
-      has = true;
-    }
-    if (flags & TSK_FS_META_FLAG_USED) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Used";
-      has = true;
-    }
-    if (flags & TSK_FS_META_FLAG_UNUSED) {
-      if (has) {
-        buf << ", ";
+namespace {
+  constexpr StrRef MetaTypes[] = {
+    STR_REF("Undefined"),
+    STR_REF("File"),
+    STR_REF("Folder"),
+    STR_REF("Named Pipe"),
+    STR_REF("Character Device"),
+    STR_REF("Block Device"),
+    STR_REF("Symbolic Link"),
+    STR_REF("Shadow Inode"),
+    STR_REF("Domain Socket"),
+    STR_REF("Whiteout Inode"),
+    STR_REF("Virtual")
+  };
+
+  constexpr StrRef NameTypes[] = {
+    STR_REF("Undefined"),
+    STR_REF("Named Pipe"),
+    STR_REF("Character Device"),
+    STR_REF("Folder"),
+    STR_REF("Block Device"),
+    STR_REF("File"),
+    STR_REF("Symbolic Link"),
+    STR_REF("Domain Socket"),
+    STR_REF("Shadow Inode"),
+    STR_REF("Whiteout Inode"),
+    STR_REF("Virtual")
+  };
+
+  struct FlagName {
+    unsigned int Bit;
+    StrRef       Name;
+  };
+
+  constexpr FlagName MetaFlagNames[] = {
+    {TSK_FS_META_FLAG_ALLOC,   STR_REF("Allocated")},
+    {TSK_FS_META_FLAG_UNALLOC, STR_REF("Deleted")},
+    {TSK_FS_META_FLAG_USED,    STR_REF("Used")},
+    {TSK_FS_META_FLAG_UNUSED,  STR_REF("Unused")},
+    {TSK_FS_META_FLAG_COMP,    STR_REF("Compressed")},
+    {TSK_FS_META_FLAG_ORPHAN,  STR_REF("Orphan")}
+  };
+
+  constexpr FlagName NameFlagNames[] = {
+    {TSK_FS_NAME_FLAG_ALLOC,   STR_REF("Allocated")},
+    {TSK_FS_NAME_FLAG_UNALLOC, STR_REF("Deleted")}
+  };
+
+  constexpr FlagName AttrFlagNames[] = {
+    {TSK_FS_ATTR_INUSE,    STR_REF("In Use")},
+    {TSK_FS_ATTR_NONRES,   STR_REF("Non-resident")},
+    {TSK_FS_ATTR_RES,      STR_REF("Resident")},
+    {TSK_FS_ATTR_ENC,      STR_REF("Encrypted")},
+    {TSK_FS_ATTR_COMP,     STR_REF("Compressed")},
+    {TSK_FS_ATTR_SPARSE,   STR_REF("Sparse")},
+    {TSK_FS_ATTR_RECOVERY, STR_REF("Recovered")}
+  };
+
+  template<size_t N>
+  constexpr unsigned int highestBit(const FlagName (&names)[N], size_t i = 0) {
+    return i < N ? (names[i].Bit > highestBit(names, i + 1) ? names[i].Bit: highestBit(names, i + 1)): 0;
+  }
+
+  // Every combination of the named bits joined with ", ", built once. Bits
+  // without a name have never been printed, so they are ignored; that
+  // covers whatever combinations TSK comes up with.
+  class FlagTable {
+  public:
+    template<size_t N>
+    FlagTable(const FlagName (&names)[N]): Mask(highestBit(names) * 2 - 1), Entries(Mask + 1) {
+      std::vector<std::pair<size_t, size_t>> spans(Entries.size());
+      for (unsigned int flags = 0; flags <= Mask; ++flags) {
+        spans[flags].first = Arena.size();
+        for (const FlagName& f: names) {
+          if (flags & f.Bit) {
+            if (Arena.size() > spans[flags].first) {
+              Arena += ", ";
+            }
+            Arena.append(f.Name.data(), f.Name.size());
+          }
+        }
+        spans[flags].second = Arena.size() - spans[flags].first;
       }
-      buf << "Unused";
-      has = true;
-    }
-    if (flags & TSK_FS_META_FLAG_COMP) {
-      if (has) {
-        buf << ", ";
+      // Arena is done growing, so it's safe to point into it now
+      for (unsigned int flags = 0; flags <= Mask; ++flags) {
+        Entries[flags] = StrRef(Arena.data() + spans[flags].first, spans[flags].second);
       }
-      buf << "Compressed";
-      has = true;
     }
-    if (flags & TSK_FS_META_FLAG_ORPHAN) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Orphan";
-      has = true;
+
+    StrRef operator[](unsigned int flags) const {
+      return Entries[flags & Mask];
     }
-    ret = buf.str();
-  }
-  return ret;
+
+  private:
+    unsigned int        Mask;
+    std::string         Arena;
+    std::vector<StrRef> Entries;
+  };
 }
 
-std::string nameFlags(unsigned int flags) {
-  std::string ret;
-  if (flags) {
-    bool has = false;
-    std::stringstream buf;
-    if (flags & TSK_FS_NAME_FLAG_ALLOC) {
-      buf << "Allocated";
-      has = true;
-    }
-    if (flags & TSK_FS_NAME_FLAG_UNALLOC) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Deleted";
-      has = true;
-    }
-    ret = buf.str();
-  }
-  return ret;
+StrRef metaType(unsigned int type) {
+  return type < sizeof(MetaTypes) / sizeof(MetaTypes[0]) ? MetaTypes[type]: MetaTypes[0];
 }
 
-std::string attrFlags(unsigned int flags) {
-  std::string ret;
-  if (flags) {
-    bool has = false;
-    std::stringstream buf;
-    if (flags & TSK_FS_ATTR_INUSE) {
-      buf << "In Use";
-      has = true;
-    }
-    if (flags & TSK_FS_ATTR_NONRES) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Non-resident";
-      has = true;
-    }
-    if (flags & TSK_FS_ATTR_RES) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Resident";
-      has = true;
-    }
-    if (flags & TSK_FS_ATTR_ENC) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Encrypted";
-      has = true;
-    }
-    if (flags & TSK_FS_ATTR_COMP) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Compressed";
-      has = true;
-    }
-    if (flags & TSK_FS_ATTR_SPARSE) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Sparse";
-      has = true;
-    }
-    if (flags & TSK_FS_ATTR_RECOVERY) {
-      if (has) {
-        buf << ", ";
-      }
-      buf << "Recovered";
-      has = true;
-    }
-    ret = buf.str();
-  }
-  return ret;
+StrRef nameType(unsigned int type) {
+  return type < sizeof(NameTypes) / sizeof(NameTypes[0]) ? NameTypes[type]: NameTypes[0];
+}
+
+StrRef metaFlags(unsigned int flags) {
+  static const FlagTable table(MetaFlagNames);
+  return table[flags];
+}
+
+StrRef nameFlags(unsigned int flags) {
+  static const FlagTable table(NameFlagNames);
+  return table[flags];
+}
+
+StrRef attrFlags(unsigned int flags) {
+  static const FlagTable table(AttrFlagNames);
+  return table[flags];
 }
@@ -0,0 +1,259 @@
+#include "filter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+namespace {
+  // days since 1970-01-01 of a proleptic Gregorian date
+  int64_t daysFromCivil(int64_t y, unsigned int m, unsigned int d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y: y - 399) / 400;
+    const unsigned int yoe = static_cast<unsigned int>(y - era * 400);
+    const unsigned int doy = (153 * (m + (m > 2 ? -3: 9)) + 2) / 5 + d - 1;
+    const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+  }
+
+  // matches c against the [...] set at p, returning the end of the set, or
+  // nullptr if it's unterminated
+  const char* matchSet(const char* p, char c, bool& found) {
+    ++p; // '['
+    const bool negate = *p == '!' || *p == '^';
+    if (negate) {
+      ++p;
+    }
+    found = false;
+    for (bool first = true; first || *p != ']'; first = false) {
+      if (!*p) {
+        return nullptr;
+      }
+      const char lo = *p++;
+      char hi = lo;
+      if (*p == '-' && p[1] && p[1] != ']') {
+        hi = p[1];
+        p += 2;
+      }
+      found |= lo <= c && c <= hi;
+    }
+    found = found != negate && c != '/';
+    return p + 1;
+  }
+}
+
+RecordFilter::RecordFilter():
+  Empty(true), NameOnly(false), Types(ALL_TYPES), MinSize(0), MaxSize(std::numeric_limits<uint64_t>::max()),
+  TimeField(MODIFIED), After(std::numeric_limits<int64_t>::min()), Before(std::numeric_limits<int64_t>::max()),
+  Alloc(ANY_STATE)
+{}
+
+void RecordFilter::setPathGlob(const std::string& glob) {
+  Glob = glob;
+  NameOnly = Glob.find('/') == std::string::npos;
+  update();
+}
+
+void RecordFilter::setTypes(unsigned int types) {
+  Types = types;
+  update();
+}
+
+void RecordFilter::setSizeRange(uint64_t min, uint64_t max) {
+  MinSize = min;
+  MaxSize = max;
+  update();
+}
+
+void RecordFilter::setTimeWindow(TIME_FIELD field, int64_t after, int64_t before) {
+  TimeField = field;
+  After = after;
+  Before = before;
+  update();
+}
+
+void RecordFilter::setAllocState(ALLOC_STATE state) {
+  Alloc = state;
+  update();
+}
+
+void RecordFilter::update() {
+  Empty = Glob.empty() && Types == ALL_TYPES && MinSize == 0 && MaxSize == std::numeric_limits<uint64_t>::max() &&
+          After == std::numeric_limits<int64_t>::min() && Before == std::numeric_limits<int64_t>::max() &&
+          Alloc == ANY_STATE;
+}
+
+bool RecordFilter::matches(const TSK_FS_FILE* file, const char* path) const {
+  if (Empty) {
+    return true;
+  }
+  const TSK_FS_NAME* n = file->name;
+  const TSK_FS_META* m = file->meta;
+  if (Alloc != ANY_STATE) {
+    const bool alloc = n ? (n->flags & TSK_FS_NAME_FLAG_ALLOC): (m && (m->flags & TSK_FS_META_FLAG_ALLOC));
+    if (alloc != (Alloc == ALLOCATED)) {
+      return false;
+    }
+  }
+  if (Types != ALL_TYPES && !typeMatches(file)) {
+    return false;
+  }
+  if (MinSize != 0 || MaxSize != std::numeric_limits<uint64_t>::max()) {
+    if (!m || m->size < 0 || uint64_t(m->size) < MinSize || uint64_t(m->size) > MaxSize) {
+      return false;
+    }
+  }
+  if (After != std::numeric_limits<int64_t>::min() || Before != std::numeric_limits<int64_t>::max()) {
+    if (!m || !timeMatches(m)) {
+      return false;
+    }
+  }
+  if (!Glob.empty()) {
+    const char* name = n && n->name ? n->name: "";
+    if (NameOnly) {
+      return globMatch(Glob.c_str(), name);
+    }
+    Scratch.assign(path);
+    Scratch += name;
+    return globMatch(Glob.c_str(), Scratch.c_str());
+  }
+  return true;
+}
+
+bool RecordFilter::mayMatchBelow(const std::string& dirPath) const {
+  return !prunesPaths() || globMatch(Glob.c_str(), dirPath.c_str(), true);
+}
+
+bool RecordFilter::typeMatches(const TSK_FS_FILE* file) const {
+  unsigned int type = OTHERS;
+  if (file->name && file->name->type != TSK_FS_NAME_TYPE_UNDEF) {
+    switch (file->name->type) {
+      case TSK_FS_NAME_TYPE_REG: type = FILES; break;
+      case TSK_FS_NAME_TYPE_DIR: type = DIRS; break;
+      case TSK_FS_NAME_TYPE_LNK: type = LINKS; break;
+      default: break;
+    }
+  }
+  else if (file->meta) {
+    switch (file->meta->type) {
+      case TSK_FS_META_TYPE_REG: type = FILES; break;
+      case TSK_FS_META_TYPE_DIR: type = DIRS; break;
+      case TSK_FS_META_TYPE_LNK: type = LINKS; break;
+      default: break;
+    }
+  }
+  return Types & type;
+}
+
+bool RecordFilter::timeMatches(const TSK_FS_META* m) const {
+  const int64_t times[] = {m->mtime, m->atime, m->crtime, m->ctime};
+  if (TimeField == ANY_TIME) {
+    for (int64_t t: times) {
+      if (After <= t && t < Before) {
+        return true;
+      }
+    }
+    return false;
+  }
+  const int64_t t = times[TimeField];
+  return After <= t && t < Before;
+}
+
+bool RecordFilter::globMatch(const char* p, const char* s, bool prefix) {
+  while (*p) {
+    if (*p == '*') {
+      const bool any = p[1] == '*';
+      p += any ? 2: 1;
+      if (any && *p == '/' && globMatch(p + 1, s, prefix)) {
+        return true; // "**/" matching no directories at all
+      }
+      for (;; ++s) {
+        if (globMatch(p, s, prefix)) {
+          return true;
+        }
+        if (!*s || (!any && *s == '/')) {
+          return false;
+        }
+      }
+    }
+    if (!*s) {
+      return prefix;
+    }
+    bool found;
+    const char* next;
+    if (*p == '[' && (next = matchSet(p, *s, found))) {
+      if (!found) {
+        return false;
+      }
+      p = next;
+      ++s;
+      continue;
+    }
+    if (*p == '?' ? *s == '/': *p != *s) { // an unterminated '[' is literal
+      return false;
+    }
+    ++p;
+    ++s;
+  }
+  return !*s;
+}
+
+bool RecordFilter::parseTypes(const std::string& spec, unsigned int& types) {
+  types = 0;
+  size_t beg = 0;
+  while (beg <= spec.size()) {
+    size_t end = spec.find(',', beg);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    const std::string t(spec, beg, end - beg);
+    if (t == "file") {
+      types |= FILES;
+    }
+    else if (t == "dir") {
+      types |= DIRS;
+    }
+    else if (t == "link") {
+      types |= LINKS;
+    }
+    else if (t == "other") {
+      types |= OTHERS;
+    }
+    else {
+      return false;
+    }
+    beg = end + 1;
+  }
+  return true;
+}
+
+bool RecordFilter::parseTime(const std::string& spec, int64_t& t) {
+  if (spec.empty()) {
+    return false;
+  }
+  if (spec.find('-', 1) == std::string::npos) {
+    char* end;
+    t = std::strtoll(spec.c_str(), &end, 10);
+    return *end == '\0';
+  }
+  int y, mo, d, h = 0, mi = 0, sec = 0, len = 0;
+  if (std::sscanf(spec.c_str(), "%4d-%2d-%2d%n", &y, &mo, &d, &len) != 3) {
+    return false;
+  }
+  if (spec.size() > unsigned(len)) {
+    int more = 0;
+    if ((spec[len] != 'T' && spec[len] != ' ') ||
+        std::sscanf(spec.c_str() + len + 1, "%2d:%2d:%2d%n", &h, &mi, &sec, &more) != 3)
+    {
+      return false;
+    }
+    len += 1 + more;
+    if (spec.size() > unsigned(len) && !(spec.size() == unsigned(len) + 1 && spec[len] == 'Z')) {
+      return false;
+    }
+  }
+  if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 60) {
+    return false;
+  }
+  t = daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec;
+  return true;
+}
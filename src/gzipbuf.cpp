@@ -0,0 +1,184 @@
+#include "gzipbuf.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+class GzipDeflater {
+public:
+  GzipDeflater(int level) {
+    Strm.zalloc = Z_NULL;
+    Strm.zfree = Z_NULL;
+    Strm.opaque = Z_NULL;
+    // 16 + 15 bits of window asks zlib for a gzip header and trailer
+    if (deflateInit2(&Strm, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw std::runtime_error("could not initialize zlib");
+    }
+  }
+
+  ~GzipDeflater() {
+    deflateEnd(&Strm);
+  }
+
+  // compresses in[0, inLen) into one complete gzip member in out, growing it
+  // if need be, and returns the member's size
+  size_t compress(const char* in, size_t inLen, std::vector<unsigned char>& out) {
+    deflateReset(&Strm);
+    const size_t bound = deflateBound(&Strm, inLen);
+    if (out.size() < bound) {
+      out.resize(bound);
+    }
+    Strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+    Strm.avail_in = inLen;
+    Strm.next_out = out.data();
+    Strm.avail_out = out.size();
+    if (deflate(&Strm, Z_FINISH) != Z_STREAM_END) {
+      throw std::runtime_error("zlib could not compress a block");
+    }
+    return out.size() - Strm.avail_out;
+  }
+
+private:
+  z_stream Strm;
+};
+
+ParallelGzipBuf::ParallelGzipBuf(std::streambuf* dest, int level, unsigned int threads, size_t blockSize):
+  Dest(dest), BlockSize(blockSize ? blockSize: DEFAULT_BLOCK_SIZE),
+  MaxPending(threads > 1 ? 2 * threads: 1), Failed(false), Cur(nullptr), Stop(false)
+{
+  // the deflaters are made here so that zlib errors surface on this thread
+  for (unsigned int i = 0; i < std::max(threads, 1u); ++i) {
+    Deflaters.emplace_back(new GzipDeflater(level));
+  }
+  if (threads > 1) {
+    for (auto& d: Deflaters) {
+      Workers.emplace_back(&ParallelGzipBuf::work, this, d.get());
+    }
+  }
+  startBlock();
+}
+
+ParallelGzipBuf::~ParallelGzipBuf() {
+  sync();
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Stop = true;
+  }
+  WorkReady.notify_all();
+  for (auto& t: Workers) {
+    t.join();
+  }
+}
+
+void ParallelGzipBuf::startBlock() {
+  if (Free.empty()) {
+    Blocks.emplace_back(new Block());
+    Blocks.back()->In.resize(BlockSize);
+    Free.push_back(Blocks.back().get());
+  }
+  Cur = Free.back();
+  Free.pop_back();
+  setp(Cur->In.data(), Cur->In.data() + BlockSize);
+}
+
+void ParallelGzipBuf::writeBlock(Block* b) {
+  if (!b->Ok) {
+    Failed = true;
+  }
+  else if (!Failed && Dest->sputn(reinterpret_cast<const char*>(b->Out.data()), b->OutLen) != std::streamsize(b->OutLen)) {
+    Failed = true;
+  }
+  Free.push_back(b);
+}
+
+void ParallelGzipBuf::submit() {
+  Cur->InLen = pptr() - pbase();
+  if (Cur->InLen) {
+    if (Workers.empty()) {
+      compress(*Deflaters.front(), Cur);
+      writeBlock(Cur);
+    }
+    else {
+      {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Cur->Done = false;
+        Pending.push_back(Cur);
+        Queue.push_back(Cur);
+      }
+      WorkReady.notify_one();
+      writeFinished(false);
+    }
+    startBlock();
+  }
+  else {
+    setp(Cur->In.data(), Cur->In.data() + BlockSize);
+  }
+}
+
+void ParallelGzipBuf::writeFinished(bool all) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (!Pending.empty()) {
+    Block* b = Pending.front();
+    if (!b->Done) {
+      if (all || Pending.size() >= MaxPending) {
+        BlockDone.wait(lock, [b]{ return b->Done; });
+      }
+      else {
+        break;
+      }
+    }
+    Pending.pop_front();
+    lock.unlock();
+    writeBlock(b);
+    lock.lock();
+  }
+}
+
+void ParallelGzipBuf::compress(GzipDeflater& deflater, Block* b) {
+  try {
+    b->OutLen = deflater.compress(b->In.data(), b->InLen, b->Out);
+    b->Ok = true;
+  }
+  catch (std::exception&) {
+    b->Ok = false;
+  }
+}
+
+void ParallelGzipBuf::work(GzipDeflater* deflater) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (true) {
+    WorkReady.wait(lock, [this]{ return Stop || !Queue.empty(); });
+    if (Queue.empty()) {
+      return;
+    }
+    Block* b = Queue.front();
+    Queue.pop_front();
+    lock.unlock();
+    compress(*deflater, b);
+    lock.lock();
+    b->Done = true;
+    BlockDone.notify_all();
+  }
+}
+
+ParallelGzipBuf::int_type ParallelGzipBuf::overflow(int_type c) {
+  submit();
+  if (Failed) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int ParallelGzipBuf::sync() {
+  submit();
+  writeFinished(true);
+  if (Failed || Dest->pubsync() == -1) {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+#include "hex.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define FSRIP_HEX_X86
+  #include <immintrin.h>
+#endif
+
+namespace {
+  const char HexDigits[] = "0123456789abcdef";
+}
+
+void hexEncodeScalar(char* out, const unsigned char* beg, const unsigned char* end) {
+  for (const unsigned char* cur = beg; cur < end; ++cur) {
+    *out++ = HexDigits[*cur >> 4];
+    *out++ = HexDigits[*cur & 0x0f];
+  }
+}
+
+#ifdef FSRIP_HEX_X86
+
+// nibble n -> '0' + n, plus 39 more for n > 9 to land on 'a'
+__attribute__((target("sse2")))
+inline __m128i nibblesToAscii(__m128i n) {
+  const __m128i gt9 = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+  return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), _mm_and_si128(gt9, _mm_set1_epi8(39)));
+}
+
+__attribute__((target("sse2")))
+void hexEncodeSSE2(char* out, const unsigned char* beg, const unsigned char* end) {
+  const __m128i lowMask = _mm_set1_epi8(0x0f);
+  for (; end - beg >= 16; beg += 16, out += 32) {
+    const __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(beg));
+    const __m128i hi = nibblesToAscii(_mm_and_si128(_mm_srli_epi16(v, 4), lowMask));
+    const __m128i lo = nibblesToAscii(_mm_and_si128(v, lowMask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(hi, lo));
+  }
+  hexEncodeScalar(out, beg, end);
+}
+
+__attribute__((target("avx2")))
+inline __m256i nibblesToAscii256(__m256i n) {
+  const __m256i gt9 = _mm256_cmpgt_epi8(n, _mm256_set1_epi8(9));
+  return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), _mm256_and_si256(gt9, _mm256_set1_epi8(39)));
+}
+
+__attribute__((target("avx2")))
+void hexEncodeAVX2(char* out, const unsigned char* beg, const unsigned char* end) {
+  const __m256i lowMask = _mm256_set1_epi8(0x0f);
+  for (; end - beg >= 32; beg += 32, out += 64) {
+    const __m256i v  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(beg));
+    const __m256i hi = nibblesToAscii256(_mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask));
+    const __m256i lo = nibblesToAscii256(_mm256_and_si256(v, lowMask));
+    // unpacking works within 128-bit lanes, so swap the middle halves back
+    const __m256i a = _mm256_unpacklo_epi8(hi, lo), // bytes 0-7, 16-23
+                  b = _mm256_unpackhi_epi8(hi, lo); // bytes 8-15, 24-31
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), _mm256_permute2x128_si256(a, b, 0x31));
+  }
+  hexEncodeSSE2(out, beg, end);
+}
+
+typedef void (*HexEncoder)(char*, const unsigned char*, const unsigned char*);
+
+HexEncoder pickHexEncoder() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &hexEncodeAVX2;
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    return &hexEncodeSSE2;
+  }
+  return &hexEncodeScalar;
+}
+
+void hexEncode(char* out, const unsigned char* beg, const unsigned char* end) {
+  static const HexEncoder encoder = pickHexEncoder();
+  if (end - beg < 16) {
+    // IDs are a handful of bytes; not worth the indirect call
+    hexEncodeScalar(out, beg, end);
+  }
+  else {
+    encoder(out, beg, end);
+  }
+}
+
+#else
+
+void hexEncode(char* out, const unsigned char* beg, const unsigned char* end) {
+  hexEncodeScalar(out, beg, end);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "inodeindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if !defined(_WIN32)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace {
+  const char MAGIC[8] = {'F', 'S', 'R', 'I', 'P', 'I', 'X', '1'};
+  const size_t HEADER_SIZE = sizeof(MAGIC) + sizeof(uint64_t);
+}
+
+InodeIndex::InodeIndex():
+  Entries(nullptr), Count(0), Map(nullptr), MapSize(0) {}
+
+InodeIndex::~InodeIndex() {
+  close();
+}
+
+void InodeIndex::close() {
+#if !defined(_WIN32)
+  if (Map) {
+    munmap(Map, MapSize);
+  }
+#endif
+  Map = nullptr;
+  MapSize = 0;
+  Entries = nullptr;
+  Count = 0;
+  Copy.clear();
+}
+
+bool InodeIndex::open(const std::string& path) {
+  close();
+#if defined(_WIN32)
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  char header[HEADER_SIZE];
+  uint64_t count;
+  if (!in.read(header, HEADER_SIZE) || std::memcmp(header, MAGIC, sizeof(MAGIC))) {
+    return false;
+  }
+  std::memcpy(&count, header + sizeof(MAGIC), sizeof(count));
+  Copy.resize(count);
+  if (count && !in.read(reinterpret_cast<char*>(&Copy[0]), count * sizeof(Entry))) {
+    Copy.clear();
+    return false;
+  }
+  Entries = Copy.data();
+  Count = count;
+  return true;
+#else
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < HEADER_SIZE) {
+    ::close(fd);
+    return false;
+  }
+  const size_t size = st.st_size;
+  void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  Map = map;
+  MapSize = size;
+  const char* data = static_cast<const char*>(map);
+
+  uint64_t count;
+  std::memcpy(&count, data + sizeof(MAGIC), sizeof(count));
+  if (std::memcmp(data, MAGIC, sizeof(MAGIC)) || count > (size - HEADER_SIZE) / sizeof(Entry)) {
+    close();
+    return false;
+  }
+  madvise(map, size, MADV_RANDOM);
+  Entries = reinterpret_cast<const Entry*>(data + HEADER_SIZE); // mmap() is page-aligned, and the header is 16 bytes
+  Count = count;
+  return true;
+#endif
+}
+
+const InodeIndex::Entry* InodeIndex::find(uint32_t vol, uint64_t addr) const {
+  Entry key;
+  key.Vol = vol;
+  key.Addr = addr;
+  const Entry* e = std::lower_bound(begin(), end(), key);
+  return e != end() && e->Vol == vol && e->Addr == addr ? e: nullptr;
+}
+
+bool InodeIndex::write(const std::string& path, std::vector<Entry>& entries) {
+  std::stable_sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end(),
+    [](const Entry& a, const Entry& b) { return a.Vol == b.Vol && a.Addr == b.Addr; }), entries.end());
+
+  // written aside and renamed, as path may be the index that --since has mapped
+  const std::string tmp(path + ".tmp");
+  std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  const uint64_t count = entries.size();
+  out.write(MAGIC, sizeof(MAGIC));
+  out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  if (count) {
+    out.write(reinterpret_cast<const char*>(entries.data()), count * sizeof(Entry));
+  }
+  out.close();
+  if (!out) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,32 @@
+#include "jsonwriter.h"
+
+JsonWriter::JsonWriter(size_t reserve):
+  Buf(reserve ? reserve: 1), Len(0) {}
+
+void JsonWriter::grow(size_t n) {
+  size_t newSize = Buf.size() * 2;
+  while (newSize < Len + n) {
+    newSize *= 2;
+  }
+  Buf.resize(newSize);
+}
+
+JsonWriter& JsonWriter::value(unsigned long long v) {
+  char  digits[20];
+  char* end = digits + sizeof(digits);
+  char* cur = end;
+  do {
+    *--cur = '0' + (v % 10);
+    v /= 10;
+  } while (v);
+  return raw(cur, end - cur);
+}
+
+JsonWriter& JsonWriter::value(long long v) {
+  if (v < 0) {
+    raw('-');
+    // negate in unsigned space so that LLONG_MIN doesn't overflow
+    return value(0ull - static_cast<unsigned long long>(v));
+  }
+  return value(static_cast<unsigned long long>(v));
+}
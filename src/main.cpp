@@ -8,19 +8,35 @@ Copyright (c) 2010 Lightbox Technologies, Inc.
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
 #include <string>
 #include <fstream>
 #include <future>
+#include <iterator>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
 
 #include <boost/program_options.hpp>
 #include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 
 #include "walkers.h"
+#include "avro.h"
+#include "fields.h"
+#include "filter.h"
+#include "gzipbuf.h"
+#include "outputsink.h"
+#include "ownerindex.h"
 #include "enums.h"
 #include "util.h"
 #include "jsonhelp.h"
+#include "jsonwriter.h"
 
 #if defined(__WIN32__) || defined(_WIN32_) || defined(__WIN32) || defined(_WIN32) || defined(WIN32) || defined(__WINDOWS__) || defined(__TOS_WIN__)
   #include <cstdio>
@@ -62,80 +78,629 @@ std::shared_ptr<LbtTskAuto> createVisitor(const std::string& cmd, std::ostream&
   }
 }
 
-void outputDiskMap(const std::string& diskMapFile, std::shared_ptr<LbtTskAuto> w) {
+// Part of a map that can't be written straight to its file, as it comes
+// after another part being written at the same time: a temporary file,
+// written through a large buffer and then copied to the map's file.
+class MapPiece: public SpoolFile {
+public:
+  MapPiece(): SpoolFile(MAP_BUFFER_SIZE) {}
+
+  static const size_t MAP_BUFFER_SIZE = 1024 * 1024;
+};
+
+// Calls fn(0) through fn(n - 1), on up to threads threads at once.
+void forEachVolume(size_t n, unsigned int threads, const std::function<void(size_t)>& fn) {
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i; (i = next++) < n; ) {
+      fn(i);
+    }
+  };
+  std::vector<std::future<void>> workers;
+  for (size_t t = 1; t < std::min<size_t>(threads, n); ++t) {
+    workers.emplace_back(std::async(std::launch::async, work));
+  }
+  work();
+  for (auto& w: workers) {
+    w.get();
+  }
+}
+
+typedef std::function<void(std::ostream& out, uint32_t vol, bool first)> VolumeMapFn;
+
+// Writes each volume's part of a map with writeVol, up to threads volumes at
+// once. The first volume's goes straight to file, and the others' to
+// MapPieces, which are then appended to it in volume order.
+void outputMapByVolume(std::ostream& file, const std::vector<uint32_t>& vols, unsigned int threads, const VolumeMapFn& writeVol) {
+  std::vector<std::unique_ptr<MapPiece>> pieces(vols.size());
+  forEachVolume(vols.size(), threads, [&](size_t i) {
+    if (i == 0) {
+      writeVol(file, vols[i], true);
+    }
+    else {
+      pieces[i].reset(new MapPiece);
+      writeVol(pieces[i]->out(), vols[i], false);
+    }
+  });
+  for (size_t i = 1; i < pieces.size(); ++i) {
+    pieces[i]->copyTo(file);
+  }
+}
+
+// records are formatted into buf, which is written out whenever it's full
+void flushMapBuffer(std::ostream& out, JsonWriter& buf, bool force = false) {
+  if (force || buf.size() >= MapPiece::MAP_BUFFER_SIZE) {
+    out.write(buf.data(), buf.size());
+    buf.clear();
+  }
+}
+
+// Formats disk map rows into out, as JSON or, given an Avro head container,
+// as Avro: into head itself if out is head's stream, otherwise into a
+// container continuing it.
+class DiskMapRows {
+public:
+  DiskMapRows(std::ostream& out, AvroContainer* head, bool intoHead):
+    Out(out), Buf(head ? 0: MapPiece::MAP_BUFFER_SIZE + 64 * 1024), Avro(head)
+  {
+    if (head && !intoHead) {
+      Continued.reset(new AvroContainer(out, *head));
+      Avro = Continued.get();
+    }
+  }
+
+  void write(uint32_t vol, uint64_t beg, uint64_t end, const MetadataWriter::AttrSet& owners) {
+    writeDiskMapID(ID, beg);
+    if (Avro) {
+      AvroWriter& rec(Avro->record());
+      rec.str(ID, DISK_MAP_ID_SIZE)
+         .num(beg)
+         .num(end - beg)
+         .beginArray(owners.size());
+      for (const auto& f: owners) {
+        rec.num(vol)
+           .num(std::get<0>(f))
+           .num(std::get<1>(f))
+           .boolean(std::get<2>(f))
+           .num(std::get<3>(f))
+           .num(std::get<4>(f));
+      }
+      rec.endArray();
+      Avro->endRecord();
+      return;
+    }
+
+    Buf.raw("{").pair("id", ID, DISK_MAP_ID_SIZE, true)
+       .raw(",\"t\": { \"i\": { ").pair("b", beg, true)
+       .pair("l", end - beg)
+       .raw(", \"f\":[");
+    bool firstFile = true;
+    for (const auto& f: owners) {
+      if (!firstFile) {
+        Buf.raw(", ");
+      }
+      Buf.raw("{").pair("vol", vol, true)
+         .pair("inum", static_cast<int64_t>(std::get<0>(f)))
+         .pair("attrId", std::get<1>(f))
+         .pair("s", std::get<2>(f))
+         .pair("drbeg", std::get<3>(f))
+         .pair("fo", std::get<4>(f))
+         .raw("}");
+      firstFile = false;
+    }
+    Buf.raw("]}}}\n");
+    flushMapBuffer(Out, Buf);
+  }
+
+  void finish() {
+    if (Avro) {
+      Avro->flush();
+    }
+    else {
+      flushMapBuffer(Out, Buf, true);
+    }
+  }
+
+private:
+  std::ostream&  Out;
+  JsonWriter     Buf;
+  AvroContainer* Avro;
+  std::unique_ptr<AvroContainer> Continued;
+  char           ID[DISK_MAP_ID_SIZE];
+};
+
+// One of the files the disk map is split into, and what the manifest says
+// of it. Shard k gets rows [FirstRow, the next shard's FirstRow), counting
+// from 0 in disk map order.
+struct DiskMapShard {
+  std::string                    Path;
+  std::unique_ptr<OutputSink>    Sink;
+  std::unique_ptr<std::ostream>  Out;
+  std::unique_ptr<AvroContainer> Avro; // head container, for avro output
+  uint64_t                       FirstRow,
+                                 Beg,     // of the first row
+                                 LastBeg, // of the last row
+                                 End;     // of the last row
+  size_t                         FirstVol; // index of the volume with the first row, whose part goes straight to Out
+};
+
+void writeDiskMapManifest(const std::string& path, const std::vector<DiskMapShard>& shards, uint64_t total) {
+  OutputSink   sink(path);
+  std::ostream file(&sink);
+  JsonWriter   buf;
+  for (size_t k = 0; k < shards.size(); ++k) {
+    const DiskMapShard& shard(shards[k]);
+    const uint64_t rows = (k + 1 < shards.size() ? shards[k + 1].FirstRow: total) - shard.FirstRow;
+    buf.raw("{").pair("shard", k, true)
+       .pair("file", shard.Path)
+       .pair("rows", rows);
+    if (rows) {
+      buf.pair("firstId", makeDiskMapID(shard.Beg))
+         .pair("lastId", makeDiskMapID(shard.LastBeg))
+         .pair("b", shard.Beg)
+         .pair("e", shard.End);
+    }
+    buf.raw("}\n");
+  }
+  file.write(buf.data(), buf.size());
+  file.flush();
+}
+
+// With numShards > 1, the disk map is split into that many files of as
+// near the same number of rows as can be, named diskMapFile.0000 and so on,
+// and diskMapFile is a manifest of them, a JSON row per shard. Otherwise
+// it's all in diskMapFile.
+//
+// Each volume's rows are written on a thread of their own, up to --threads.
+// A volume's rows for a shard go straight to the shard's file if the shard
+// begins in that volume, and otherwise to a MapPiece that's appended to the
+// shard's file once all the volumes are done. Splitting takes a first pass
+// to count each volume's rows.
+void outputDiskMap(const std::string& diskMapFile, std::shared_ptr<LbtTskAuto> w, LbtTskAuto::OUTPUT_FORMAT format, unsigned int numShards) {
   // std::cerr << "outputDiskMap" << std::endl;
   auto walker(std::dynamic_pointer_cast<MetadataWriter>(w));
-  if (walker) {
-    std::ofstream file(diskMapFile, std::ios::out | std::ios::trunc);
-
-    auto map(walker->diskMap());
-    for (auto fsMapInfo: map) {
-      auto layout = std::get<3>(fsMapInfo.second);
-      for (auto frag: layout) {
-        file  << "{" << j("id", makeDiskMapID(frag.first.lower()), true)
-              << ",\"t\": { \"i\": { "
-              << j("b", frag.first.lower(), true)
-              << j("l", frag.first.upper() - frag.first.lower())
-              << ", \"f\":[";
-        bool firstFile = true;
-        for (auto f: frag.second) {
-          if (!firstFile) {
-            file << ", ";
-          }
-          file  << "{"
-                << j("vol", fsMapInfo.first, true)
-                << j("inum", static_cast<int64_t>(std::get<0>(f)))
-                << j("attrId", std::get<1>(f))
-                << j("s", std::get<2>(f))
-                << j("drbeg", std::get<3>(f))
-                << j("fo", std::get<4>(f))
-                << "}";
-          firstFile = false;
+  if (!walker || diskMapFile.empty()) {
+    return;
+  }
+  const std::vector<uint32_t> vols(walker->diskMapVolumes());
+  const unsigned int threads = walker->threads();
+  const bool split = numShards > 1;
+
+  std::vector<uint64_t> volFirstRow(vols.size() + 1, 0);
+  if (split) {
+    forEachVolume(vols.size(), threads, [&](size_t v) {
+      walker->forEachFragment([&](uint32_t, uint64_t, uint64_t, const MetadataWriter::AttrSet&) {
+        ++volFirstRow[v + 1];
+      }, vols[v]);
+    });
+    std::partial_sum(volFirstRow.begin(), volFirstRow.end(), volFirstRow.begin());
+  }
+  const uint64_t total = volFirstRow.back();
+
+  std::vector<DiskMapShard> shards(split ? numShards: 1);
+  for (size_t k = 0; k < shards.size(); ++k) {
+    DiskMapShard& shard(shards[k]);
+    if (split) {
+      std::stringstream path;
+      path << diskMapFile << '.' << std::setw(4) << std::setfill('0') << k;
+      shard.Path = path.str();
+      shard.FirstRow = (k * total + shards.size() - 1) / shards.size();
+      shard.FirstVol = std::upper_bound(volFirstRow.begin(), volFirstRow.end() - 1, shard.FirstRow) - volFirstRow.begin() - 1;
+    }
+    else {
+      shard.Path = diskMapFile;
+      shard.FirstRow = 0;
+      shard.FirstVol = 0;
+    }
+    shard.Beg = shard.LastBeg = shard.End = 0;
+    shard.Sink.reset(new OutputSink(shard.Path, split ? MapPiece::MAP_BUFFER_SIZE: OutputSink::DEFAULT_BUFFER_SIZE));
+    shard.Out.reset(new std::ostream(shard.Sink.get()));
+    if (LbtTskAuto::AVRO == format) {
+      shard.Avro.reset(new AvroContainer(*shard.Out, DISK_MAP_SCHEMA, split ? MapPiece::MAP_BUFFER_SIZE: AvroContainer::DEFAULT_BLOCK_SIZE));
+    }
+  }
+
+  // by volume, the shards and pieces it didn't write straight to their files
+  std::vector<std::vector<std::pair<size_t, std::unique_ptr<MapPiece>>>> pieces(vols.size());
+  forEachVolume(vols.size(), threads, [&](size_t v) {
+    uint64_t row = volFirstRow[v];
+    size_t   k = 0;
+    std::unique_ptr<DiskMapRows> rows;
+    walker->forEachFragment([&](uint32_t vol, uint64_t beg, uint64_t end, const MetadataWriter::AttrSet& owners) {
+      const size_t rowShard = split ? row * shards.size() / total: 0;
+      if (!rows || rowShard != k) {
+        if (rows) {
+          rows->finish();
         }
-        file << "]}}}\n";
+        k = rowShard;
+        DiskMapShard& shard(shards[k]);
+        if (v == shard.FirstVol) {
+          rows.reset(new DiskMapRows(*shard.Out, shard.Avro.get(), true));
+        }
+        else {
+          pieces[v].emplace_back(k, std::unique_ptr<MapPiece>(new MapPiece));
+          rows.reset(new DiskMapRows(pieces[v].back().second->out(), shard.Avro.get(), false));
+        }
+      }
+      rows->write(vol, beg, end, owners);
+
+      DiskMapShard& shard(shards[k]);
+      if (row == shard.FirstRow) {
+        shard.Beg = beg;
       }
+      if (split && row + 1 == (k + 1 < shards.size() ? shards[k + 1].FirstRow: total)) {
+        shard.LastBeg = beg;
+        shard.End = end;
+      }
+      ++row;
+    }, vols[v]);
+    if (rows) {
+      rows->finish();
+    }
+  });
+
+  for (auto& volPieces: pieces) {
+    for (auto& piece: volPieces) {
+      piece.second->copyTo(*shards[piece.first].Out);
     }
-    file.close();
+  }
+  for (auto& shard: shards) {
+    shard.Avro.reset();
+    shard.Out->flush();
+  }
+  if (split) {
+    writeDiskMapManifest(diskMapFile, shards, total);
   }
 }
 
-void outputInodeMap(const std::string& inodeMapFile, std::shared_ptr<LbtTskAuto> w) {
+void outputOwnerIndex(const std::string& indexFile, std::shared_ptr<LbtTskAuto> w) {
   auto walker(std::dynamic_pointer_cast<MetadataWriter>(w));
-  if (walker) {
-    std::ofstream file(inodeMapFile, std::ios::out | std::ios::trunc);
+  if (walker && !indexFile.empty()) {
+    OwnerIndex::Writer index(indexFile, walker->sectorSize());
+    walker->forEachFragment([&](uint32_t vol, uint64_t beg, uint64_t end, const MetadataWriter::AttrSet& owners) {
+      index.fragment(vol, beg, end);
+      for (const auto& f: owners) {
+        index.owner(OwnerIndex::Owner{std::get<0>(f), std::get<3>(f), std::get<4>(f), std::get<1>(f), std::get<2>(f)});
+      }
+    });
+    if (!index.close()) {
+      throw std::runtime_error("could not write " + indexFile);
+    }
+  }
+}
 
-    const auto& reverseMap(walker->reverseMap());
-    for (auto fsReverseMap: reverseMap) {
-      uint32_t volIndex(fsReverseMap.first);
+// Formats inode map rows into out, as DiskMapRows does disk map rows.
+class InodeMapRows {
+public:
+  InodeMapRows(std::ostream& out, AvroContainer* head, bool intoHead):
+    Out(out), Buf(head ? 0: MapPiece::MAP_BUFFER_SIZE + 64 * 1024), Avro(head)
+  {
+    if (head && !intoHead) {
+      Continued.reset(new AvroContainer(out, *head));
+      Avro = Continued.get();
+    }
+  }
 
-      for (auto inodeMap: fsReverseMap.second) {
-        std::string s = makeInodeID(volIndex, inodeMap.first);
+  // ids are the files' binary record IDs, hex-encoded as in their records;
+  // continued if the inode already has a row, from the walk
+  void write(uint32_t vol, uint64_t addr, const std::vector<std::string>& ids, bool continued = false) {
+    writeInodeID(ID, vol, addr);
+    if (Avro) {
+      AvroWriter& rec(Avro->record());
+      rec.str(ID, INODE_ID_SIZE)
+         .beginArray(ids.size());
+      for (const auto& fileID: ids) {
+        rec.hex(fileID);
+      }
+      rec.endArray()
+         .boolean(continued);
+      Avro->endRecord();
+      return;
+    }
 
-        file << "{ \"id\":\"" << s
-             << "\", \"t\": { \"hardlinks\":[";
+    Buf.raw("{ \"id\":").value(ID, INODE_ID_SIZE)
+       .raw(", \"t\": { \"hardlinks\":[");
+    bool first = true;
+    for (const auto& fileID: ids) {
+      if (!first) {
+        Buf.raw(", ");
+      }
+      Buf.hex(fileID);
+      first = false;
+    }
+    Buf.raw(continued ? "], \"continued\":true}}\n": "]}}\n");
+    flushMapBuffer(Out, Buf);
+  }
 
-        bool first = true;
-        for (auto fileID: inodeMap.second) {
-          if (!first) {
-            file << ", ";
-          }
-          file << "\"" << fileID << "\"";
-          first = false;
+  void finish() {
+    if (Avro) {
+      Avro->flush();
+    }
+    else {
+      flushMapBuffer(Out, Buf, true);
+    }
+  }
+
+private:
+  std::ostream&  Out;
+  JsonWriter     Buf;
+  AvroContainer* Avro;
+  std::unique_ptr<AvroContainer> Continued;
+  char           ID[INODE_ID_SIZE];
+};
+
+// --inode-map-file, open for the whole dump. The walker hands sink() the
+// rows of inodes with only the one name as it finds them, and finish()
+// writes the rest after the walk, sorted, a volume per thread. Deleted
+// names found for a sunk inode get it a second row, marked as continued.
+class InodeMapFile {
+public:
+  InodeMapFile(const std::string& path, LbtTskAuto::OUTPUT_FORMAT format):
+    Sink(path), File(&Sink), Head(LbtTskAuto::AVRO == format ? new AvroContainer(File, INODE_MAP_SCHEMA): nullptr),
+    Walked(File, Head.get(), true) {}
+
+  MetadataWriter::InodeFn sink() {
+    return [this](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) { Walked.write(vol, addr, ids); };
+  }
+
+  void finish(MetadataWriter& walker) {
+    Walked.finish();
+    outputMapByVolume(File, walker.inodeMapVolumes(), walker.threads(), [&](std::ostream& out, uint32_t volIndex, bool first) {
+      InodeMapRows rows(out, Head.get(), first);
+      walker.forEachInode([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+        rows.write(vol, addr, ids, walker.sunk(vol, addr));
+      }, volIndex);
+      rows.finish();
+    });
+    Head.reset();
+    File.flush();
+  }
+
+private:
+  InodeMapFile(const InodeMapFile&);
+  InodeMapFile& operator=(const InodeMapFile&);
+
+  OutputSink   Sink;
+  std::ostream File;
+  std::unique_ptr<AvroContainer> Head; // for avro output
+  InodeMapRows Walked; // rows from the walk
+};
+
+// "gzip" or "gzip:N", N being zlib's 0-9
+bool parseGzipLevel(const std::string& spec, int& level) {
+  if (spec == "gzip") {
+    level = -1; // Z_DEFAULT_COMPRESSION
+    return true;
+  }
+  if (spec.size() == 6 && spec.compare(0, 5, "gzip:") == 0 && spec[5] >= '0' && spec[5] <= '9') {
+    level = spec[5] - '0';
+    return true;
+  }
+  return false;
+}
+
+// a number of bytes, optionally with a K, M, or G suffix
+bool parseByteSize(const std::string& spec, uint64_t& bytes) {
+  size_t end = 0;
+  try {
+    bytes = std::stoull(spec, &end);
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  if (spec[0] == '-') {
+    return false;
+  }
+  if (end + 1 == spec.size()) {
+    const size_t unit = std::string("KMG").find(std::toupper(spec[end]));
+    if (unit == std::string::npos) {
+      return false;
+    }
+    bytes <<= 10 * (unit + 1);
+    return true;
+  }
+  return end == spec.size();
+}
+
+// a byte offset, in decimal or 0x hex, or a sector number with an 's' suffix
+bool parseOffset(const std::string& spec, uint32_t sectorSize, uint64_t& offset) {
+  if (spec.empty() || !std::isdigit(static_cast<unsigned char>(spec[0]))) {
+    return false;
+  }
+  const bool sector = spec[spec.size() - 1] == 's';
+  const std::string num(spec, 0, spec.size() - (sector ? 1: 0));
+  size_t end = 0;
+  try {
+    offset = std::stoull(num, &end, num.compare(0, 2, "0x") == 0 ? 16: 10);
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+  if (end != num.size()) {
+    return false;
+  }
+  if (sector) {
+    offset *= sectorSize;
+  }
+  return true;
+}
+
+// Writes a JSON row for each offset, with the disk map fragments containing
+// it (one per volume, at most) and their owners, and where in each owner's
+// file the offset falls. An offset of "-" reads more offsets from stdin, one
+// per line.
+int whoOwns(const std::string& indexFile, const std::vector<std::string>& offsets, std::ostream& out) {
+  OwnerIndex index;
+  if (!index.open(indexFile)) {
+    std::cerr << "Error: could not read an owner index from " << indexFile << std::endl;
+    return 1;
+  }
+  JsonWriter buf;
+  std::vector<const OwnerIndex::Fragment*> found;
+  auto lookup = [&](const std::string& spec) {
+    uint64_t offset;
+    if (!parseOffset(spec, index.sectorSize(), offset)) {
+      std::cerr << "Error: did not understand offset " << spec << std::endl;
+      return false;
+    }
+    buf.raw("{").pair("offset", offset, true)
+       .raw(",\"i\":[");
+    index.find(offset, found);
+    for (const OwnerIndex::Fragment* frag: found) {
+      if (frag != found.front()) {
+        buf.raw(",");
+      }
+      buf.raw("{").pair("id", makeDiskMapID(frag->Beg), true)
+         .pair("b", frag->Beg)
+         .pair("l", frag->End - frag->Beg)
+         .raw(",\"f\":[");
+      for (const OwnerIndex::Owner* o = index.ownersBegin(*frag); o != index.ownersEnd(*frag); ++o) {
+        if (o != index.ownersBegin(*frag)) {
+          buf.raw(",");
         }
-        file << "]}}\n";
+        buf.raw("{").pair("vol", frag->Vol, true)
+           .pair("inum", static_cast<int64_t>(o->Addr))
+           .pair("inode", makeInodeID(frag->Vol, o->Addr))
+           .pair("attrId", o->AttrID)
+           .pair("s", o->Slack)
+           .pair("drbeg", o->DrBeg)
+           .pair("fo", o->Offset)
+           .pair("fileOffset", o->Offset + (offset - o->DrBeg))
+           .raw("}");
       }
+      buf.raw("]}");
+    }
+    buf.raw("]}\n");
+    flushMapBuffer(out, buf);
+    return true;
+  };
+
+  bool ok = true;
+  for (auto spec = offsets.begin(); ok && spec != offsets.end(); ++spec) {
+    if (*spec == "-") {
+      std::string line;
+      while (ok && std::getline(std::cin, line)) {
+        ok = line.empty() || lookup(line);
+      }
+    }
+    else {
+      ok = lookup(*spec);
     }
-    file.close();
   }
+  flushMapBuffer(out, buf, true);
+  out.flush();
+  return ok ? 0: 1;
+}
+
+// comma-separated Fields::Group names, or "all"
+bool parseFields(const std::string& spec, unsigned int& fields) {
+  static const std::pair<const char*, unsigned int> groups[] = {
+    {"all",    Fields::ALL},
+    {"name",   Fields::NAME},
+    {"meta",   Fields::META},
+    {"times",  Fields::TIMES},
+    {"attrs",  Fields::ATTRS},
+    {"runs",   Fields::RUNS},
+    {"rd_buf", Fields::RD_BUF}
+  };
+  fields = 0;
+  size_t beg = 0;
+  while (beg <= spec.size()) {
+    size_t end = spec.find(',', beg);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    const std::string name(spec, beg, end - beg);
+    auto g = std::find_if(std::begin(groups), std::end(groups), [&name](const std::pair<const char*, unsigned int>& p) { return name == p.first; });
+    if (g == std::end(groups)) {
+      return false;
+    }
+    fields |= g->second;
+    beg = end + 1;
+  }
+  return true;
+}
+
+// sets up filter from the filter options; on failure, bad is the option it didn't understand
+bool parseFilter(const po::variables_map& vm, RecordFilter& filter, std::string& bad) {
+  if (vm.count("path-glob")) {
+    filter.setPathGlob(vm["path-glob"].as<std::string>());
+  }
+  if (vm.count("type")) {
+    const std::string& spec(vm["type"].as<std::string>());
+    unsigned int types;
+    if (!RecordFilter::parseTypes(spec, types)) {
+      bad = "--type=" + spec;
+      return false;
+    }
+    filter.setTypes(types);
+  }
+  if (vm.count("min-size") || vm.count("max-size")) {
+    filter.setSizeRange(vm.count("min-size") ? vm["min-size"].as<uint64_t>(): 0,
+                        vm.count("max-size") ? vm["max-size"].as<uint64_t>(): std::numeric_limits<uint64_t>::max());
+  }
+  if (vm.count("after") || vm.count("before")) {
+    static const std::pair<const char*, RecordFilter::TIME_FIELD> timeFields[] = {
+      {"modified", RecordFilter::MODIFIED},
+      {"accessed", RecordFilter::ACCESSED},
+      {"created",  RecordFilter::CREATED},
+      {"metadata", RecordFilter::METADATA},
+      {"any",      RecordFilter::ANY_TIME}
+    };
+    const std::string& field(vm["time-field"].as<std::string>());
+    auto f = std::find_if(std::begin(timeFields), std::end(timeFields), [&field](const std::pair<const char*, RecordFilter::TIME_FIELD>& p) { return field == p.first; });
+    if (f == std::end(timeFields)) {
+      bad = "--time-field=" + field;
+      return false;
+    }
+    int64_t after = std::numeric_limits<int64_t>::min(),
+            before = std::numeric_limits<int64_t>::max();
+    if (vm.count("after") && !RecordFilter::parseTime(vm["after"].as<std::string>(), after)) {
+      bad = "--after=" + vm["after"].as<std::string>();
+      return false;
+    }
+    if (vm.count("before") && !RecordFilter::parseTime(vm["before"].as<std::string>(), before)) {
+      bad = "--before=" + vm["before"].as<std::string>();
+      return false;
+    }
+    filter.setTimeWindow(f->second, after, before);
+  }
+  if (vm.count("alloc")) {
+    const std::string& state(vm["alloc"].as<std::string>());
+    if (state == "allocated") {
+      filter.setAllocState(RecordFilter::ALLOCATED);
+    }
+    else if (state == "unallocated") {
+      filter.setAllocState(RecordFilter::UNALLOCATED);
+    }
+    else if (state != "any") {
+      bad = "--alloc=" + state;
+      return false;
+    }
+  }
+  return true;
 }
 
 int main(int argc, char *argv[]) {
   std::string command,
               ucMode,
+              ucSource,
               volMode,
+              format,
+              fields,
+              scanOrder,
+              compress,
               inodeMapFile,
-              diskMapFile;
-  uint64_t    maxUcBlockSize;
+              diskMapFile,
+              checkpointFile,
+              indexFile,
+              sinceFile,
+              ownerIndexFile,
+              maxMemory;
+  uint64_t    maxUcBlockSize,
+              checkpointEvery;
+  unsigned int threads,
+               diskMapShards;
 
   po::options_description desc("Allowed Options");
   po::positional_options_description posOpts;
@@ -143,19 +708,59 @@ int main(int argc, char *argv[]) {
   posOpts.add("ev-files", -1);
   desc.add_options()
     ("help", "produce help message")
-    ("command", po::value< std::string >(&command), "command to perform [info|dumpimg|dumpfs|dumpfiles]")
+    ("command", po::value< std::string >(&command), "command to perform [info|dumpimg|dumpfs|dumpfiles|whoowns]")
     ("overview-file", po::value< std::string >(), "output disk overview information")
     ("unallocated", po::value< std::string >(&ucMode)->default_value("none"), "how to handle unallocated [none|fragment|block]")
+    ("unallocated-source", po::value< std::string >(&ucSource)->default_value("runs"), "where unallocated space comes from; bitmap asks the filesystem, and doesn't need every file's runs [runs|bitmap]")
     ("max-unallocated-block-size", po::value< uint64_t >(&maxUcBlockSize)->default_value(std::numeric_limits<uint64_t>::max()), "Maximum size of an unallocated entry, in blocks")
+    ("format", po::value< std::string >(&format)->default_value("json"), "output format for dumpfs [json|binary|avro]")
+    ("fields", po::value< std::string >(&fields)->default_value("all"), "comma-separated field groups for dumpfs to compute and write [all|name|meta|times|attrs|runs|rd_buf]")
+    ("path-glob", po::value< std::string >(), "only write dumpfs entries whose path matches, e.g. 'home/**/*.doc'; without a '/', matches the name")
+    ("type", po::value< std::string >(), "only write dumpfs entries of these comma-separated types [file|dir|link|other]")
+    ("min-size", po::value< uint64_t >(), "only write dumpfs entries at least this many bytes in size")
+    ("max-size", po::value< uint64_t >(), "only write dumpfs entries at most this many bytes in size")
+    ("after", po::value< std::string >(), "only write dumpfs entries whose time is at or after this, in seconds since the epoch or as YYYY-MM-DD[THH:MM:SS] UTC")
+    ("before", po::value< std::string >(), "only write dumpfs entries whose time is before this")
+    ("time-field", po::value< std::string >()->default_value("modified"), "which time --after and --before look at [modified|accessed|created|metadata|any]")
+    ("alloc", po::value< std::string >(), "only write dumpfs entries in this allocation state [any|allocated|unallocated]")
+    ("scan-order", po::value< std::string >(&scanOrder)->default_value("dir"), "order of dumpfs entries; inode reads the inodes in one sequential pass [dir|inode]")
+    ("compress", po::value< std::string >(&compress)->default_value("none"), "compress output [none|gzip[:level]]")
+    ("threads", po::value< unsigned int >(&threads)->default_value(1), "number of threads to use")
+    ("max-memory", po::value< std::string >(&maxMemory)->default_value("0"), "memory for the disk and inode maps, e.g. 4G, past which they're spilled to temporary files; 0 for no limit")
+    ("checkpoint-file", po::value< std::string >(&checkpointFile)->default_value(""), "file to save dumpfs's progress in, for --resume")
+    ("checkpoint-every", po::value< uint64_t >(&checkpointEvery)->default_value(1000000), "number of directory entries between checkpoints")
+    ("resume", "continue dumpfs from --checkpoint-file, writing only what comes after it")
+    ("index-file", po::value< std::string >(&indexFile)->default_value(""), "file to save each inode's seq, times and size in, for a later --since")
+    ("since", po::value< std::string >(&sinceFile)->default_value(""), "a previous dumpfs's --index-file; write only the entries whose inodes were added or changed, and tombstones for those removed")
     ("ev-files", po::value< std::vector< std::string > >(), "evidence files")
     ("inode-map-file", po::value<std::string>(&inodeMapFile)->default_value(""), "optional file to output containing directory entry to inode map")
-    ("disk-map-file", po::value<std::string>(&diskMapFile)->default_value(""), "optional file to output containing disk data to inode map");
+    ("disk-map-file", po::value<std::string>(&diskMapFile)->default_value(""), "optional file to output containing disk data to inode map")
+    ("disk-map-shards", po::value<unsigned int>(&diskMapShards)->default_value(1), "number of files to split the disk map into by offset, as FILE.0000 and so on, with --disk-map-file a manifest of them")
+    ("owner-index-file", po::value<std::string>(&ownerIndexFile)->default_value(""), "file for dumpfs to save an index of the disk map's owners by offset in, and for whoowns to look offsets up in");
 
   po::variables_map vm;
   try {
     po::store(po::command_line_parser(argc, argv).options(desc).positional(posOpts).run(), vm);
     po::notify(vm);
 
+    // declared before the walker so that they outlive it
+    OutputSink                       stdoutSink(1);
+    std::ostream                     stdoutStream(&stdoutSink);
+    std::unique_ptr<ParallelGzipBuf> gzipBuf;
+    std::unique_ptr<std::ostream>    gzipOut;
+    std::ostream* out = &stdoutStream;
+    if (compress != "none") {
+      int level;
+      if (!parseGzipLevel(compress, level)) {
+        std::cerr << "Error: did not understand --compress=" << compress << "\n\n";
+        printHelp(desc);
+        return 1;
+      }
+      gzipBuf.reset(new ParallelGzipBuf(&stdoutSink, level, threads));
+      gzipOut.reset(new std::ostream(gzipBuf.get()));
+      out = gzipOut.get();
+    }
+
     std::shared_ptr<LbtTskAuto> walker;
 
     std::vector< std::string > imgSegs;
@@ -165,7 +770,15 @@ int main(int argc, char *argv[]) {
     if (vm.count("help")) {
       printHelp(desc);
     }
-    else if (vm.count("command") && vm.count("ev-files") && (walker = createVisitor(command, std::cout, imgSegs))) {
+    else if (command == "whoowns" && vm.count("ev-files")) {
+      if (ownerIndexFile.empty()) {
+        std::cerr << "Error: whoowns needs --owner-index-file\n\n";
+        printHelp(desc);
+        return 1;
+      }
+      return whoOwns(ownerIndexFile, imgSegs, *out);
+    }
+    else if (vm.count("command") && vm.count("ev-files") && (walker = createVisitor(command, *out, imgSegs))) {
       std_binary_io();
 
       boost::scoped_array< const char* >  segments(new const char*[imgSegs.size()]);
@@ -191,15 +804,114 @@ int main(int argc, char *argv[]) {
         else {
           walker->setUnallocatedMode(LbtTskAuto::NONE);
         }
+        if (ucSource == "bitmap") {
+          walker->setUnallocatedSource(LbtTskAuto::BITMAP);
+        }
+        else if (ucSource != "runs") {
+          std::cerr << "Error: did not understand --unallocated-source=" << ucSource << "\n\n";
+          printHelp(desc);
+          return 1;
+        }
+        LbtTskAuto::OUTPUT_FORMAT outputFormat = LbtTskAuto::JSON;
+        if (format == "binary") {
+          outputFormat = LbtTskAuto::BINARY;
+        }
+        else if (format == "avro") {
+          outputFormat = LbtTskAuto::AVRO;
+        }
+        if (command == "dumpfs") {
+          unsigned int fieldGroups;
+          if (!parseFields(fields, fieldGroups)) {
+            std::cerr << "Error: did not understand --fields=" << fields << "\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          RecordFilter filter;
+          std::string  badFilter;
+          if (!parseFilter(vm, filter, badFilter)) {
+            std::cerr << "Error: did not understand " << badFilter << "\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          walker->setFields(fieldGroups);
+          walker->setFilter(filter);
+          walker->setThreads(threads);
+          if (scanOrder == "inode") {
+            walker->setScanOrder(LbtTskAuto::INODE);
+          }
+          else if (scanOrder != "dir") {
+            std::cerr << "Error: did not understand --scan-order=" << scanOrder << "\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          walker->setBuildDiskMap(!diskMapFile.empty() || !ownerIndexFile.empty());
+          walker->setBuildInodeMap(!inodeMapFile.empty());
+          walker->setOutputFormat(outputFormat);
+          if (!checkpointFile.empty()) {
+            if (threads > 1 || scanOrder != "dir" || outputFormat == LbtTskAuto::AVRO || compress != "none") {
+              std::cerr << "Error: --checkpoint-file needs --threads=1, --scan-order=dir, and uncompressed json or binary output\n\n";
+              printHelp(desc);
+              return 1;
+            }
+            walker->setCheckpoints(checkpointFile, checkpointEvery);
+            if (vm.count("resume") && !walker->resume(checkpointFile)) {
+              std::cerr << "Error: could not read a checkpoint from " << checkpointFile << std::endl;
+              return 1;
+            }
+          }
+          else if (vm.count("resume")) {
+            std::cerr << "Error: --resume needs --checkpoint-file\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          uint64_t maxMemoryBytes;
+          if (!parseByteSize(maxMemory, maxMemoryBytes)) {
+            std::cerr << "Error: did not understand --max-memory=" << maxMemory << "\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          walker->setMaxMemory(maxMemoryBytes);
+          if (diskMapShards == 0) {
+            std::cerr << "Error: did not understand --disk-map-shards=0\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          if (diskMapShards > 1 && diskMapFile.empty()) {
+            std::cerr << "Error: --disk-map-shards needs --disk-map-file\n\n";
+            printHelp(desc);
+            return 1;
+          }
+          walker->setIndexFile(indexFile);
+          if (!sinceFile.empty()) {
+            if (outputFormat == LbtTskAuto::AVRO) {
+              std::cerr << "Error: --since needs json or binary output\n\n";
+              printHelp(desc);
+              return 1;
+            }
+            if (!walker->setSince(sinceFile)) {
+              std::cerr << "Error: could not read an index from " << sinceFile << std::endl;
+              return 1;
+            }
+          }
+        }
+        std::shared_ptr<InodeMapFile> inodeMap;
+        auto writer(std::dynamic_pointer_cast<MetadataWriter>(walker));
+        if (writer && !inodeMapFile.empty() && command == "dumpfs") {
+          inodeMap.reset(new InodeMapFile(inodeMapFile, outputFormat));
+          writer->setInodeSink(inodeMap->sink());
+        }
         if (0 == walker->start()) {
-          walker->startUnallocated();
           walker->finishWalk();
           std::vector<std::future<void>> futs;
           if (vm.count("disk-map-file") && command == "dumpfs") {
-            futs.emplace_back(std::async(outputDiskMap, diskMapFile, walker));
+            // both sweep the disk map, so one after the other
+            futs.emplace_back(std::async([=]() {
+              outputDiskMap(diskMapFile, walker, outputFormat, diskMapShards);
+              outputOwnerIndex(ownerIndexFile, walker);
+            }));
           }
-          if (vm.count("inode-map-file") && command == "dumpfs") {
-            futs.emplace_back(std::async(outputInodeMap, inodeMapFile, walker));
+          if (inodeMap) {
+            futs.emplace_back(std::async([=]() { inodeMap->finish(*writer); }));
           }
           for (auto& fut: futs) {
             fut.get();
@@ -207,9 +919,9 @@ int main(int argc, char *argv[]) {
           return 0;
         }
         else {
-          std::cout.flush();
+          out->flush();
           std::cerr << "Had an error parsing filesystem" << std::endl;
-          for (auto& err: walker->getErrorList()) {
+          for (auto& err: walker->errors()) {
             std::cerr << err.msg1 << " " << err.msg2 << std::endl;
           }
         }
@@ -0,0 +1,260 @@
+#include "outputsink.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+  #include <io.h>
+#else
+  #include <sys/uio.h>
+  #include <unistd.h>
+#endif
+
+#if defined(__linux__)
+  #define FSRIP_SPLICE
+#endif
+
+namespace {
+  long sysWrite(int fd, const char* s, size_t n) {
+#if defined(_WIN32)
+    return _write(fd, s, n > 1u << 30 ? 1u << 30: static_cast<unsigned int>(n));
+#else
+    return ::write(fd, s, n);
+#endif
+  }
+
+  int openForWriting(const std::string& path) {
+#if defined(_WIN32)
+    const int fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) {
+      throw std::runtime_error("could not open " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+  }
+}
+
+OutputSink::OutputSink(int fd, size_t bufSize):
+  Fd(fd), OwnFd(false), Splice(false), Failed(false), BufSize(bufSize ? bufSize: DEFAULT_BUFFER_SIZE), CurBuf(0), BytesWritten(0)
+{
+  init();
+}
+
+OutputSink::OutputSink(const std::string& path, size_t bufSize):
+  Fd(openForWriting(path)), OwnFd(true), Splice(false), Failed(false), BufSize(bufSize ? bufSize: DEFAULT_BUFFER_SIZE), CurBuf(0), BytesWritten(0)
+{
+  init();
+}
+
+OutputSink::~OutputSink() {
+  sync();
+  if (OwnFd) {
+#if defined(_WIN32)
+    _close(Fd);
+#else
+    ::close(Fd);
+#endif
+  }
+  for (char* b: Buffers) {
+    std::free(b);
+  }
+}
+
+void OutputSink::init() {
+#ifdef FSRIP_SPLICE
+  struct stat st;
+  if (fstat(Fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+    // vmsplice wants whole pages, and a buffer at least as big as the pipe
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    BufSize = (BufSize + pageSize - 1) / pageSize * pageSize;
+    fcntl(Fd, F_SETPIPE_SZ, static_cast<int>(BufSize)); // fails if over pipe-max-size, which is fine
+    const int pipeSize = fcntl(Fd, F_GETPIPE_SZ);
+    if (pipeSize > 0 && size_t(pipeSize) <= BufSize) {
+      for (unsigned int i = 0; i < 2; ++i) {
+        void* p;
+        if (posix_memalign(&p, pageSize, BufSize) != 0) {
+          throw std::bad_alloc();
+        }
+        Buffers.push_back(static_cast<char*>(p));
+      }
+      Splice = true;
+    }
+  }
+#endif
+  if (Buffers.empty()) {
+    char* p = static_cast<char*>(std::malloc(BufSize));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    Buffers.push_back(p);
+  }
+  setp(Buffers[CurBuf], Buffers[CurBuf] + BufSize);
+}
+
+bool OutputSink::writeAll(const char* s, size_t n) {
+  while (n) {
+    const long ret = sysWrite(Fd, s, n);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    s += ret;
+    n -= ret;
+  }
+  return true;
+}
+
+bool OutputSink::writeAll(const char* s1, size_t n1, const char* s2, size_t n2) {
+#if defined(_WIN32)
+  return writeAll(s1, n1) && writeAll(s2, n2);
+#else
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char*>(s1);
+  iov[0].iov_len = n1;
+  iov[1].iov_base = const_cast<char*>(s2);
+  iov[1].iov_len = n2;
+  struct iovec* cur = n1 ? iov: iov + 1;
+  int num = n1 ? 2: 1;
+  while (num) {
+    ssize_t ret = ::writev(Fd, cur, num);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    while (num && size_t(ret) >= cur->iov_len) {
+      ret -= cur->iov_len;
+      ++cur;
+      --num;
+    }
+    if (num) {
+      cur->iov_base = static_cast<char*>(cur->iov_base) + ret;
+      cur->iov_len -= ret;
+    }
+  }
+  return true;
+#endif
+}
+
+bool OutputSink::spliceAll(char* s, size_t n) {
+#ifdef FSRIP_SPLICE
+  struct iovec iov;
+  iov.iov_base = s;
+  iov.iov_len = n;
+  while (iov.iov_len) {
+    const ssize_t ret = vmsplice(Fd, &iov, 1, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    iov.iov_base = static_cast<char*>(iov.iov_base) + ret;
+    iov.iov_len -= ret;
+  }
+  return true;
+#else
+  return writeAll(s, n);
+#endif
+}
+
+bool OutputSink::flushBuffer() {
+  const size_t n = pptr() - pbase();
+  if (n && !Failed) {
+    if (Splice && n == BufSize) {
+      // the pages now belong to the pipe until the reader gets to them, so
+      // fill the other buffer meanwhile
+      Failed = !spliceAll(pbase(), n);
+      CurBuf ^= 1;
+    }
+    else {
+      Failed = !writeAll(pbase(), n);
+    }
+    if (!Failed) {
+      BytesWritten += n;
+    }
+  }
+  setp(Buffers[CurBuf], Buffers[CurBuf] + BufSize);
+  return !Failed;
+}
+
+OutputSink::int_type OutputSink::overflow(int_type c) {
+  if (!flushBuffer()) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize OutputSink::xsputn(const char* s, std::streamsize n) {
+  if (Failed) {
+    return 0;
+  }
+  size_t room = epptr() - pptr();
+  if (size_t(n) <= room) {
+    std::memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+  }
+  if (size_t(n) >= BufSize) {
+    // too big to be worth copying; send it along with what's buffered
+    const size_t buffered = pptr() - pbase();
+    Failed = !writeAll(pbase(), buffered, s, n);
+    if (Failed) {
+      return 0;
+    }
+    BytesWritten += buffered + n;
+    setp(Buffers[CurBuf], Buffers[CurBuf] + BufSize);
+    return n;
+  }
+  // top off the buffer so that it goes out whole, then start the next
+  std::memcpy(pptr(), s, room);
+  pbump(room);
+  if (!flushBuffer()) {
+    return room;
+  }
+  std::memcpy(pptr(), s + room, n - room);
+  pbump(n - room);
+  return n;
+}
+
+int OutputSink::sync() {
+  return flushBuffer() ? 0: -1;
+}
+
+SpoolFile::SpoolFile(size_t bufSize): BufSize(bufSize), File(std::tmpfile()) {
+  if (!File) {
+    throw std::runtime_error("could not create a temporary file");
+  }
+  Sink.reset(new OutputSink(fileno(File), BufSize));
+  Out.reset(new std::ostream(Sink.get()));
+}
+
+SpoolFile::~SpoolFile() {
+  Out.reset();
+  Sink.reset();
+  std::fclose(File);
+}
+
+void SpoolFile::copyTo(std::ostream& dest) {
+  Out->flush();
+  std::rewind(File);
+  std::vector<char> buf(BufSize);
+  size_t len;
+  while ((len = std::fread(&buf[0], 1, buf.size(), File)) > 0) {
+    dest.write(&buf[0], len);
+  }
+}
@@ -0,0 +1,224 @@
+#include "ownerindex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace {
+  const char MAGIC[8] = {'F', 'S', 'R', 'I', 'P', 'O', 'X', '1'};
+
+  struct Header {
+    char     Magic[8];
+    uint32_t SectorSize,
+             NumVolumes;
+    uint64_t NumFragments,
+             NumOwners;
+  };
+}
+
+OwnerIndex::OwnerIndex():
+  Fragments(nullptr), Owners(nullptr), Volumes(nullptr), NumFragments(0), NumVolumes(0),
+  SectorSize(0), Map(nullptr), MapSize(0) {}
+
+OwnerIndex::~OwnerIndex() {
+  close();
+}
+
+void OwnerIndex::close() {
+#if !defined(_WIN32)
+  if (Map) {
+    munmap(Map, MapSize);
+  }
+#endif
+  Map = nullptr;
+  MapSize = 0;
+  Fragments = nullptr;
+  Owners = nullptr;
+  Volumes = nullptr;
+  NumFragments = 0;
+  NumVolumes = 0;
+  SectorSize = 0;
+  Copy.clear();
+}
+
+bool OwnerIndex::open(const std::string& path) {
+  close();
+  const char* data;
+  size_t size;
+#if defined(_WIN32)
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  Copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  data = Copy.data();
+  size = Copy.size();
+#else
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  size = st.st_size;
+  void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  Map = map;
+  MapSize = size;
+  madvise(map, size, MADV_RANDOM);
+  data = static_cast<const char*>(map);
+#endif
+
+  Header h;
+  if (size < sizeof(h)) {
+    close();
+    return false;
+  }
+  std::memcpy(&h, data, sizeof(h));
+  size_t room = size - sizeof(h);
+  if (std::memcmp(h.Magic, MAGIC, sizeof(MAGIC)) || h.NumFragments > room / sizeof(Fragment)) {
+    close();
+    return false;
+  }
+  room -= h.NumFragments * sizeof(Fragment);
+  if (h.NumOwners > room / sizeof(Owner)) {
+    close();
+    return false;
+  }
+  room -= h.NumOwners * sizeof(Owner);
+  if (h.NumVolumes > room / sizeof(Volume)) {
+    close();
+    return false;
+  }
+  // mmap() is page-aligned, and the header and records are multiples of 8 bytes
+  const char* cur = data + sizeof(h);
+  Fragments = reinterpret_cast<const Fragment*>(cur);
+  cur += h.NumFragments * sizeof(Fragment);
+  Owners = reinterpret_cast<const Owner*>(cur);
+  cur += h.NumOwners * sizeof(Owner);
+  Volumes = reinterpret_cast<const Volume*>(cur);
+  NumFragments = h.NumFragments;
+  NumVolumes = h.NumVolumes;
+  SectorSize = h.SectorSize;
+  return true;
+}
+
+void OwnerIndex::find(uint64_t offset, std::vector<const Fragment*>& found) const {
+  found.clear();
+  for (const Volume* v = Volumes; v != Volumes + NumVolumes; ++v) {
+    if (v->FirstFragment > NumFragments || v->NumFragments > NumFragments - v->FirstFragment) {
+      continue; // a damaged index
+    }
+    const Fragment* beg = Fragments + v->FirstFragment;
+    const Fragment* end = beg + v->NumFragments;
+    const Fragment* f = std::upper_bound(beg, end, offset,
+      [](uint64_t off, const Fragment& frag) { return off < frag.Beg; });
+    if (f != beg && offset < (f - 1)->End) {
+      found.push_back(f - 1);
+    }
+  }
+}
+
+OwnerIndex::Writer::Writer(const std::string& path, uint32_t sectorSize):
+  Path(path), Out(nullptr), OwnerFile(nullptr), SectorSize(sectorSize),
+  HaveCur(false), Failed(false), NumFragments(0), NumOwners(0)
+{
+  // written aside and renamed, as with InodeIndex, so a half-written index is never left in path
+  Out = std::fopen((Path + ".tmp").c_str(), "wb");
+  OwnerFile = std::tmpfile();
+  if (!Out || !OwnerFile) {
+    const std::string err(std::strerror(errno));
+    if (Out) {
+      std::fclose(Out);
+      std::remove((Path + ".tmp").c_str());
+    }
+    if (OwnerFile) {
+      std::fclose(OwnerFile);
+    }
+    throw std::runtime_error("could not create " + Path + ": " + err);
+  }
+  Header h;
+  std::memset(&h, 0, sizeof(h));
+  Failed = std::fwrite(&h, sizeof(h), 1, Out) != 1; // a placeholder, until the counts are known
+}
+
+OwnerIndex::Writer::~Writer() {
+  if (Out) {
+    std::fclose(Out);
+    std::remove((Path + ".tmp").c_str());
+  }
+  if (OwnerFile) {
+    std::fclose(OwnerFile);
+  }
+}
+
+void OwnerIndex::Writer::flushFragment() {
+  if (HaveCur) {
+    Failed |= std::fwrite(&Cur, sizeof(Cur), 1, Out) != 1;
+    ++NumFragments;
+    HaveCur = false;
+  }
+}
+
+void OwnerIndex::Writer::fragment(uint32_t vol, uint64_t beg, uint64_t end) {
+  flushFragment();
+  if (Volumes.empty() || Volumes.back().Vol != vol) {
+    Volumes.push_back(Volume{NumFragments, 0, vol, 0});
+  }
+  ++Volumes.back().NumFragments;
+  Cur.Beg = beg;
+  Cur.End = end;
+  Cur.FirstOwner = NumOwners;
+  Cur.Vol = vol;
+  Cur.NumOwners = 0;
+  HaveCur = true;
+}
+
+void OwnerIndex::Writer::owner(const Owner& o) {
+  Failed |= std::fwrite(&o, sizeof(o), 1, OwnerFile) != 1;
+  ++NumOwners;
+  ++Cur.NumOwners;
+}
+
+bool OwnerIndex::Writer::close() {
+  flushFragment();
+
+  std::rewind(OwnerFile);
+  Owner o;
+  for (uint64_t i = 0; i < NumOwners && !Failed; ++i) {
+    Failed = std::fread(&o, sizeof(o), 1, OwnerFile) != 1 || std::fwrite(&o, sizeof(o), 1, Out) != 1;
+  }
+  if (!Volumes.empty()) {
+    Failed = Failed || std::fwrite(&Volumes[0], sizeof(Volume), Volumes.size(), Out) != Volumes.size();
+  }
+
+  Header h;
+  std::memcpy(h.Magic, MAGIC, sizeof(MAGIC));
+  h.SectorSize = SectorSize;
+  h.NumVolumes = Volumes.size();
+  h.NumFragments = NumFragments;
+  h.NumOwners = NumOwners;
+  Failed = Failed || std::fseek(Out, 0, SEEK_SET) != 0 || std::fwrite(&h, sizeof(h), 1, Out) != 1;
+  Failed = std::fclose(Out) != 0 || Failed;
+  Out = nullptr;
+
+  const std::string tmp(Path + ".tmp");
+  if (Failed || std::rename(tmp.c_str(), Path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,87 @@
+#include "spill.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+  const size_t FAN_IN = 16;
+
+  template<class Record, class Less>
+  void compact(SpillFiles& files) {
+    while (files.size() >= FAN_IN) {
+      const size_t beg = files.size() - FAN_IN;
+      const unsigned int level = files[beg]->level();
+      for (size_t i = beg + 1; i < files.size(); ++i) {
+        if (files[i]->level() != level) {
+          return;
+        }
+      }
+      std::unique_ptr<SpillFile> merged(new SpillFile(level + 1));
+      for (SpillMerge<Record, Less> m(files, beg, files.size()); !m.empty(); m.pop()) {
+        merged->write(m.top());
+      }
+      files.resize(beg);
+      files.push_back(std::move(merged));
+    }
+  }
+}
+
+SpillFile::SpillFile(unsigned int level):
+  File(std::tmpfile()), Level(level)
+{
+  if (!File) {
+    throw std::runtime_error(std::string("could not create a temporary file: ") + std::strerror(errno));
+  }
+}
+
+SpillFile::~SpillFile() {
+  std::fclose(File);
+}
+
+void SpillFile::write(const void* data, size_t len) {
+  if (std::fwrite(data, 1, len, File) != len) {
+    throw std::runtime_error(std::string("could not write a temporary file: ") + std::strerror(errno));
+  }
+}
+
+void SpillFile::write(const RunRecord& r) {
+  write(&r, sizeof(r));
+}
+
+void SpillFile::write(const InodeRecord& r) {
+  const uint32_t len = r.ID.size();
+  write(&r.Vol, sizeof(r.Vol));
+  write(&r.Addr, sizeof(r.Addr));
+  write(&len, sizeof(len));
+  write(r.ID.data(), len);
+}
+
+void SpillFile::rewind() {
+  std::fflush(File);
+  std::rewind(File);
+}
+
+bool SpillFile::read(RunRecord& r) {
+  return std::fread(&r, sizeof(r), 1, File) == 1;
+}
+
+bool SpillFile::read(InodeRecord& r) {
+  uint32_t len;
+  if (std::fread(&r.Vol, sizeof(r.Vol), 1, File) != 1 ||
+      std::fread(&r.Addr, sizeof(r.Addr), 1, File) != 1 ||
+      std::fread(&len, sizeof(len), 1, File) != 1)
+  {
+    return false;
+  }
+  r.ID.resize(len);
+  return len == 0 || std::fread(&r.ID[0], len, 1, File) == 1;
+}
+
+void compactRuns(SpillFiles& files) {
+  compact<RunRecord, RunOrder>(files);
+}
+
+void compactInodes(SpillFiles& files) {
+  compact<InodeRecord, InodeOrder>(files);
+}
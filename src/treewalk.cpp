@@ -0,0 +1,218 @@
+#include "treewalk.h"
+
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+bool ThreadBudget::take() {
+  unsigned int free = Free.load();
+  while (free > 0) {
+    if (Free.compare_exchange_weak(free, free - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SegmentBuf::take(std::string& data, std::unique_ptr<SpoolFile>& spool) {
+  data.clear();
+  data.swap(Data);
+  spool = std::move(Spool);
+}
+
+SegmentBuf::int_type SegmentBuf::overflow(int_type c) {
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    const char ch = traits_type::to_char_type(c);
+    xsputn(&ch, 1);
+  }
+  return traits_type::not_eof(c);
+}
+
+std::streamsize SegmentBuf::xsputn(const char* s, std::streamsize n) {
+  if (Spool) {
+    Spool->out().write(s, n);
+    return n;
+  }
+  Data.append(s, n);
+  if (Data.size() > Limit) {
+    try {
+      Spool.reset(new SpoolFile(Limit));
+    }
+    catch (std::runtime_error&) {
+      Limit = std::numeric_limits<size_t>::max(); // keep it in memory, then
+      return n;
+    }
+    Spool->out().write(Data.data(), Data.size());
+    std::string().swap(Data);
+  }
+  return n;
+}
+
+TreeWalk::TreeWalk(MetadataWriter& parent, TSK_FS_INFO* fs, ThreadBudget& budget):
+  Parent(parent), Fs(fs), Budget(budget), Idle(0), Pending(0), Finished(false)
+{}
+
+void TreeWalk::run() {
+  if (Parent.Avro) {
+    Parent.Avro->flush(); // segments are whole blocks, to follow ours
+  }
+  std::unique_lock<std::mutex> lock(Lock);
+  Task root;
+  root.Addr = Fs->root_inum;
+  root.Seen.push_back(Fs->root_inum);
+  root.Dirs = Parent.Dirs;
+  root.Seg = Segments.emplace(Segments.end());
+  root.Root = true;
+  Queue.push_back(std::move(root));
+  Pending = 1;
+  startWorker(Fs); // TSK's handle is free, since its thread is waiting on us
+
+  // write segments as they're done, in order
+  for (;;) {
+    Ready.wait(lock, [this]() { return (!Segments.empty() && Segments.front().Done) || Finished; });
+    SegmentItr end(Segments.begin());
+    while (end != Segments.end() && end->Done) {
+      ++end;
+    }
+    std::list<Segment> ready;
+    ready.splice(ready.end(), Segments, Segments.begin(), end);
+    const bool finished = Finished && Segments.empty();
+    lock.unlock();
+    write(ready);
+    if (finished) {
+      break;
+    }
+    lock.lock();
+  }
+
+  for (Worker& w: Workers) {
+    w.Thread.join();
+    if (w.Walker) {
+      Parent.mergeWalk(*w.Walker);
+    }
+    if (w.OwnsFs && w.Fs) {
+      Parent.closeFs(w.Fs);
+    }
+  }
+  Budget.give(Workers.size() - 1);
+  Parent.Dirs.swap(RootDirs);
+}
+
+void TreeWalk::startWorker(TSK_FS_INFO* fs) {
+  Workers.emplace_back();
+  Worker& w(Workers.back());
+  w.Fs = fs;
+  w.OwnsFs = !fs;
+  w.Thread = std::thread(&TreeWalk::work, this, std::ref(w));
+}
+
+void TreeWalk::work(Worker& w) {
+  if (!w.Fs) {
+    w.Fs = Parent.openFs(Fs->offset, Fs->ftype);
+    if (!w.Fs) {
+      tsk_error_reset(); // the others will take its tasks
+      return;
+    }
+  }
+  w.Walker.reset(Parent.newWorker(w.Out));
+  w.Walker->shareFs(Parent, w.Fs);
+  w.Walker->HandOff = [this, &w](TSK_INUM_T addr, const std::string& path, const std::vector<TSK_INUM_T>& seen) {
+    return handOff(w, addr, path, seen);
+  };
+
+  std::unique_lock<std::mutex> lock(Lock);
+  for (;;) {
+    ++Idle;
+    Work.wait(lock, [this]() { return !Queue.empty() || Finished; });
+    --Idle;
+    if (Queue.empty()) {
+      return;
+    }
+    Task t(std::move(Queue.front()));
+    Queue.pop_front();
+    w.Seg = t.Seg;
+    lock.unlock();
+
+    w.Walker->Dirs.swap(t.Dirs);
+    w.Walker->walkDirAt(t.Addr, t.Path, t.Seen);
+    if (t.Root) {
+      RootDirs = w.Walker->Dirs; // deeper dirs are popped before they matter
+      RootDirs.resize(Parent.Dirs.size());
+    }
+    finishSegment(w, w.Seg);
+
+    lock.lock();
+    if (--Pending == 0) {
+      Finished = true;
+      Work.notify_all();
+      Ready.notify_one();
+    }
+  }
+}
+
+bool TreeWalk::handOff(Worker& w, TSK_INUM_T addr, const std::string& path, const std::vector<TSK_INUM_T>& seen) {
+  if (Idle.load(std::memory_order_relaxed) == 0 && !Budget.available()) {
+    return false;
+  }
+  SegmentItr done;
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    const bool idle = Queue.size() < Idle;
+    if (!idle && !Budget.take()) {
+      return false;
+    }
+    Task t;
+    t.Addr = addr;
+    t.Path = path;
+    t.Seen = seen;
+    t.Seen.push_back(addr);
+    t.Dirs = w.Walker->Dirs;
+    t.Root = false;
+    // the subdirectory's output goes after ours so far, and the rest of ours after it
+    done = w.Seg;
+    t.Seg = Segments.emplace(std::next(done));
+    w.Seg = Segments.emplace(std::next(t.Seg));
+    Queue.push_back(std::move(t));
+    ++Pending;
+    if (idle) {
+      Work.notify_one();
+    }
+    else {
+      startWorker(nullptr);
+    }
+  }
+  finishSegment(w, done);
+  return true;
+}
+
+void TreeWalk::finishSegment(Worker& w, SegmentItr seg) {
+  // only w touches seg until it's done, so this needn't be locked
+  if (w.Walker->Avro) {
+    w.Walker->Avro->flush();
+  }
+  w.Buf.take(seg->Data, seg->Spool);
+  seg->Inodes.swap(w.Walker->ReverseMap);
+  seg->InodeSpills.swap(w.Walker->InodeSpills);
+  seg->SinkRows.swap(w.Walker->SinkRows);
+  w.Walker->InodeBytes = 0;
+
+  std::lock_guard<std::mutex> lock(Lock);
+  seg->Done = true;
+  if (seg == Segments.begin()) {
+    Ready.notify_one();
+  }
+}
+
+void TreeWalk::write(std::list<Segment>& ready) {
+  for (Segment& seg: ready) {
+    if (seg.Spool) {
+      seg.Spool->copyTo(Parent.Out);
+      seg.Spool.reset();
+    }
+    else {
+      Parent.Out.write(seg.Data.data(), seg.Data.size());
+    }
+    Parent.mergeInodes(seg.InodeSpills, seg.Inodes, seg.SinkRows);
+    Parent.limitMemory();
+  }
+}
@@ -1,11 +1,13 @@
 #include "util.h"
 
 #include <iostream>
-#include <ctime>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <iomanip>
 
 #include "enums.h"
+#include "hex.h"
 #include "jsonhelp.h"
 
 template<unsigned int N>
@@ -21,18 +23,6 @@ inline void writeBigEndian<1>(const uint64_t val, unsigned char* buf) {
   *buf = val & 0xff;
 }
 
-template<unsigned int N>
-inline void readBigEndian(const unsigned char* buf, uint64_t& val) {
-  constexpr unsigned int shift = (N - 1) * 8;
-  val |= (uint64_t)*buf << shift;
-  readBigEndian<N-1>(buf + 1, val);
-}
-
-template<>
-inline void readBigEndian<1>(const unsigned char* buf, uint64_t& val) {
-  val |= *buf;
-}
-
 unsigned int vintEncode(unsigned char* buf, uint64_t val) {
   if (val < 241) {
     buf[0] = val;
@@ -83,58 +73,6 @@ unsigned int vintEncode(unsigned char* buf, uint64_t val) {
   }
 }
 
-unsigned int vintDecode(uint64_t& val, const unsigned char* buf) {
-  if (buf == nullptr) {
-    return 0;
-  }
-  val = 0;
-  int diff = buf[0] - 241;
-  switch (diff) {
-    case 0:
-    case 1:
-    case 2:
-    case 3:
-    case 4:
-    case 5:
-    case 6:
-    case 7: // 241-248
-      val = 256*diff + buf[1] + 240;
-      return 2;
-      break;
-    case 8: // 249
-      val = 2288 + 256*buf[1] + buf[2];
-      return 3;
-      break;
-    case 9: // 250
-      readBigEndian<3>(&buf[1], val);
-      return 4;
-      break;
-    case 10:
-      readBigEndian<4>(&buf[1], val);
-      return 5;
-      break;
-    case 11:
-      readBigEndian<5>(&buf[1], val);
-      return 6;
-      break;
-    case 12:
-      readBigEndian<6>(&buf[1], val);
-      return 7;
-      break;
-    case 13:
-      readBigEndian<7>(&buf[1], val);
-      return 8;
-      break;
-    case 14:
-      readBigEndian<8>(&buf[1], val);
-      return 9;
-      break;
-    default:
-      val = buf[0];
-      return 1;
-  }
-}
-
 std::string appendVarint(const std::string& base, const unsigned int val) {
   unsigned char encoded[9];
   auto bytes = vintEncode(encoded, val);
@@ -160,71 +98,120 @@ std::string makeChildID(const unsigned char* parentID, unsigned int len, unsigne
   return ret;
 }
 
-std::string formatTimestamp(uint32_t unix, uint32_t ns) {
-  std::string ret;
-  time_t ts = unix;
-  tm* tmPtr = gmtime(&ts);
-  char tbuf[100];
-  size_t len = strftime(tbuf, 100, "%FT%T", tmPtr);
-  if (len) {
-    ret.append(tbuf);
-    if (ns) {
-      std::stringstream buf;
-      buf.setf(std::ios::fixed, std::ios::floatfield);
-      buf.precision(8);
-      buf << double(ns)/1000000000;
-      std::string frac = buf.str();
-      frac.erase(0, 1); // leading 0
-      std::string::iterator zeroItr(frac.end());
-      --zeroItr;
-      while (zeroItr != frac.begin() && *zeroItr == '0') {
-        --zeroItr;
+TimestampFormatter::TimestampFormatter():
+  LastSecond(0), HavePrefix(false) {}
+
+inline void write2Digits(char* buf, unsigned int val) {
+  buf[0] = '0' + val / 10;
+  buf[1] = '0' + val % 10;
+}
+
+void TimestampFormatter::formatPrefix(uint32_t unix) {
+  // days-to-civil conversion, from Howard Hinnant's date algorithms
+  const uint32_t days = unix / 86400,
+                 secs = unix % 86400;
+  const uint32_t z   = days + 719468,
+                 era = z / 146097,
+                 doe = z - era * 146097,
+                 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365,
+                 doy = doe - (365 * yoe + yoe / 4 - yoe / 100),
+                 mp  = (5 * doy + 2) / 153,
+                 day = doy - (153 * mp + 2) / 5 + 1,
+                 mon = mp < 10 ? mp + 3: mp - 9,
+                 yr  = yoe + era * 400 + (mon <= 2 ? 1: 0);
+
+  write2Digits(Prefix, yr / 100);
+  write2Digits(Prefix + 2, yr % 100);
+  Prefix[4] = '-';
+  write2Digits(Prefix + 5, mon);
+  Prefix[7] = '-';
+  write2Digits(Prefix + 8, day);
+  Prefix[10] = 'T';
+  write2Digits(Prefix + 11, secs / 3600);
+  Prefix[13] = ':';
+  write2Digits(Prefix + 14, (secs / 60) % 60);
+  Prefix[16] = ':';
+  write2Digits(Prefix + 17, secs % 60);
+
+  LastSecond = unix;
+  HavePrefix = true;
+}
+
+unsigned int TimestampFormatter::format(char* buf, uint32_t unix, uint32_t ns) {
+  if (!HavePrefix || unix != LastSecond) {
+    formatPrefix(unix);
+  }
+  std::memcpy(buf, Prefix, sizeof(Prefix));
+  unsigned int len = sizeof(Prefix);
+  if (ns) {
+    // The fraction used to be printed as a double with 8 places, so round to
+    // 8 digits the way printf would have. Only an exact 5 in the last place
+    // needs the double, to see which way the division rounded.
+    uint32_t frac = ns / 10;
+    const uint32_t last = ns % 10;
+    if (last > 5) {
+      ++frac;
+    }
+    else if (last == 5) {
+      const double err = std::fma(double(ns) / 1000000000, 1000000000, -double(ns));
+      if (err > 0 || (err == 0 && (frac & 1))) {
+        ++frac;
+      }
+    }
+    frac %= 100000000; // the integer part was dropped
+    buf[len++] = '.';
+    if (frac) { // an all-zero fraction was trimmed down to just the '.'
+      for (int i = 7; i >= 0; --i) {
+        buf[len + i] = '0' + frac % 10;
+        frac /= 10;
+      }
+      len += 8;
+      while (buf[len - 1] == '0') {
+        --len;
       }
-      ++zeroItr;
-      frac.erase(zeroItr, frac.end()); // kill trailing zeroes
-      ret.append(frac);
     }
-    ret.append("Z");
   }
-  return ret;
+  buf[len++] = 'Z';
+  return len;
+}
+
+std::string formatTimestamp(uint32_t unix, uint32_t ns) {
+  TimestampFormatter fmt;
+  char buf[TimestampFormatter::MAX_SIZE];
+  return std::string(buf, fmt.format(buf, unix, ns));
 }
 
 std::string bytesAsString(const unsigned char* idBeg, const unsigned char* idEnd) {
-  std::stringstream buf;
-  unsigned short val;
-  for (const unsigned char* cur = idBeg; cur < idEnd; ++cur) {
-    val = *cur;
-    buf.width(2);
-    buf.fill('0');
-    buf << std::hex;
-    buf << val;
-  }
-  return buf.str();
+  std::string ret(2 * (idEnd - idBeg), '\0');
+  hexEncode(&ret[0], idBeg, idEnd);
+  return ret;
+}
+
+void writeInodeID(char* buf, uint32_t volIndex, uint64_t inum) {
+  unsigned char bytes[INODE_ID_SIZE / 2];
+  bytes[0] = RecordTypes::INODE;
+  writeBigEndian<4>(volIndex, &bytes[1]);
+  writeBigEndian<8>(inum, &bytes[5]);
+  hexEncode(buf, bytes, bytes + sizeof(bytes));
+}
+
+void writeDiskMapID(char* buf, uint64_t offset) {
+  unsigned char bytes[DISK_MAP_ID_SIZE / 2];
+  bytes[0] = RecordTypes::DISK_MAP;
+  writeBigEndian<8>(offset, &bytes[1]);
+  hexEncode(buf, bytes, bytes + sizeof(bytes));
 }
 
 std::string makeInodeID(uint32_t volIndex, uint64_t inum) {
-  std::stringstream buf;
-  buf.width(2);
-  buf.fill('0');
-  buf << std::hex << RecordTypes::INODE;
-  buf.width(2 * sizeof(volIndex));
-  buf.fill('0');
-  buf << std::hex << volIndex;
-  buf.width(2 * sizeof(inum));
-  buf.fill('0');
-  buf << std::hex << inum;
-  return buf.str();
+  std::string ret(INODE_ID_SIZE, '\0');
+  writeInodeID(&ret[0], volIndex, inum);
+  return ret;
 }
 
 std::string makeDiskMapID(uint64_t offset) {
-  std::stringstream buf;
-  buf.width(2);
-  buf.fill('0');
-  buf << std::hex << RecordTypes::DISK_MAP;
-  buf.width(2 * sizeof(offset));
-  buf.fill('0');
-  buf << offset;
-  return buf.str();
+  std::string ret(DISK_MAP_ID_SIZE, '\0');
+  writeDiskMapID(&ret[0], offset);
+  return ret;
 }
 
 std::string j(const std::string& x) {
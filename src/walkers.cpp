@@ -1,22 +1,24 @@
 #include "walkers.h"
+#include "treewalk.h"
 
 #include "jsonhelp.h"
+#include "binrecord.h"
 #include "util.h"
 #include "enums.h"
+#include "hex.h"
+#include "parallelsort.h"
 
+#include <cstring>
 #include <sstream>
 #include <iomanip>
 #include <cmath>
 #include <utility>
 #include <algorithm>
+#include <iterator>
 
 #include <iostream>
 
-std::string j(const boost::icl::discrete_interval<uint64_t>& i) {
-  std::stringstream buf;
-  buf << "(" << i.lower() << ", " << i.upper() << ")";
-  return buf.str();
-}
+bool hasUsableMeta(const TSK_FS_FILE* file);
 
 template<typename ItType>
 void writeSequence(std::ostream& out, ItType begin, ItType end, const std::string& delimiter) {
@@ -34,31 +36,128 @@ void writeSequence(std::ostream& out, ItType begin, ItType end, const std::strin
 DirInfo::DirInfo():
   Path(""), BareID(""), Level(0), Count(0) {}
 
+namespace {
+  bool loadsMeta(TSK_INUM_T addr, TSK_FS_NAME_FLAG_ENUM flags) {
+    // whether tsk_fs_dir_get() loads the inode of a name
+    return addr || (flags & TSK_FS_NAME_FLAG_ALLOC);
+  }
+
+  void appendVint(std::string& buf, uint64_t val) {
+    unsigned char encoded[MAX_VINT_SIZE];
+    buf.append(reinterpret_cast<const char*>(encoded), vintEncode(encoded, val));
+  }
+
+  std::string binaryAsHex(const std::string& bin) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(bin.data());
+    return bytesAsString(p, p + bin.size());
+  }
+
+  struct TableSource {
+    const RunRecord* Cur;
+    const RunRecord* End;
+
+    bool empty() const { return Cur == End; }
+    const RunRecord& top() const { return *Cur; }
+    void pop() { ++Cur; }
+  };
+
+  // Runs come from src in order of volume and where they begin. The
+  // fragments are the spans between run boundaries, joined where their
+  // owners are the same, so that each fragment has a different set of
+  // owners from its neighbours.
+  template<class Source>
+  void sweepRuns(Source& runs, uint32_t vol, const MetadataWriter::FragmentFn& fn) {
+    while (!runs.empty() && MetadataWriter::ALL_VOLS != vol && runs.top().Vol < vol) {
+      runs.pop();
+    }
+    auto wanted = [&]() { return !runs.empty() && (MetadataWriter::ALL_VOLS == vol || runs.top().Vol == vol); };
+
+    std::multimap<uint64_t, MetadataWriter::AttrRunInfo> active; // by end
+    std::map<MetadataWriter::AttrRunInfo, unsigned int>  counts; // a run can overlap itself, as a hard link's does
+    MetadataWriter::AttrSet owners,
+                            pendOwners;
+    bool     pending = false;
+    uint32_t pendVol = 0,
+             curVol = 0;
+    uint64_t pendBeg = 0,
+             pendEnd = 0,
+             pos = 0;
+    while (wanted() || !active.empty()) {
+      if (active.empty()) {
+        curVol = runs.top().Vol;
+        pos = runs.top().Beg;
+      }
+      for (; wanted() && runs.top().Vol == curVol && runs.top().Beg == pos; runs.pop()) {
+        const RunRecord& r(runs.top());
+        const MetadataWriter::AttrRunInfo owner(r.Addr, r.AttrID, r.Slack, r.DrBeg, r.Offset);
+        active.emplace(r.End, owner);
+        if (1 == ++counts[owner]) {
+          owners.insert(owner);
+        }
+      }
+
+      uint64_t next = active.begin()->first;
+      if (wanted() && runs.top().Vol == curVol) {
+        next = std::min(next, runs.top().Beg);
+      }
+      if (pending && pendVol == curVol && pendEnd == pos && pendOwners == owners) {
+        pendEnd = next;
+      }
+      else {
+        if (pending) {
+          fn(pendVol, pendBeg, pendEnd, pendOwners);
+        }
+        pending = true;
+        pendVol = curVol;
+        pendBeg = pos;
+        pendEnd = next;
+        pendOwners = owners;
+      }
+      pos = next;
+
+      while (!active.empty() && active.begin()->first == pos) {
+        auto cnt = counts.find(active.begin()->second);
+        if (0 == --cnt->second) {
+          owners.erase(cnt->first);
+          counts.erase(cnt);
+        }
+        active.erase(active.begin());
+      }
+    }
+    if (pending) {
+      fn(pendVol, pendBeg, pendEnd, pendOwners);
+    }
+  }
+}
+
 DirInfo DirInfo::newChild(const std::string &path) {
-  uint32_t childLvl = childLevel();
   DirInfo  ret;
   ret.Path = path;
-  ret.BareID = appendVarint(BareID, Count - 1);
-//  ret.BareID = appendVarint(BareID, Count);
-  ret.Level = childLvl;
+  ret.BareID = BareID;
+  appendVint(ret.BareID, uint32_t(Count - 1));
+  ret.Level = childLevel();
   return ret;
 }
 
+void DirInfo::appendID(std::string& buf, uint32_t level, bool lastChild) const {
+  appendVint(buf, RecordTypes::FILE);
+  appendVint(buf, level);
+  buf += BareID;
+  if (lastChild && Count > 0) {
+    appendVint(buf, Count - 1);
+  }
+}
+
 std::string DirInfo::id() const {
-  std::string ret(appendVarint("", RecordTypes::FILE));
-  ret = appendVarint(ret, Level);
-  ret += BareID;
-  return ret;
+  std::string ret;
+  appendID(ret);
+  return binaryAsHex(ret);
 }
 
 std::string DirInfo::lastChild() const {
-  std::string ret(appendVarint("", RecordTypes::FILE));
-  ret = appendVarint(ret, childLevel());
-  ret += BareID;
-  if (Count > 0) {
-    ret = appendVarint(ret, Count - 1);
-  }
-  return ret;
+  std::string ret;
+  appendLastChild(ret);
+  return binaryAsHex(ret);
 }
 
 uint32_t DirInfo::childLevel() const {
@@ -172,7 +271,7 @@ uint8_t ImageInfo::start() {
   Out << "{";
 
   Out << j(std::string("files")) << ":[";
-  writeSequence(std::cout, img->files().begin(), img->files().end(), ", ");
+  writeSequence(Out, img->files().begin(), img->files().end(), ", ");
   Out << "]"
       << j("description", img->desc())
       << j("size", img->size())
@@ -211,16 +310,16 @@ uint8_t ImageInfo::start() {
 
 uint8_t ImageDumper::start() {
   ssize_t rlen;
-  char buf[4096];
+  std::vector<char> buf(1024 * 1024); // fewer, larger reads and writes
   TSK_OFF_T off = 0;
 
   while (off < m_img_info->size) {
-    rlen = tsk_img_read(m_img_info, off, buf, sizeof(buf));
+    rlen = tsk_img_read(m_img_info, off, buf.data(), buf.size());
     if (rlen == -1) {
       return -1;
     }
     off += rlen;
-    Out.write(buf, rlen);
+    Out.write(buf.data(), rlen);
     if (!Out.good()) {
       return -1;
     }
@@ -253,8 +352,9 @@ ssize_t physicalSize(const TSK_FS_FILE* file) {
 }
 
 MetadataWriter::MetadataWriter(std::ostream& out):
-  FileCounter(out), Fs(0), NumUnallocated(0), DiskSize(0), MaxUnallocatedBlockSize(std::numeric_limits<uint64_t>::max()),
-  DataWritten(0), SectorSize(0), NumVols(0), InUnallocated(false), UCMode(NONE)
+  FileCounter(out), Part(0), Fs(0), NumUnallocated(0), DiskSize(0), MaxUnallocatedBlockSize(std::numeric_limits<uint64_t>::max()),
+  DataWritten(0), SectorSize(0), NumVols(0), BuildDiskMap(true), BuildInodeMap(true), UCMode(NONE), UCSource(RUNS), Format(JSON), RecordFields(Fields::ALL), Threads(1), ScanOrder(DIRECTORY),
+  CheckpointEvery(0), NextCheckpoint(std::numeric_limits<uint64_t>::max()), OutputOffset(0), Resuming(false), MaxMemory(0), RunBytes(0), InodeBytes(0), StreamInodes(false), FsVolIndex(0)
 {
   DummyFile.name = &DummyName;
   DummyFile.meta = &DummyMeta;
@@ -263,6 +363,8 @@ MetadataWriter::MetadataWriter(std::ostream& out):
   DummyName.flags = TSK_FS_NAME_FLAG_UNALLOC;
   DummyName.meta_addr = 0;
   DummyName.meta_seq = 0;
+  DummyName.par_addr = 0;
+  DummyName.par_seq = 0;
   DummyName.type = TSK_FS_NAME_TYPE_VIRT;
 
   DummyAttrRun.flags = TSK_FS_ATTR_RUN_FLAG_NONE;
@@ -314,13 +416,63 @@ MetadataWriter::MetadataWriter(std::ostream& out):
   Dirs.emplace_back(DirInfo());
 }
 
+MetadataWriter::MetadataWriter(std::ostream& out, const MetadataWriter& parent):
+  MetadataWriter(out)
+{
+  openImageHandle(parent.m_img_info); // TSK locks the image's cache, so it can be shared
+  m_fileFilterFlags = parent.m_fileFilterFlags;
+  DiskSize = parent.DiskSize;
+  SectorSize = parent.SectorSize;
+  NumVols = parent.NumVols;
+  MaxUnallocatedBlockSize = parent.MaxUnallocatedBlockSize;
+  BuildDiskMap = parent.BuildDiskMap;
+  BuildInodeMap = parent.BuildInodeMap;
+  StreamInodes = parent.StreamInodes;
+  UCMode = parent.UCMode;
+  UCSource = parent.UCSource;
+  Format = parent.Format;
+  RecordFields = parent.RecordFields;
+  Filter = parent.Filter;
+  Budget = parent.Budget;
+  ScanOrder = parent.ScanOrder;
+  IndexFile = parent.IndexFile;
+  Since = parent.Since;
+  // Only the top walker has Threads > 1, and its limit is split evenly among
+  // all the walkers below it that can be at once: Threads volume walkers,
+  // each with its tree walk's first worker, and Threads - 1 more workers from
+  // the budget. Their children keep the same share.
+  MaxMemory = parent.Threads > 1 && parent.MaxMemory ? std::max(parent.MaxMemory / (3 * parent.Threads - 1), uint64_t(1)): parent.MaxMemory;
+  Dirs.front() = parent.Dirs.front();
+  if (AVRO == Format) {
+    Avro.reset(new AvroContainer(out, *parent.Avro));
+  }
+}
+
+void MetadataWriter::setThreads(const unsigned int threads) {
+  Threads = threads;
+  if (Threads > 1) {
+    Budget = std::make_shared<ThreadBudget>(Threads - 1); // a tree walk's first thread is its own
+  }
+}
+
 uint8_t MetadataWriter::start() {
   DiskSize = m_img_info->size;
   SectorSize = m_img_info->sector_size;
   NumVols = 0;
   // set PartBeg and PartEnd in case there isn't a partition scheme
   resetPartitionRange();
-  return LbtTskAuto::start();
+  uint8_t ret = LbtTskAuto::start();
+  finishVolumeWalks(0);
+  if (!ChildErrors.empty()) {
+    ret = 1; // as a serial walk, registering them itself, would have
+  }
+  if (Since) {
+    writeTombstones();
+  }
+  if (!IndexFile.empty() && !InodeIndex::write(IndexFile, IndexEntries)) {
+    std::cerr << "Error: could not write index to " << IndexFile << std::endl;
+  }
+  return ret;
 }
 
 std::string getPartName(const TSK_VS_PART_INFO* vs_part) {
@@ -338,6 +490,10 @@ std::string getPartName(const TSK_VS_PART_INFO* vs_part) {
 }
 
 TSK_FILTER_ENUM MetadataWriter::filterVol(const TSK_VS_PART_INFO* vs_part) {
+  if (Threads > 1) {
+    startVolumeWalk(vs_part);
+    return TSK_FILTER_CONT;
+  }
   VolName.clear();
   Part = vs_part;
 
@@ -348,52 +504,52 @@ TSK_FILTER_ENUM MetadataWriter::filterVol(const TSK_VS_PART_INFO* vs_part) {
 
   Dirs.resize(1);
   ++NumVols;
-  if (!InUnallocated) {
-    TSK_FS_INFO fs; // we'll make image & volume system look like an fs, sort of
-                    // fs.partName will be empty, since we're not _in_ a partition
-    const TSK_VS_INFO* vs = vs_part->vs;
-    fs.block_count = (vs->img_info->size / vs->img_info->sector_size);
-    fs.block_post_size = fs.block_pre_size = 0;
-    fs.block_size = fs.dev_bsize = vs->img_info->sector_size;
-    fs.duname = "sector";
-    fs.endian = vs->endian;
-    fs.first_block = 0;
-    fs.first_inum = 1;
-    fs.flags = TSK_FS_INFO_FLAG_NONE;
-    fs.fs_id_used = 0;
-    fs.ftype = TSK_FS_TYPE_UNSUPP;
-    fs.img_info = vs->img_info;
-    fs.inum_count = vs->part_count;
-    fs.journ_inum = 0;
-    fs.last_block = fs.last_block_act = fs.block_count - 1;
-    fs.last_inum = vs->part_count;
-    fs.list_inum_named = 0;
-    fs.offset = 0;
-    fs.orphan_dir = 0;
-    fs.root_inum = 1;
-    uint32_t numVols = NumVols;
-    NumVols = 0; // because NumVols is used as the FS index
-    resetPartitionRange(); // since we're talking about the dummy root FS
-    setFsInfo(&fs, fs.first_block, fs.first_block + fs.block_count);
-    NumVols = numVols;
-
-    DummyFile.fs_info = &fs;
-
-    DummyAttrRun.addr = vs_part->start;
-    DummyAttrRun.len = vs_part->len;
-    DummyAttrRun.offset = 0;
-    DummyMeta.size = DummyAttr.size = DummyAttr.nrd.initsize = DummyAttr.nrd.allocsize = DummyAttrRun.len * fs.block_size;
-    
-    DummyName.meta_addr = DummyMeta.addr = NumVols;
-
-    // std::cerr << "name = " << name << std::endl;
-    DummyName.name = DummyName.shrt_name = const_cast<char*>(partName.c_str());
-    DummyName.name_size = DummyName.shrt_name_size = partName.size();
+  TSK_FS_INFO fs; // we'll make image & volume system look like an fs, sort of
+                  // fs.partName will be empty, since we're not _in_ a partition
+  const TSK_VS_INFO* vs = vs_part->vs;
+  fs.block_count = (vs->img_info->size / vs->img_info->sector_size);
+  fs.block_post_size = fs.block_pre_size = 0;
+  fs.block_size = fs.dev_bsize = vs->img_info->sector_size;
+  fs.duname = "sector";
+  fs.endian = vs->endian;
+  fs.first_block = 0;
+  fs.first_inum = 1;
+  fs.flags = TSK_FS_INFO_FLAG_NONE;
+  fs.fs_id_used = 0;
+  fs.ftype = TSK_FS_TYPE_UNSUPP;
+  fs.img_info = vs->img_info;
+  fs.inum_count = vs->part_count;
+  fs.journ_inum = 0;
+  fs.last_block = fs.last_block_act = fs.block_count - 1;
+  fs.last_inum = vs->part_count;
+  fs.list_inum_named = 0;
+  fs.offset = 0;
+  fs.orphan_dir = 0;
+  fs.root_inum = 1;
+  uint32_t numVols = NumVols;
+  NumVols = 0; // because NumVols is used as the FS index
+  resetPartitionRange(); // since we're talking about the dummy root FS
+  setFsInfo(&fs, fs.first_block, fs.first_block + fs.block_count);
+  NumVols = numVols;
+
+  DummyFile.fs_info = &fs;
+
+  DummyAttrRun.addr = vs_part->start;
+  DummyAttrRun.len = vs_part->len;
+  DummyAttrRun.offset = 0;
+  DummyMeta.size = DummyAttr.size = DummyAttr.nrd.initsize = DummyAttr.nrd.allocsize = DummyAttrRun.len * fs.block_size;
+  
+  DummyName.meta_addr = DummyMeta.addr = NumVols;
+  DummyName.par_addr = 0; // the previous volume's unallocated entries may have changed these
+  DummyName.flags = TSK_FS_NAME_FLAG_UNALLOC;
+
+  // std::cerr << "name = " << name << std::endl;
+  DummyName.name = DummyName.shrt_name = const_cast<char*>(partName.c_str());
+  DummyName.name_size = DummyName.shrt_name_size = partName.size();
 
 //    std::cerr << "processing " << CurDir << name << std::endl;
-    processFile(&DummyFile, "");
+  processFile(&DummyFile, "");
 //    std::cerr << "done processing" << std::endl;
-  }
   setPartitionRange(std::min(vs_part->start * SectorSize, DiskSize),
                     std::min((vs_part->start * vs_part->len) * SectorSize, DiskSize));
   VolName = partName;
@@ -402,26 +558,565 @@ TSK_FILTER_ENUM MetadataWriter::filterVol(const TSK_VS_PART_INFO* vs_part) {
 }
 
 TSK_FILTER_ENUM MetadataWriter::filterFs(TSK_FS_INFO *fs) {
-  using namespace boost::icl;
+  if (Threads > 1 && Part) {
+    // the volume's walker opens its own handle, since a TSK_FS_INFO can't be shared between threads
+    MetadataWriter* walker = VolumeWalks.back()->Walker.get();
+    const TSK_OFF_T offset = fs->offset;
+    const TSK_FS_TYPE_ENUM type = fs->ftype;
+    VolumeWalks.back()->Done = std::async(std::launch::async, [walker, offset, type]() { walker->walkVolumeFs(offset, type); });
+    return TSK_FILTER_SKIP;
+  }
   setFsInfo(fs, Part ? Part->start: 0, Part ? Part->start + Part->len: m_img_info->size / m_img_info->sector_size);
+  if (resumeSkips("")) {
+    return TSK_FILTER_SKIP; // all written before the checkpoint
+  }
 
-  if (InUnallocated) {
-    for (unsigned i = 0; i < NumRootEntries[NumVols]; ++i) {
-      Dirs.back().incCount();
+  // The unallocated space is written right after the fs's entries, once
+  // its runs are all known, so the fs is walked here rather than by TSK.
+  if (INODE == ScanOrder) {
+    if (scanInodes(fs)) {
+      flushUnallocated();
+      return TSK_FILTER_SKIP;
     }
+    // let TSK's walk report the error
+  }
+  else if (Budget) {
+    TreeWalk(*this, fs, *Budget).run();
     flushUnallocated();
     return TSK_FILTER_SKIP;
   }
+  else if (canPrune() || NONE != UCMode || Resuming) {
+    // if nothing needs the runs of what the glob rules out, walkDir()
+    // skips the directories where nothing can match, and likewise those
+    // that were written before the checkpoint being resumed
+    TSK_FS_DIR* root = tsk_fs_dir_open_meta(fs, fs->root_inum);
+    if (root) {
+      std::string path;
+      std::vector<TSK_INUM_T> seen{fs->root_inum};
+      walkDir(root, path, seen);
+      flushUnallocated();
+      return TSK_FILTER_SKIP;
+    }
+    // let TSK's walk report the error
+  }
+  // TSK walks the fs. Usually there's no --unallocated to write, since with
+  // it walkDir() would have; if the root couldn't be opened, there is, but
+  // TSK's walk will find nothing to mark as allocated.
+  flushUnallocated();
+  return TSK_FILTER_CONT;
+}
+
+bool MetadataWriter::canPrune() const {
+  return Filter.prunesPaths() && !needRuns() && !Since; // --since must see every inode, or it would write tombstones for them
+}
+
+bool MetadataWriter::entersDir(TSK_FS_FILE* file) {
+  return (m_fileFilterFlags & TSK_FS_DIR_WALK_FLAG_RECURSE) && file->meta && isDir(file) && !isDotDir(file) &&
+    // reallocated dirs have someone else's contents
+    !((file->name->flags & TSK_FS_NAME_FLAG_UNALLOC) && (file->meta->flags & TSK_FS_META_FLAG_ALLOC));
+}
+
+bool MetadataWriter::entersDir(const TSK_FS_NAME* n, TSK_FS_META* m) {
+  // the file as tsk_fs_dir_get() would give it
+  TSK_FS_FILE file;
+  std::memset(&file, 0, sizeof(file));
+  file.fs_info = Fs;
+  file.name = const_cast<TSK_FS_NAME*>(n);
+  file.meta = loadsMeta(n->meta_addr, n->flags) && m && m->seq == n->meta_seq ? m: nullptr;
+  return entersDir(&file);
+}
+
+void MetadataWriter::walkDir(TSK_FS_DIR* dir, std::string& path, std::vector<TSK_INUM_T>& seen) {
+  // visits entries in the same order as tsk_fs_dir_walk(), so IDs come out the same
+  const size_t num = tsk_fs_dir_getsize(dir);
+  for (size_t i = 0; i < num; ++i) {
+    TSK_FS_FILE* file = tsk_fs_dir_get(dir, i);
+    if (!file) {
+      continue;
+    }
+    walkFile(file, path, seen);
+    tsk_fs_file_close(file);
+  }
+  tsk_fs_dir_close(dir);
+}
+
+void MetadataWriter::walkFile(TSK_FS_FILE* file, std::string& path, std::vector<TSK_INUM_T>& seen) {
+  if (!(file->name->flags & m_fileFilterFlags)) {
+    return;
+  }
+  processFile(file, path.c_str());
+
+  if (entersDir(file) && std::find(seen.begin(), seen.end(), file->meta->addr) == seen.end()) {
+    const size_t pathLen = path.size();
+    path += file->name->name;
+    path += '/';
+    if ((!canPrune() || Filter.mayMatchBelow(path)) && !resumeSkips(path) && !(HandOff && HandOff(file->meta->addr, path, seen))) {
+      seen.push_back(file->meta->addr);
+      walkDirAt(file->meta->addr, path, seen);
+      seen.pop_back();
+    }
+    path.resize(pathLen);
+  }
+}
+
+void MetadataWriter::walkDirAt(TSK_INUM_T addr, std::string& path, std::vector<TSK_INUM_T>& seen) {
+  TSK_FS_DIR* dir = tsk_fs_dir_open_meta(Fs, addr);
+  if (dir) {
+    walkDir(dir, path, seen);
+  }
   else {
-    return TSK_FILTER_CONT;
+    tsk_error_reset(); // as TSK does, carry on without it
   }
 }
 
-void MetadataWriter::startUnallocated() {
-  if (NONE != UCMode) {
-    InUnallocated = true;
-    start();
+TSK_FS_INFO* MetadataWriter::openFs(TSK_OFF_T offset, TSK_FS_TYPE_ENUM type) const {
+  return tsk_fs_open_img(m_img_info, offset, type);
+}
+
+void MetadataWriter::closeFs(TSK_FS_INFO* fs) const {
+  tsk_fs_close(fs);
+}
+
+bool MetadataWriter::scanInodes(TSK_FS_INFO* fs) {
+  NameList names;
+  names.Walker = this;
+  std::string path;
+  std::vector<TSK_INUM_T> seen{fs->root_inum};
+  if (!walkNamesAt(fs->root_inum, nullptr, path, seen, names)) {
+    return false;
   }
+
+  // the names TSK wouldn't load an inode for go first, and aren't joined
+  std::stable_sort(names.Edges.begin(), names.Edges.end(),
+    [](const NameEdge& a, const NameEdge& b) {
+      return std::make_pair(loadsMeta(a.Addr, a.Flags), a.Addr) < std::make_pair(loadsMeta(b.Addr, b.Flags), b.Addr);
+    });
+  names.Next = 0;
+
+  const std::vector<DirInfo> walked(Dirs);
+  Dirs.resize(1); // back() is set to each entry's place in the walk
+
+  TSK_FS_FILE noMeta; // as TSK gives a name whose inode it doesn't or can't load
+  std::memset(&noMeta, 0, sizeof(noMeta));
+  noMeta.fs_info = fs;
+  while (names.Next < names.Edges.size() && !loadsMeta(names.Edges[names.Next].Addr, names.Edges[names.Next].Flags)) {
+    writeJoined(&noMeta, names.Edges[names.Next++], names);
+  }
+
+  if (names.Next < names.Edges.size()) {
+    const TSK_INUM_T first = std::max(names.Edges[names.Next].Addr, fs->first_inum),
+                     last = std::min(names.Edges.back().Addr, fs->last_inum);
+    if (first <= last && !walkInodes(fs, first, last, names)) {
+      tsk_error_reset(); // whatever it didn't get to is loaded below
+    }
+  }
+  // names whose inodes the walk didn't give us, e.g., out of its range, get them one at a time
+  for (size_t i = names.Next; i < names.Edges.size(); ++i) {
+    names.Missed.push_back(i);
+  }
+  for (size_t i: names.Missed) {
+    const NameEdge& edge(names.Edges[i]);
+    TSK_FS_FILE* file = tsk_fs_file_open_meta(fs, nullptr, edge.Addr);
+    if (file) {
+      writeJoined(file, edge, names);
+      tsk_fs_file_close(file);
+    }
+    else {
+      tsk_error_reset();
+      writeJoined(&noMeta, edge, names);
+    }
+  }
+  Dirs = walked;
+  return true;
+}
+
+void MetadataWriter::walkNames(TSK_FS_DIR* dir, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names) {
+  // as walkDir(), but inodes are loaded only for directories
+  const size_t num = tsk_fs_dir_getsize(dir);
+  uint32_t dirIndex = NO_DIR;
+  for (size_t i = 0; i < num; ++i) {
+    const TSK_FS_NAME* n = tsk_fs_dir_get_name(dir, i);
+    if (n) {
+      walkName(n, path, seen, names, dirIndex);
+    }
+  }
+  tsk_fs_dir_close(dir);
+}
+
+void MetadataWriter::walkName(const TSK_FS_NAME* n, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names, uint32_t& dirIndex) {
+  if (!(n->flags & m_fileFilterFlags)) {
+    return;
+  }
+  setCurDir(path.c_str());
+  if (NO_DIR == dirIndex) {
+    dirIndex = names.Dirs.size();
+    names.Dirs.push_back(Dirs.back());
+  }
+
+  NameEdge edge;
+  edge.Addr = n->meta_addr;
+  edge.ParAddr = n->par_addr;
+  edge.Name = names.Strings.size();
+  edge.NameSize = n->name_size;
+  edge.ShrtNameSize = n->shrt_name_size;
+  edge.MetaSeq = n->meta_seq;
+  edge.ParSeq = n->par_seq;
+  edge.Dir = dirIndex;
+  edge.Count = Dirs.back().count();
+  edge.Type = n->type;
+  edge.Flags = n->flags;
+  names.Strings.append(n->name ? n->name: "");
+  names.Strings.push_back('\0');
+  names.Strings.append(n->shrt_name ? n->shrt_name: "");
+  names.Strings.push_back('\0');
+  names.Edges.push_back(edge);
+
+  // isDir() is only true of these types, so the others' inodes needn't be loaded
+  const bool dirType = n->type == TSK_FS_NAME_TYPE_DIR || n->type == TSK_FS_NAME_TYPE_UNDEF,
+             dotDir = n->name && (!std::strcmp(n->name, ".") || !std::strcmp(n->name, ".."));
+  if ((m_fileFilterFlags & TSK_FS_DIR_WALK_FLAG_RECURSE) && dirType && !dotDir && loadsMeta(n->meta_addr, n->flags) &&
+      std::find(seen.begin(), seen.end(), n->meta_addr) == seen.end())
+  {
+    const size_t pathLen = path.size();
+    path += n->name;
+    path += '/';
+    if (!canPrune() || Filter.mayMatchBelow(path)) {
+      seen.push_back(n->meta_addr);
+      if (!walkNamesAt(n->meta_addr, n, path, seen, names)) {
+        tsk_error_reset(); // as TSK does, carry on without it
+      }
+      seen.pop_back();
+    }
+    path.resize(pathLen);
+  }
+}
+
+bool MetadataWriter::walkNamesAt(TSK_INUM_T addr, const TSK_FS_NAME* n, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names) {
+  TSK_FS_DIR* dir = tsk_fs_dir_open_meta(Fs, addr);
+  if (!dir) {
+    return false;
+  }
+  // the same test as walkDir(), with the inode we had to load anyway
+  if (n && !entersDir(n, dir->fs_file ? dir->fs_file->meta: nullptr)) {
+    tsk_fs_dir_close(dir);
+    return true;
+  }
+  walkNames(dir, path, seen, names);
+  return true;
+}
+
+bool MetadataWriter::walkInodes(TSK_FS_INFO* fs, TSK_INUM_T first, TSK_INUM_T last, NameList& names) {
+  return !tsk_fs_meta_walk(fs, first, last,
+    (TSK_FS_META_FLAG_ENUM)(TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC | TSK_FS_META_FLAG_USED | TSK_FS_META_FLAG_UNUSED),
+    joinInode, &names);
+}
+
+TSK_WALK_RET_ENUM MetadataWriter::joinInode(TSK_FS_FILE* file, void* ptr) {
+  NameList& names(*static_cast<NameList*>(ptr));
+  const TSK_INUM_T addr = file->meta->addr;
+  while (names.Next < names.Edges.size() && names.Edges[names.Next].Addr < addr) {
+    names.Missed.push_back(names.Next++);
+  }
+  while (names.Next < names.Edges.size() && names.Edges[names.Next].Addr == addr) {
+    names.Walker->writeJoined(file, names.Edges[names.Next++], names);
+  }
+  return names.Next < names.Edges.size() ? TSK_WALK_CONT: TSK_WALK_STOP;
+}
+
+void MetadataWriter::writeJoined(TSK_FS_FILE* file, const NameEdge& edge, NameList& names) {
+  TSK_FS_NAME name;
+  std::memset(&name, 0, sizeof(name));
+  name.name = &names.Strings[edge.Name];
+  name.name_size = edge.NameSize;
+  name.shrt_name = name.name + std::strlen(name.name) + 1;
+  name.shrt_name_size = edge.ShrtNameSize;
+  name.meta_addr = edge.Addr;
+  name.meta_seq = edge.MetaSeq;
+  name.par_addr = edge.ParAddr;
+  name.par_seq = edge.ParSeq;
+  name.type = edge.Type;
+  name.flags = edge.Flags;
+
+  Dirs.back() = names.Dirs[edge.Dir];
+  Dirs.back().setCount(edge.Count);
+
+  TSK_FS_NAME* none = file->name; // the meta walk gives no name
+  TSK_FS_META* meta = file->meta;
+  file->name = &name;
+  if (meta && meta->seq != edge.MetaSeq) {
+    file->meta = nullptr; // as tsk_fs_dir_get() gives it, since the inode's been reused
+  }
+  writeEntry(file, Dirs.back().path().c_str() + (VolName.empty() ? 0: VolName.size() + 1));
+  file->name = none;
+  file->meta = meta;
+}
+
+void MetadataWriter::startVolumeWalk(const TSK_VS_PART_INFO* vs_part) {
+  finishVolumeWalks(Threads - 1);
+
+  VolumeWalks.emplace_back(new VolumeWalk);
+  VolumeWalk& vw(*VolumeWalks.back());
+  if (VolumeWalks.size() == 1) {
+    if (Avro) {
+      Avro->flush(); // the walker's blocks follow ours
+    }
+    vw.Walker.reset(new MetadataWriter(Out, *this));
+  }
+  else {
+    vw.Spool.reset(new SpoolFile);
+    vw.Walker.reset(new MetadataWriter(vw.Spool->out(), *this));
+  }
+  vw.Part = *vs_part;
+  vw.Walker->filterVol(&vw.Part); // writes the volume's record, while vs_part's pointers are still good
+
+  // keep in step, as though we'd walked it ourselves
+  Part = vs_part;
+  NumVols = vw.Walker->NumVols;
+  Dirs = vw.Walker->Dirs;
+}
+
+void MetadataWriter::walkVolumeFs(TSK_OFF_T offset, TSK_FS_TYPE_ENUM type) {
+  TSK_FS_INFO* fs = openFs(offset, type);
+  if (fs) {
+    findFilesInFs(fs);
+    closeFs(fs);
+  }
+}
+
+void MetadataWriter::finishVolumeWalks(size_t maxPending) {
+  while (VolumeWalks.size() > maxPending) {
+    VolumeWalk& vw(*VolumeWalks.front());
+    if (vw.Done.valid()) {
+      vw.Done.get();
+    }
+    vw.Walker->finishWalk();
+    if (vw.Spool) {
+      if (Avro) {
+        Avro->flush(); // the walker's blocks follow ours
+      }
+      vw.Spool->copyTo(Out);
+    }
+    mergeWalk(*vw.Walker);
+    VolumeWalks.pop_front();
+  }
+}
+
+void MetadataWriter::mergeWalk(MetadataWriter& walker) {
+  NumFiles += walker.NumFiles;
+  DataWritten += walker.DataWritten;
+  for (auto& fsRuns: walker.AllocatedRuns) {
+    auto itr = AllocatedRuns.find(fsRuns.first);
+    if (itr == AllocatedRuns.end()) {
+      AllocatedRuns.insert(std::move(fsRuns));
+    }
+    else {
+      RunTable& runs(std::get<3>(itr->second)); // the dummy root fs has every walker's volume
+      runs.insert(runs.end(), std::get<3>(fsRuns.second).begin(), std::get<3>(fsRuns.second).end());
+    }
+  }
+  RunBytes += walker.RunBytes;
+  std::move(walker.RunSpills.begin(), walker.RunSpills.end(), std::back_inserter(RunSpills)); // order doesn't matter for runs
+  walker.RunSpills.clear();
+  compactRuns(RunSpills);
+  mergeInodes(walker.InodeSpills, walker.ReverseMap, walker.SinkRows);
+  IndexEntries.insert(IndexEntries.end(), walker.IndexEntries.begin(), walker.IndexEntries.end());
+  const std::vector<error_record> errs(walker.errors());
+  ChildErrors.insert(ChildErrors.end(), errs.begin(), errs.end());
+  limitMemory();
+}
+
+void MetadataWriter::mapInode(const TSK_FS_FILE* file) {
+  const TSK_FS_META* m = file->meta;
+  InodeRecord r{NumVols, m->addr, RecordID};
+  if (StreamInodes && m->nlink <= 1 && (m->flags & TSK_FS_META_FLAG_ALLOC) && m->type != TSK_FS_META_TYPE_DIR &&
+      (!file->name || (file->name->flags & TSK_FS_NAME_FLAG_ALLOC)))
+  {
+    // no other name can turn up for it, so its row is done
+    SinkRows.push_back(std::move(r));
+    if (InodeSink) {
+      sinkInodes(SinkRows);
+    }
+    return;
+  }
+  ReverseMap[NumVols].push_back(std::move(r));
+  InodeBytes += sizeof(InodeRecord);
+}
+
+void MetadataWriter::sinkInodes(std::vector<InodeRecord>& rows) {
+  for (InodeRecord& r: rows) {
+    Sunk[r.Vol].push_back(r.Addr);
+    SinkIDs.resize(1);
+    SinkIDs[0].swap(r.ID);
+    InodeSink(r.Vol, r.Addr, SinkIDs);
+  }
+  rows.clear();
+}
+
+void MetadataWriter::mergeInodes(SpillFiles& spills, ReverseInodeMapType& inodes, std::vector<InodeRecord>& rows) {
+  if (InodeSink) {
+    sinkInodes(rows);
+  }
+  else {
+    std::move(rows.begin(), rows.end(), std::back_inserter(SinkRows));
+    rows.clear();
+  }
+
+  if (!spills.empty()) {
+    spillInodes(); // ours come first
+    std::move(spills.begin(), spills.end(), std::back_inserter(InodeSpills));
+    spills.clear();
+    compactInodes(InodeSpills);
+  }
+  for (auto& fsInodes: inodes) {
+    InodeTable& to(ReverseMap[fsInodes.first]);
+    std::move(fsInodes.second.begin(), fsInodes.second.end(), std::back_inserter(to));
+    InodeBytes += sizeof(InodeRecord) * fsInodes.second.size();
+  }
+  inodes.clear();
+}
+
+void MetadataWriter::limitMemory() {
+  if (MaxMemory && RunBytes + InodeBytes > MaxMemory) {
+    spillRuns();
+    spillInodes();
+  }
+}
+
+void MetadataWriter::spillRuns() {
+  if (!RunBytes) {
+    return;
+  }
+  std::unique_ptr<SpillFile> spill(new SpillFile);
+  for (auto& fsRuns: AllocatedRuns) {
+    RunTable& runs(std::get<3>(fsRuns.second));
+    sortRuns(runs);
+    for (const RunRecord& r: runs) {
+      spill->write(r);
+    }
+    RunTable().swap(runs); // to free it, but keep the entry, as CurAllocatedItr may point to it
+  }
+  RunSpills.push_back(std::move(spill));
+  compactRuns(RunSpills);
+  RunBytes = 0;
+}
+
+void MetadataWriter::spillInodes() {
+  if (ReverseMap.empty()) {
+    return;
+  }
+  std::unique_ptr<SpillFile> spill(new SpillFile);
+  for (auto& fsInodes: ReverseMap) {
+    sortInodes(fsInodes.second);
+    for (const InodeRecord& r: fsInodes.second) {
+      spill->write(r);
+    }
+  }
+  InodeSpills.push_back(std::move(spill));
+  compactInodes(InodeSpills);
+  ReverseMap.clear();
+  InodeBytes = 0;
+}
+
+void MetadataWriter::sortRuns(RunTable& runs) const {
+  parallelSort(runs.begin(), runs.end(), RunOrder(), Threads);
+}
+
+void MetadataWriter::sortInodes(InodeTable& inodes) const {
+  std::stable_sort(inodes.begin(), inodes.end(), InodeOrder()); // an inode's IDs stay in walk order
+}
+
+void MetadataWriter::forEachFragment(const FragmentFn& fn, uint32_t vol) {
+  if (!RunSpills.empty()) {
+    spillRuns(); // so that it's all in one place
+    SpillFiles spills;
+    spills.swap(RunSpills); // fn may spill more, which mustn't touch these
+    SpillMerge<RunRecord, RunOrder> runs(spills, 0, spills.size());
+    sweepRuns(runs, vol, fn);
+    std::move(RunSpills.begin(), RunSpills.end(), std::back_inserter(spills));
+    RunSpills.swap(spills);
+    return;
+  }
+  for (auto& fsRuns: AllocatedRuns) {
+    if (ALL_VOLS == vol || fsRuns.first == vol) {
+      RunTable runs;
+      runs.swap(std::get<3>(fsRuns.second)); // fn may add more, which mustn't move these
+      sortRuns(runs);
+      TableSource src{runs.data(), runs.data() + runs.size()};
+      sweepRuns(src, vol, fn);
+      RunTable& added(std::get<3>(fsRuns.second));
+      runs.insert(runs.end(), added.begin(), added.end());
+      added.swap(runs);
+    }
+  }
+}
+
+void MetadataWriter::forEachInode(const InodeFn& fn, uint32_t vol) {
+  for (auto& addrs: Sunk) {
+    if (ALL_VOLS == vol || addrs.first == vol) {
+      std::sort(addrs.second.begin(), addrs.second.end()); // for sunk()
+    }
+  }
+
+  std::vector<std::string> ids;
+  if (InodeSpills.empty()) {
+    for (auto& fsInodes: ReverseMap) {
+      if (ALL_VOLS == vol || fsInodes.first == vol) {
+        InodeTable& inodes(fsInodes.second);
+        sortInodes(inodes);
+        for (auto r = inodes.begin(); r != inodes.end(); ) {
+          const uint64_t addr = r->Addr;
+          ids.clear();
+          for (; r != inodes.end() && r->Addr == addr; ++r) {
+            ids.push_back(r->ID);
+          }
+          fn(fsInodes.first, addr, ids);
+        }
+      }
+    }
+    return;
+  }
+  spillInodes();
+
+  // the spills are in the order their IDs were written, which the merge keeps
+  SpillMerge<InodeRecord, InodeOrder> inodes(InodeSpills, 0, InodeSpills.size());
+  while (!inodes.empty()) {
+    const uint32_t curVol = inodes.top().Vol;
+    const uint64_t addr = inodes.top().Addr;
+    ids.clear();
+    for (; !inodes.empty() && inodes.top().Vol == curVol && inodes.top().Addr == addr; inodes.pop()) {
+      ids.push_back(inodes.top().ID);
+    }
+    if (ALL_VOLS == vol || curVol == vol) {
+      fn(curVol, addr, ids);
+    }
+  }
+}
+
+bool MetadataWriter::sunk(uint32_t vol, uint64_t addr) const {
+  const auto itr = Sunk.find(vol);
+  return itr != Sunk.end() && std::binary_search(itr->second.begin(), itr->second.end(), addr);
+}
+
+std::vector<uint32_t> MetadataWriter::diskMapVolumes() const {
+  if (!RunSpills.empty()) {
+    return std::vector<uint32_t>(1, uint32_t(ALL_VOLS));
+  }
+  std::vector<uint32_t> vols;
+  for (const auto& fsRuns: AllocatedRuns) {
+    vols.push_back(fsRuns.first);
+  }
+  return vols;
+}
+
+std::vector<uint32_t> MetadataWriter::inodeMapVolumes() const {
+  if (!InodeSpills.empty()) {
+    return std::vector<uint32_t>(1, uint32_t(ALL_VOLS));
+  }
+  std::vector<uint32_t> vols;
+  for (const auto& fsInodes: ReverseMap) {
+    vols.push_back(fsInodes.first);
+  }
+  return vols;
 }
 
 void MetadataWriter::setFsInfo(TSK_FS_INFO* fs, uint64_t startSector, uint64_t endSector) {
@@ -435,47 +1130,66 @@ void MetadataWriter::setFsInfo(TSK_FS_INFO* fs, uint64_t startSector, uint64_t e
       << j("volIndex", NumVols)
       << "}";
   FsInfo = buf.str();
+  FsVolIndex = NumVols;
+  if (BINARY == Format && !Resuming) { // a resumed fs's record was written before
+    Binary.clear();
+    Binary.varint(BinRecord::FS)
+          .varint(fs->offset)
+          .varint(fs->block_size)
+          .bytes(fs->fs_id, fs->fs_id_used)
+          .str(VolName)
+          .varint(NumVols);
+    writeBinaryRecord();
+  }
   Fs = fs; // does not take ownership
   FSBeg = PartBeg;
   FSEnd = PartEnd;
   CurAllocatedItr = AllocatedRuns.find(NumVols);
   if (AllocatedRuns.end() == CurAllocatedItr) {
     CurAllocatedItr = AllocatedRuns.insert(std::make_pair(NumVols,
-                        std::make_tuple(fs->block_size, startSector, endSector, FsMap{}))).first;
+                        std::make_tuple(fs->block_size, startSector, endSector, RunTable{}))).first;
   }
 }
 
-bool MetadataWriter::atFSRootLevel(const std::string& path) const {
-  return path.size() == VolName.size() + 1 && path.back() == '/';
+void MetadataWriter::shareFs(const MetadataWriter& walker, TSK_FS_INFO* fs) {
+  Part = walker.Part;
+  VolName = walker.VolName;
+  NumVols = walker.NumVols;
+  PartBeg = walker.PartBeg;
+  PartEnd = walker.PartEnd;
+  FSBeg = walker.FSBeg;
+  FSEnd = walker.FSEnd;
+  FsInfo = walker.FsInfo;
+  FsID = walker.FsID;
+  FsVolIndex = walker.FsVolIndex;
+  Fs = fs;
+  const FsMapInfo& runs(walker.CurAllocatedItr->second);
+  CurAllocatedItr = AllocatedRuns.insert(std::make_pair(NumVols,
+                      std::make_tuple(std::get<0>(runs), std::get<1>(runs), std::get<2>(runs), RunTable{}))).first;
 }
 
 void MetadataWriter::setCurDir(const char* path) {
-  std::string p;
-  if (!VolName.empty()) {
-    p += VolName;
-    p += "/";
-  }
-  p += path;
-
-  auto rItr = std::find_if(Dirs.rbegin(), Dirs.rend(), [&p](const DirInfo& d){ return d.path() == p; });
-  if (rItr == Dirs.rend()) {
-    // Couldn't find the dir on the stack, so push it on
-    // However, since TSK uses depth-first traversal, we'll have seen the entry for the directory immediately prior,
-    // so we _MUST NOT_ increment the count on Dirs.back(), because then we'd be double-counting.
-    // std::cerr << "new directory " << p << std::endl;
-    Dirs.emplace_back(Dirs.back().newChild(p));
+  // TSK walks depth-first and reports a directory's entry just before its
+  // contents, so path is that of the current directory, of one just entered,
+  // or of an ancestor, and its length alone tells which
+  const size_t len = (VolName.empty() ? 0: VolName.size() + 1) + std::strlen(path);
+  while (Dirs.size() > 1 && Dirs.back().path().size() > len) {
+    Dirs.pop_back();
   }
-  else {
-    // found it; pop off any children and inc the count
-    // std::cerr << "old directory " << p << std::endl;
-    Dirs.erase(rItr.base(), Dirs.end());
+  if (Dirs.back().path().size() < len) {
+    // new directory, so push it on
+    // However, since we'll have seen the entry for the directory immediately prior,
+    // we _MUST NOT_ increment the count on Dirs.back(), because then we'd be double-counting.
+    std::string p;
+    p.reserve(len);
+    if (!VolName.empty()) {
+      p += VolName;
+      p += "/";
+    }
+    p += path;
+    Dirs.emplace_back(Dirs.back().newChild(p));
   }
   Dirs.back().incCount();
-  if (atFSRootLevel(p)) {
-    NumRootEntries[NumVols] = Dirs.back().count();
-  }
-  // std::cerr << "setCurDir(" << path << ") seen, id = " << Dirs.back().id() << ", Count = " << Dirs.back().count()
-  //   << ", parentID = " << (++Dirs.rbegin() != Dirs.rend() ? (++Dirs.rbegin())->id(): "") << std::endl;
 }
 
 void MetadataWriter::resetPartitionRange() {
@@ -490,99 +1204,311 @@ void MetadataWriter::setPartitionRange(uint64_t begin, uint64_t end) {
 
 TSK_RETVAL_ENUM MetadataWriter::processFile(TSK_FS_FILE* file, const char* path) {
   // std::cerr << "processFile on " << path << file->name->name << std::endl;
-  setCurDir(path);
+  setCurDir(path); // even if filtered out, so that IDs match an unfiltered run
+  writeEntry(file, path);
+  return TSK_OK;
+}
+
+void MetadataWriter::writeEntry(TSK_FS_FILE* file, const char* path) {
   // std::cerr << "beginning callback" << std::endl;
+  bool written = false,
+       resumed = false;
   try {
-    if (file) {
-      std::stringstream buf;
-      writeFile(buf, file);
-      std::string output(buf.str());
-      Out << output << '\n';
-      DataWritten += output.size();
+    if (file && !IndexFile.empty() && hasUsableMeta(file)) {
+      const TSK_FS_META* m = file->meta;
+      IndexEntries.push_back(InodeIndex::Entry{m->addr, FsVolIndex, m->seq, m->mtime, m->ctime, uint64_t(m->size)});
+    }
+
+    if (file && Resuming) {
+      resumed = skipResumed(file, path);
+    }
+    else if (file && ((Since && unchanged(file)) || !Filter.matches(file, path))) { // unchanged() first, to mark it seen
+      if (needRuns() && hasUsableMeta(file)) {
+        collectAttrs(file); // not written, but the disk map still needs its runs
+        markCollectedRuns(file->meta->addr);
+      }
+    }
+    else if (file) {
+      if (BINARY == Format) {
+        Binary.clear();
+        writeFile(Binary, file);
+        writeBinaryRecord();
+      }
+      else if (AVRO == Format) {
+        AvroWriter& rec(Avro->record());
+        const size_t before = rec.size();
+        writeFile(rec, file);
+        DataWritten += rec.size() - before;
+        Avro->endRecord();
+      }
+      else {
+        Record.clear();
+        writeFile(Record, file);
+        DataWritten += Record.size();
+        Record.raw('\n');
+        Out.write(Record.data(), Record.size());
+        OutputOffset += Record.size();
+      }
+      written = true;
     }
+    limitMemory();
   }
   catch (std::exception& e) {
     std::cerr << "Error on " << NumFiles << ": " << e.what() << std::endl;
   }
   // std::cerr << "finishing callback" << std::endl;
   FileCounter::processFile(file, path);
-  return TSK_OK;
+  if (resumed) {
+    NumFiles = Resume.Records; // whatever was skipped on the way
+  }
+  else if (written && NumFiles >= NextCheckpoint) {
+    saveCheckpoint(path);
+  }
+}
+
+void MetadataWriter::setCheckpoints(const std::string& file, const uint64_t every) {
+  CheckpointFile = file;
+  CheckpointEvery = std::max(every, uint64_t(1));
+  NextCheckpoint = CheckpointEvery;
+}
+
+bool MetadataWriter::resume(const std::string& file) {
+  if (!Resume.load(file)) {
+    return false;
+  }
+  Resuming = true;
+  NextCheckpoint = Resume.Records + CheckpointEvery;
+  return true;
+}
+
+void MetadataWriter::saveCheckpoint(const char* path) {
+  Out.flush(); // the output must be at least as long as the checkpoint says
+  Checkpoint cp;
+  cp.Records = NumFiles;
+  cp.DataWritten = DataWritten;
+  cp.Offset = OutputOffset;
+  cp.NumVols = NumVols;
+  cp.LastID = RecordID;
+  cp.Path = path;
+  for (const DirInfo& dir: Dirs) {
+    cp.Dirs.emplace_back(dir.path(), dir.count());
+  }
+  if (!cp.save(CheckpointFile)) {
+    std::cerr << "Error: could not write checkpoint to " << CheckpointFile << std::endl;
+  }
+  NextCheckpoint = NumFiles + CheckpointEvery;
+}
+
+bool MetadataWriter::skipResumed(TSK_FS_FILE* file, const char* path) {
+  // what writeEntry() would have done, but without writing
+  setRecordIDs();
+  const bool skipped = (Since && unchanged(file)) || !Filter.matches(file, path);
+  if (hasUsableMeta(file)) {
+    if (needRuns()) {
+      collectAttrs(file);
+      markCollectedRuns(file->meta->addr);
+    }
+    if (BuildInodeMap && !skipped) {
+      mapInode(file);
+    }
+  }
+  if (NumVols != Resume.NumVols || RecordID != Resume.LastID) {
+    return false;
+  }
+  Resuming = false;
+  DataWritten = Resume.DataWritten;
+  OutputOffset = Resume.Offset;
+  bool same = Dirs.size() == Resume.Dirs.size();
+  for (size_t i = 0; same && i < Dirs.size(); ++i) {
+    same = Dirs[i].path() == Resume.Dirs[i].first && Dirs[i].count() == Resume.Dirs[i].second;
+  }
+  if (!same) {
+    std::cerr << "Error: the checkpoint's directories don't match the image's; resuming anyway" << std::endl;
+  }
+  return true;
+}
+
+bool MetadataWriter::resumeSkips(const std::string& dirPath) const {
+  // IDs depend only on the entries before them in their own directories and
+  // those above, so the directories that don't lead to Resume's last record
+  // can go unread, unless their runs or inodes are needed
+  return Resuming && !needRuns() && !BuildInodeMap && IndexFile.empty() && !Since &&
+         (NumVols != Resume.NumVols || Resume.Path.compare(0, dirPath.size(), dirPath) != 0);
+}
+
+bool MetadataWriter::setSince(const std::string& file) {
+  std::shared_ptr<SinceIndex> since(new SinceIndex);
+  if (!since->Index.open(file)) {
+    return false;
+  }
+  since->Seen.reset(new std::atomic<bool>[since->Index.size()]()); // all false
+  Since = since;
+  return true;
+}
+
+bool MetadataWriter::unchanged(const TSK_FS_FILE* file) {
+  if (!hasUsableMeta(file)) {
+    return false;
+  }
+  const TSK_FS_META* m = file->meta;
+  const InodeIndex::Entry* e = Since->Index.find(FsVolIndex, m->addr);
+  if (!e) {
+    return false; // added
+  }
+  Since->Seen[e - Since->Index.begin()].store(true, std::memory_order_relaxed);
+  return e->Seq == m->seq && e->MTime == m->mtime && e->CTime == m->ctime && e->Size == uint64_t(m->size);
+}
+
+void MetadataWriter::writeTombstones() {
+  char id[INODE_ID_SIZE];
+  const InodeIndex::Entry* first = Since->Index.begin();
+  for (const InodeIndex::Entry* e = first; e != Since->Index.end(); ++e) {
+    if (Since->Seen[e - first].load(std::memory_order_relaxed)) {
+      continue;
+    }
+    if (BINARY == Format) {
+      Binary.clear();
+      Binary.varint(BinRecord::TOMBSTONE).varint(e->Vol).varint(e->Addr).varint(e->Seq);
+      writeBinaryRecord();
+    }
+    else {
+      writeInodeID(id, e->Vol, e->Addr);
+      Record.clear();
+      Record.beginObject()
+            .pair("id", id, INODE_ID_SIZE, true)
+            .key("t").beginObject()
+              .key("tombstone", true).beginObject()
+                .pair("vol", e->Vol, true)
+                .pair("addr", e->Addr)
+                .pair("seq", e->Seq)
+              .endObject()
+            .endObject()
+            .endObject()
+            .raw('\n');
+      Out.write(Record.data(), Record.size());
+      OutputOffset += Record.size();
+    }
+  }
 }
 
 void MetadataWriter::finishWalk() {
+  if (Resuming) {
+    std::cerr << "Error: the walk never reached the checkpoint's last record, so nothing was written" << std::endl;
+  }
+  if (Avro) {
+    Avro->flush();
+  }
+}
+
+std::vector<TskAuto::error_record> MetadataWriter::errors() {
+  std::vector<error_record> ret(getErrorList());
+  ret.insert(ret.end(), ChildErrors.begin(), ChildErrors.end());
+  return ret;
+}
+
+void MetadataWriter::setOutputFormat(const OUTPUT_FORMAT format) {
+  Format = format;
+  if (AVRO == Format) {
+    if (!Avro) {
+      Avro.reset(new AvroContainer(Out, dirEntrySchema(RecordFields)));
+    }
+  }
+  else {
+    Avro.reset();
+  }
+}
+
+void MetadataWriter::writeMetaRecord(JsonWriter& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs) {
+  const TSK_FS_META* i = file->meta;
+  const bool meta = RecordFields & Fields::META,
+             times = RecordFields & Fields::TIMES;
+  out.beginObject()
+     .pair("addr", static_cast<int64_t>(i->addr), true);
+  if (times) {
+    writeTimestamp(out, "accessed", i->atime, i->atime_nano);
+  }
+  if (meta) {
+    out.pair("content_len", i->content_len);
+  }
+  if (times) {
+    writeTimestamp(out, "created", i->crtime, i->crtime_nano);
+    writeTimestamp(out, "metadata", i->ctime, i->ctime_nano);
+  }
+  if (meta) {
+    out.pair("flags", metaFlags(i->flags))
+       .pair("gid", i->gid);
+    if (i->link) {
+      out.pair("link", i->link);
+    }
+  }
+  if (times) {
+    if (TSK_FS_TYPE_ISEXT(fs->ftype)) {
+      writeTimestamp(out, "dtime", i->time2.ext2.dtime, i->time2.ext2.dtime_nano);
+    }
+    else if (TSK_FS_TYPE_ISHFS(fs->ftype)) {
+      writeTimestamp(out, "bkup_time", i->time2.hfs.bkup_time, i->time2.hfs.bkup_time_nano);
+    }
+  }
+  if (meta) {
+    out.pair("mode", i->mode);
+  }
+  if (times) {
+    writeTimestamp(out, "modified", i->mtime, i->mtime_nano);
+  }
+  if (meta) {
+    out.pair("nlink", i->nlink)
+       .pair("seq", i->seq)
+       .pair("size", i->size)
+       .pair("type", metaType(i->type))
+       .pair("uid", i->uid);
+  }
+
+  if (RecordFields & Fields::ATTRS) {
+    out.raw(", \"attrs\":[");
+    collectAttrs(file);
+    for (auto a = Attrs.begin(); a != Attrs.end(); ++a) {
+      if (a != Attrs.begin()) {
+        out.raw(", ");
+      }
+      writeAttr(out, i->addr, *a);
+    }
+    out.raw(']');
+  }
+  out.endObject();
 }
 
-void MetadataWriter::writeMetaRecord(std::ostream& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs) {
+void MetadataWriter::collectAttrs(const TSK_FS_FILE* file) {
+  Attrs.clear();
   const TSK_FS_META* i = file->meta;
-  out << "{"
-      << j<int64_t>("addr", static_cast<int64_t>(i->addr), true)
-      << j("accessed", formatTimestamp(i->atime, i->atime_nano))
-      << j("content_len", i->content_len)
-      << j("created", formatTimestamp(i->crtime, i->crtime_nano))
-      << j("metadata", formatTimestamp(i->ctime, i->ctime_nano))
-      << j("flags", metaFlags(i->flags))
-      << j("gid", i->gid);
-  if (i->link) {
-    out << j("link", std::string(i->link));
-  }
-  if (TSK_FS_TYPE_ISEXT(fs->ftype)) {
-    out << j("dtime", formatTimestamp(i->time2.ext2.dtime, i->time2.ext2.dtime_nano));
-  }
-  else if (TSK_FS_TYPE_ISHFS(fs->ftype)) {
-    out << j("bkup_time", formatTimestamp(i->time2.hfs.bkup_time, i->time2.hfs.bkup_time_nano));
-  }
-  out << j("mode", i->mode)
-      << j("modified", formatTimestamp(i->mtime, i->mtime_nano))
-      << j("nlink", i->nlink)
-      << j("seq", i->seq)
-      << j("size", i->size)
-      << j("type", metaType(i->type))
-      << j("uid", i->uid);
-
-  out << ", \"attrs\":[";
   if ((i->attr_state & TSK_FS_META_ATTR_STUDIED) && i->attr) {
-    const TSK_FS_ATTR* lastAttr = 0;
     for (const TSK_FS_ATTR* a = i->attr->head; a; a = a->next) {
       if (a->flags & TSK_FS_ATTR_INUSE) {
-        if (lastAttr != 0) {
-          out << ", ";
-        }
-        writeAttr(out, i->addr, a);
-        lastAttr = a;
+        Attrs.push_back(a);
       }
     }
   }
   else {
     int numAttrs = tsk_fs_file_attr_getsize(const_cast<TSK_FS_FILE*>(file));
-    if (numAttrs > 0) {
-      unsigned int num = 0;
-      for (int j = 0; j < numAttrs; ++j) {
-        const TSK_FS_ATTR* a = tsk_fs_file_attr_get_idx(const_cast<TSK_FS_FILE*>(file), j);
-        if (a) {
-          if (num > 0) {
-            out << ", ";
-          }
-          writeAttr(out, i->addr, a);
-          ++num;
-        }
+    for (int j = 0; j < numAttrs; ++j) {
+      const TSK_FS_ATTR* a = tsk_fs_file_attr_get_idx(const_cast<TSK_FS_FILE*>(file), j);
+      if (a) {
+        Attrs.push_back(a);
       }
     }
   }
-  out << "]";
-  out << "}";
 }
 
-void MetadataWriter::writeNameRecord(std::ostream& out, const TSK_FS_NAME* n) {
-  out << "{"
-      << j("flags", nameFlags(n->flags), true)
-      << j<int64_t>("meta_addr", static_cast<int64_t>(n->meta_addr))
-      << j("meta_seq", n->meta_seq)
-      << j("name", (n->name && n->name_size ? std::string(n->name): ""))
-      << j("par_addr", n->par_addr)
-      << j("par_seq", n->par_seq)
-      << j("shrt_name", (n->shrt_name && n->shrt_name_size ? std::string(n->shrt_name): ""))
-      << j("type", nameType(n->type))
-      << "}";
+void MetadataWriter::writeNameRecord(JsonWriter& out, const TSK_FS_NAME* n) {
+  out.beginObject()
+     .pair("flags", nameFlags(n->flags), true)
+     .pair("meta_addr", static_cast<int64_t>(n->meta_addr))
+     .pair("meta_seq", n->meta_seq)
+     .pair("name", n->name_size ? n->name: nullptr)
+     .pair("par_addr", n->par_addr)
+     .pair("par_seq", n->par_seq)
+     .pair("shrt_name", n->shrt_name_size ? n->shrt_name: nullptr)
+     .pair("type", nameType(n->type))
+     .endObject();
 }
 
 bool typeMatch(const TSK_FS_NAME_TYPE_ENUM n, const TSK_FS_META_TYPE_ENUM m) {
@@ -601,146 +1527,493 @@ bool typeMatch(const TSK_FS_NAME_TYPE_ENUM n, const TSK_FS_META_TYPE_ENUM m) {
          (n == TSK_FS_NAME_TYPE_UNDEF); // no meta type for this, so give it the pedantic benefit of the doubt
 }
 
-void MetadataWriter::writeFile(std::ostream& out, const TSK_FS_FILE* file) {
-  DirInfo     fileDirEnt(Dirs.back().newChild(""));
-  std::string id(fileDirEnt.id());
+bool hasUsableMeta(const TSK_FS_FILE* file) {
+  const TSK_FS_NAME* n = file->name;
+  const TSK_FS_META* m = file->meta;
+  return m && // gotta have a pointer
+     (m->flags & TSK_FS_META_FLAG_USED) && // gotta be legit
+     (!n || n->flags & TSK_FS_NAME_FLAG_ALLOC || typeMatch(n->type, m->type)); // no sense in outputting meta if file's deleted and name and meta types don't match
+}
+
+void MetadataWriter::setRecordIDs() {
+  const DirInfo& dir(Dirs.back());
+  RecordID.clear();
+  dir.appendLastChild(RecordID);
+  ParentID.clear();
+  dir.appendID(ParentID);
+  ChildrenID.clear();
+  dir.appendLastChildsChildren(ChildrenID);
+}
+
+void MetadataWriter::writeFile(JsonWriter& out, const TSK_FS_FILE* file) {
+  setRecordIDs();
 
-  out << "{" << j("id", id, true)
-      << j("parent", Dirs.back().id())
-      << j("children", fileDirEnt.lastChild())
-      << ", \"t\":{ \"fsmd\":{ ";
+  out.beginObject()
+     .key("id", true).hex(RecordID)
+     .key("parent").hex(ParentID)
+     .key("children").hex(ChildrenID)
+     .raw(", \"t\":{ \"fsmd\":{ ");
 
-  out << FsInfo
-      << j("path", Dirs.back().path());
+  out.raw(FsInfo)
+     .pair("path", Dirs.back().path());
 
-  TSK_FS_NAME* n = nullptr;
-  if (file->name) {
-    n = file->name;
-    out << ", \"name\":";
-    writeNameRecord(out, n);
+  if (file->name && (RecordFields & Fields::NAME)) {
+    out.raw(", \"name\":");
+    writeNameRecord(out, file->name);
   }
-  TSK_FS_META* m = file->meta;
-  if (m && // gotta have a pointer
-     (m->flags & TSK_FS_META_FLAG_USED) && // gotta be legit
-     (!n || n->flags & TSK_FS_NAME_FLAG_ALLOC || typeMatch(n->type, m->type))) // no sense in outputting meta if file's deleted and name and meta types don't match
-  {
-    out << ", \"meta\":";
+  if (hasUsableMeta(file)) {
+    out.raw(", \"meta\":");
     writeMetaRecord(out, file, file->fs_info);
+    markFileRuns(file);
 
-    ReverseMap[NumVols][file->meta->addr].emplace_back(id);
+    if (BuildInodeMap) {
+      mapInode(file);
+    }
 
-    out << "}, \"__link\":\"" << makeInodeID(NumVols, file->meta->addr) << "\"";
+    out.raw("}, \"__link\":\"");
+    writeInodeID(out.reserve(INODE_ID_SIZE), NumVols, file->meta->addr);
+    out.commit(INODE_ID_SIZE);
+    out.raw('"');
   }
   else {
-    out << "}";
+    out.raw('}');
   }
 
-  out << " } }";
+  out.raw(" } }");
 }
 
-void MetadataWriter::writeAttr(std::ostream& out, TSK_INUM_T addr, const TSK_FS_ATTR* a) {
-  out << "{"
-      << j("flags", attrFlags(a->flags), true)
-      << j("id", a->id)
-      << j("name", a->name ? std::string(a->name): std::string(""))
-      << j("size", a->size)
-      << j("type", a->type)
-      << j("rd_buf_size", a->rd.buf_size)
-      << j("nrd_allocsize", a->nrd.allocsize)
-      << j("nrd_compsize", a->nrd.compsize)
-      << j("nrd_initsize", a->nrd.initsize)
-      << j("nrd_skiplen", a->nrd.skiplen);
-
-  if (a->flags & TSK_FS_ATTR_RES && a->rd.buf_size && a->rd.buf) {
-    out << ", " << j(std::string("rd_buf")) << ":\"";
-    std::ios::fmtflags oldFlags = out.flags();
-    out << std::hex << std::setfill('0');
+void MetadataWriter::writeAttr(JsonWriter& out, TSK_INUM_T addr, const TSK_FS_ATTR* a) {
+  out.beginObject()
+     .pair("flags", attrFlags(a->flags), true)
+     .pair("id", a->id)
+     .pair("name", a->name)
+     .pair("size", a->size)
+     .pair("type", a->type)
+     .pair("rd_buf_size", a->rd.buf_size)
+     .pair("nrd_allocsize", a->nrd.allocsize)
+     .pair("nrd_compsize", a->nrd.compsize)
+     .pair("nrd_initsize", a->nrd.initsize)
+     .pair("nrd_skiplen", a->nrd.skiplen);
+
+  if (a->flags & TSK_FS_ATTR_RES && a->rd.buf_size && a->rd.buf && (RecordFields & Fields::RD_BUF)) {
+    out.raw(", \"rd_buf\":\"");
     size_t numBytes = std::min(a->rd.buf_size, (size_t)a->size);
-    for (size_t i = 0; i < numBytes; ++i) {
-      out << std::setw(2) << (unsigned int)a->rd.buf[i];
-    }
-    out.flags(oldFlags);
-    out << "\"";
+    hexEncode(out.reserve(numBytes * 2), a->rd.buf, a->rd.buf + numBytes);
+    out.commit(numBytes * 2);
+    out.raw('"');
   }
 
-  if (a->flags & TSK_FS_ATTR_NONRES) {
-    out << ", \"nrd_runs\":[";
-    uint64_t fo = 0; // file offset
-    uint64_t slackFo = 0;
-    uint64_t skipBytes = a->nrd.skiplen; // up from 32 bits to 64 for convenience
-    const uint64_t mainSize  = (a->flags & TSK_FS_ATTR_COMP) ? a->nrd.allocsize: a->nrd.initsize;
-    // if (addr == 3240) {
-    //   std::cerr << "mainSize = " << mainSize << "\n";
-    // }
+  if (a->flags & TSK_FS_ATTR_NONRES && (RecordFields & Fields::RUNS)) {
+    const uint64_t slackSize = markAttrRuns(addr, a);
+    out.raw(", \"nrd_runs\":[");
     bool first = true;
     for (TSK_FS_ATTR_RUN* curRun = a->nrd.run; curRun; curRun = curRun->next) {
       if (TSK_FS_ATTR_RUN_FLAG_FILLER == curRun->flags) {
-        // TO-DO: check on the exact semantics of this flag
         continue;
       }
-      // normal case - make absolute offsets
-      uint64_t beg = (curRun->addr * Fs->block_size) + Fs->offset,
-               runEnd = beg + (curRun->len * Fs->block_size),
-               end = runEnd;
-      bool     trueSlack = false;
-      // if (addr == 3240) {
-      //   std::cerr << "beg = " << beg << ", end = " << end << ", len = " << (end - beg) << ", fo = " << fo << ", slackFo = " << slackFo << "\n";
-      // }
-      // if skipping, advance beg and decrement skipBytes accordingly
-      if (skipBytes > 0) { // still towards beginning where skiplen is > 0
-        uint64_t toSkip = std::min(end - beg, skipBytes);
-        beg += toSkip;
-        skipBytes -= toSkip;
+      if (!first) {
+        out.raw(", ");
       }
-      if (beg < end) { // past skipping, we're onto data
-        uint64_t bytesRemaining = mainSize - fo; // how much data left in file stream?
-        if (beg + bytesRemaining < end) {
-          end = beg + bytesRemaining; // end is now beginning of true slack
-          trueSlack = true;
-          // if (3240 == addr) {
-          //   std::cerr << "bytesRemaining = " << bytesRemaining << ", end now =" << end << "\n";
-          // }
-        }
-        if (beg < end) { // if false, we're fully into true slack, nothing of file left
-          if (TSK_FS_ATTR_RUN_FLAG_NONE == curRun->flags) {
-            // just normal data; sparse blocks will be made available as unallocated
-            markDataRun(beg, end, fo, addr, a->id, false);
-          }
-          fo += (end - beg); // advances fo even if data run is sparse, which is critical
+      out.beginObject()
+         .pair("addr", curRun->addr, true)
+         .pair("flags", curRun->flags)
+         .pair("len", curRun->len)
+         .pair("offset", curRun->offset)
+         .endObject();
+      first = false;
+    }
+    out.raw(']').pair("slack_size", slackSize);
+  }
+  out.endObject();
+}
+
+uint64_t MetadataWriter::markAttrRuns(TSK_INUM_T addr, const TSK_FS_ATTR* a) {
+  uint64_t fo = 0; // file offset
+  uint64_t slackFo = 0;
+  uint64_t skipBytes = a->nrd.skiplen; // up from 32 bits to 64 for convenience
+  const uint64_t mainSize  = (a->flags & TSK_FS_ATTR_COMP) ? a->nrd.allocsize: a->nrd.initsize;
+  // if (addr == 3240) {
+  //   std::cerr << "mainSize = " << mainSize << "\n";
+  // }
+  for (TSK_FS_ATTR_RUN* curRun = a->nrd.run; curRun; curRun = curRun->next) {
+    if (TSK_FS_ATTR_RUN_FLAG_FILLER == curRun->flags) {
+      // TO-DO: check on the exact semantics of this flag
+      continue;
+    }
+    // normal case - make absolute offsets
+    uint64_t beg = (curRun->addr * Fs->block_size) + Fs->offset,
+             runEnd = beg + (curRun->len * Fs->block_size),
+             end = runEnd;
+    bool     trueSlack = false;
+    // if (addr == 3240) {
+    //   std::cerr << "beg = " << beg << ", end = " << end << ", len = " << (end - beg) << ", fo = " << fo << ", slackFo = " << slackFo << "\n";
+    // }
+    // if skipping, advance beg and decrement skipBytes accordingly
+    if (skipBytes > 0) { // still towards beginning where skiplen is > 0
+      uint64_t toSkip = std::min(end - beg, skipBytes);
+      beg += toSkip;
+      skipBytes -= toSkip;
+    }
+    if (beg < end) { // past skipping, we're onto data
+      uint64_t bytesRemaining = mainSize - fo; // how much data left in file stream?
+      if (beg + bytesRemaining < end) {
+        end = beg + bytesRemaining; // end is now beginning of true slack
+        trueSlack = true;
+        // if (3240 == addr) {
+        //   std::cerr << "bytesRemaining = " << bytesRemaining << ", end now =" << end << "\n";
+        // }
+      }
+      if (beg < end) { // if false, we're fully into true slack, nothing of file left
+        if (TSK_FS_ATTR_RUN_FLAG_NONE == curRun->flags) {
+          // just normal data; sparse blocks will be made available as unallocated
+          markDataRun(beg, end, fo, addr, a->id, false);
         }
-        if (trueSlack) {
-          // mark slack at end of allocated space
-          if (TSK_FS_ATTR_RUN_FLAG_NONE == curRun->flags) { // but only if not sparse (yes, could have sparse slack)
-            markDataRun(end, runEnd, slackFo, addr, a->id, true);
-          }
-          slackFo += (runEnd - end);
+        fo += (end - beg); // advances fo even if data run is sparse, which is critical
+      }
+      if (trueSlack) {
+        // mark slack at end of allocated space
+        if (TSK_FS_ATTR_RUN_FLAG_NONE == curRun->flags) { // but only if not sparse (yes, could have sparse slack)
+          markDataRun(end, runEnd, slackFo, addr, a->id, true);
         }
+        slackFo += (runEnd - end);
       }
-      // output data run as json
-      if (!first) {
-        out << ", ";
+    }
+  }
+  return slackFo;
+}
+
+void MetadataWriter::markFileRuns(const TSK_FS_FILE* file) {
+  const unsigned int written = Fields::ATTRS | Fields::RUNS;
+  if ((RecordFields & written) == written || !needRuns()) {
+    return; // either writeAttr() has marked them, or nothing needs them
+  }
+  if (!(RecordFields & Fields::ATTRS)) {
+    collectAttrs(file);
+  }
+  markCollectedRuns(file->meta->addr);
+}
+
+void MetadataWriter::markCollectedRuns(TSK_INUM_T addr) {
+  for (const TSK_FS_ATTR* a: Attrs) {
+    if (a->flags & TSK_FS_ATTR_NONRES) {
+      markAttrRuns(addr, a);
+    }
+  }
+}
+
+void MetadataWriter::writeFile(BinaryWriter& out, const TSK_FS_FILE* file) {
+  setRecordIDs();
+
+  out.varint(BinRecord::FILE);
+  out.str(RecordID);
+  out.str(ParentID);
+  out.str(ChildrenID);
+  out.str(Dirs.back().path());
+
+  const bool hasName = file->name && (RecordFields & Fields::NAME),
+             hasMeta = hasUsableMeta(file);
+  out.varint((hasName ? BinRecord::HAS_NAME: 0) | (hasMeta ? BinRecord::HAS_META: 0));
+  if (hasName) {
+    writeNameRecord(out, file->name);
+  }
+  if (hasMeta) {
+    writeMetaRecord(out, file, file->fs_info);
+    markFileRuns(file);
+    if (BuildInodeMap) {
+      mapInode(file);
+    }
+  }
+}
+
+void MetadataWriter::writeNameRecord(BinaryWriter& out, const TSK_FS_NAME* n) {
+  out.varint(n->flags)
+     .varint(n->meta_addr)
+     .varint(n->meta_seq)
+     .str(n->name_size ? n->name: nullptr)
+     .varint(n->par_addr)
+     .varint(n->par_seq)
+     .str(n->shrt_name_size ? n->shrt_name: nullptr)
+     .varint(n->type);
+}
+
+void MetadataWriter::writeMetaRecord(BinaryWriter& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs) {
+  // timestamps are truncated to 32 bits, as in the JSON
+  const TSK_FS_META* i = file->meta;
+  unsigned int contents = 0;
+  if (RecordFields & Fields::META) {
+    contents |= BinRecord::HAS_FIELDS | (i->link ? BinRecord::HAS_LINK: 0);
+  }
+  if (RecordFields & Fields::TIMES) {
+    contents |= BinRecord::HAS_TIMES;
+    if (TSK_FS_TYPE_ISEXT(fs->ftype)) {
+      contents |= BinRecord::HAS_DTIME;
+    }
+    else if (TSK_FS_TYPE_ISHFS(fs->ftype)) {
+      contents |= BinRecord::HAS_BKUP_TIME;
+    }
+  }
+  if (RecordFields & Fields::ATTRS) {
+    contents |= BinRecord::HAS_ATTRS;
+  }
+  out.varint(i->addr)
+     .varint(contents);
+
+  if (contents & BinRecord::HAS_FIELDS) {
+    out.varint(i->content_len)
+       .varint(i->flags)
+       .varint(i->gid);
+    if (i->link) {
+      out.str(i->link);
+    }
+    out.varint(i->mode)
+       .varint(static_cast<int64_t>(i->nlink))
+       .varint(i->seq)
+       .varint(i->size)
+       .varint(i->type)
+       .varint(i->uid);
+  }
+  if (contents & BinRecord::HAS_TIMES) {
+    out.varint(static_cast<uint32_t>(i->atime))
+       .varint(i->atime_nano)
+       .varint(static_cast<uint32_t>(i->crtime))
+       .varint(i->crtime_nano)
+       .varint(static_cast<uint32_t>(i->ctime))
+       .varint(i->ctime_nano);
+    if (contents & BinRecord::HAS_DTIME) {
+      out.varint(static_cast<uint32_t>(i->time2.ext2.dtime)).varint(i->time2.ext2.dtime_nano);
+    }
+    else if (contents & BinRecord::HAS_BKUP_TIME) {
+      out.varint(static_cast<uint32_t>(i->time2.hfs.bkup_time)).varint(i->time2.hfs.bkup_time_nano);
+    }
+    out.varint(static_cast<uint32_t>(i->mtime))
+       .varint(i->mtime_nano);
+  }
+  if (contents & BinRecord::HAS_ATTRS) {
+    collectAttrs(file);
+    out.varint(Attrs.size());
+    for (const TSK_FS_ATTR* a: Attrs) {
+      writeAttr(out, i->addr, a);
+    }
+  }
+}
+
+void MetadataWriter::writeAttr(BinaryWriter& out, TSK_INUM_T addr, const TSK_FS_ATTR* a) {
+  out.varint(a->flags)
+     .varint(a->id)
+     .str(a->name)
+     .varint(a->size)
+     .varint(a->type)
+     .varint(a->rd.buf_size)
+     .varint(a->nrd.allocsize)
+     .varint(a->nrd.compsize)
+     .varint(a->nrd.initsize)
+     .varint(a->nrd.skiplen);
+
+  const bool hasRdBuf = a->flags & TSK_FS_ATTR_RES && a->rd.buf_size && a->rd.buf && (RecordFields & Fields::RD_BUF);
+  const bool hasRuns = a->flags & TSK_FS_ATTR_NONRES && (RecordFields & Fields::RUNS);
+  out.varint((hasRdBuf ? BinRecord::HAS_RD_BUF: 0) | (hasRuns ? BinRecord::HAS_RUNS: 0));
+  if (hasRdBuf) {
+    out.bytes(a->rd.buf, std::min(a->rd.buf_size, (size_t)a->size));
+  }
+  if (hasRuns) {
+    const uint64_t slackSize = markAttrRuns(addr, a);
+    uint64_t numRuns = 0;
+    for (TSK_FS_ATTR_RUN* curRun = a->nrd.run; curRun; curRun = curRun->next) {
+      if (TSK_FS_ATTR_RUN_FLAG_FILLER != curRun->flags) {
+        ++numRuns;
       }
-      out << "{"
-          << j("addr", curRun->addr, true)
-          << j("flags", curRun->flags)
-          << j("len", curRun->len)
-          << j("offset", curRun->offset)
-          << "}";
-      first = false;
     }
-    out << "]" << j("slack_size", slackFo);
+    out.varint(numRuns);
+    for (TSK_FS_ATTR_RUN* curRun = a->nrd.run; curRun; curRun = curRun->next) {
+      if (TSK_FS_ATTR_RUN_FLAG_FILLER != curRun->flags) {
+        out.varint(curRun->addr)
+           .varint(curRun->flags)
+           .varint(curRun->len)
+           .varint(curRun->offset);
+      }
+    }
+    out.varint(slackSize);
+  }
+}
+
+void MetadataWriter::writeFile(AvroWriter& out, const TSK_FS_FILE* file) {
+  setRecordIDs();
+
+  out.hex(RecordID)
+     .hex(ParentID)
+     .hex(ChildrenID)
+     .num(Fs->offset)
+     .num(Fs->block_size)
+     .str(FsID)
+     .str(VolName)
+     .num(FsVolIndex)
+     .str(Dirs.back().path());
+
+  if (RecordFields & Fields::NAME) {
+    if (file->name) {
+      writeNameRecord(out.branch(1), file->name);
+    }
+    else {
+      out.branch(0);
+    }
+  }
+  if (hasUsableMeta(file)) {
+    writeMetaRecord(out.branch(1), file, file->fs_info);
+    markFileRuns(file);
+
+    if (BuildInodeMap) {
+      mapInode(file);
+    }
+
+    char link[INODE_ID_SIZE];
+    writeInodeID(link, NumVols, file->meta->addr);
+    out.branch(1).str(link, INODE_ID_SIZE);
+  }
+  else {
+    out.branch(0).branch(0);
+  }
+}
+
+void MetadataWriter::writeNameRecord(AvroWriter& out, const TSK_FS_NAME* n) {
+  out.str(nameFlags(n->flags))
+     .num(n->meta_addr)
+     .num(n->meta_seq)
+     .str(n->name_size ? n->name: nullptr)
+     .num(n->par_addr)
+     .num(n->par_seq)
+     .str(n->shrt_name_size ? n->shrt_name: nullptr)
+     .str(nameType(n->type));
+}
+
+void MetadataWriter::writeMetaRecord(AvroWriter& out, const TSK_FS_FILE* file, const TSK_FS_INFO* fs) {
+  // fields in the order of dirEntrySchema()
+  const TSK_FS_META* i = file->meta;
+  const bool meta = RecordFields & Fields::META,
+             times = RecordFields & Fields::TIMES;
+  out.num(i->addr);
+  if (times) {
+    writeTimestamp(out, i->atime, i->atime_nano);
+  }
+  if (meta) {
+    out.num(i->content_len);
+  }
+  if (times) {
+    writeTimestamp(out, i->crtime, i->crtime_nano);
+    writeTimestamp(out, i->ctime, i->ctime_nano);
+  }
+  if (meta) {
+    out.str(metaFlags(i->flags))
+       .num(i->gid);
+    if (i->link) {
+      out.branch(1).str(i->link);
+    }
+    else {
+      out.branch(0);
+    }
+  }
+  if (times) {
+    if (TSK_FS_TYPE_ISEXT(fs->ftype)) {
+      writeTimestamp(out.branch(1), i->time2.ext2.dtime, i->time2.ext2.dtime_nano);
+      out.branch(0);
+    }
+    else if (TSK_FS_TYPE_ISHFS(fs->ftype)) {
+      out.branch(0);
+      writeTimestamp(out.branch(1), i->time2.hfs.bkup_time, i->time2.hfs.bkup_time_nano);
+    }
+    else {
+      out.branch(0).branch(0);
+    }
+  }
+  if (meta) {
+    out.num(i->mode);
+  }
+  if (times) {
+    writeTimestamp(out, i->mtime, i->mtime_nano);
+  }
+  if (meta) {
+    out.num(i->nlink)
+       .num(i->seq)
+       .num(i->size)
+       .str(metaType(i->type))
+       .num(i->uid);
+  }
+
+  if (RecordFields & Fields::ATTRS) {
+    collectAttrs(file);
+    out.beginArray(Attrs.size());
+    for (const TSK_FS_ATTR* a: Attrs) {
+      writeAttr(out, i->addr, a);
+    }
+    out.endArray();
   }
-  out << "}";
+}
+
+void MetadataWriter::writeAttr(AvroWriter& out, TSK_INUM_T addr, const TSK_FS_ATTR* a) {
+  out.str(attrFlags(a->flags))
+     .num(a->id)
+     .str(a->name)
+     .num(a->size)
+     .num(a->type)
+     .num(a->rd.buf_size)
+     .num(a->nrd.allocsize)
+     .num(a->nrd.compsize)
+     .num(a->nrd.initsize)
+     .num(a->nrd.skiplen);
+
+  if (RecordFields & Fields::RD_BUF) {
+    if (a->flags & TSK_FS_ATTR_RES && a->rd.buf_size && a->rd.buf) {
+      out.branch(1).bytes(a->rd.buf, std::min(a->rd.buf_size, (size_t)a->size));
+    }
+    else {
+      out.branch(0);
+    }
+  }
+
+  if (!(RecordFields & Fields::RUNS)) {
+    return;
+  }
+  if (a->flags & TSK_FS_ATTR_NONRES) {
+    const uint64_t slackSize = markAttrRuns(addr, a);
+    uint64_t numRuns = 0;
+    for (TSK_FS_ATTR_RUN* curRun = a->nrd.run; curRun; curRun = curRun->next) {
+      if (TSK_FS_ATTR_RUN_FLAG_FILLER != curRun->flags) {
+        ++numRuns;
+      }
+    }
+    out.branch(1).beginArray(numRuns);
+    for (TSK_FS_ATTR_RUN* curRun = a->nrd.run; curRun; curRun = curRun->next) {
+      if (TSK_FS_ATTR_RUN_FLAG_FILLER != curRun->flags) {
+        out.num(curRun->addr)
+           .num(curRun->flags)
+           .num(curRun->len)
+           .num(curRun->offset);
+      }
+    }
+    out.endArray().branch(1).num(slackSize);
+  }
+  else {
+    out.branch(0).branch(0);
+  }
+}
+
+void MetadataWriter::writeBinaryRecord() {
+  unsigned char len[MAX_VINT_SIZE];
+  const unsigned int lenSize = vintEncode(len, Binary.size());
+  Out.write(reinterpret_cast<const char*>(len), lenSize);
+  Out.write(reinterpret_cast<const char*>(Binary.data()), Binary.size());
+  DataWritten += lenSize + Binary.size();
+  OutputOffset += lenSize + Binary.size();
 }
 
 void MetadataWriter::markDataRun(uint64_t beg, uint64_t end, uint64_t offset, TSK_INUM_T addr, uint32_t attrID, bool slack) {
+  if (!needRuns()) {
+    return;
+  }
   beg = std::max(beg, FSBeg); // just in case
   end = std::min(end, FSEnd);
   if (beg < end) {
-    std::get<3>(CurAllocatedItr->second) += std::make_pair(
-      boost::icl::discrete_interval<uint64_t>::right_open(beg, end),
-      AttrSet{{AttrRunInfo{addr, attrID, slack, beg, offset}}}
-    );
+    std::get<3>(CurAllocatedItr->second).push_back(RunRecord{beg, end, addr, beg, offset, CurAllocatedItr->first, attrID, slack});
+    RunBytes += sizeof(RunRecord);
   }
 }
 
@@ -819,17 +2092,31 @@ void MetadataWriter::flushUnallocated() {
 
   const unsigned int fieldWidth = std::log10(Fs->block_count) + 1;
 
+  if (BITMAP == UCSource) {
+    GapWalk gaps{this, fieldWidth, &name, 0, 0};
+    if (tsk_fs_block_walk(Fs, Fs->first_block, Fs->last_block,
+                          (TSK_FS_BLOCK_WALK_FLAG_ENUM)(TSK_FS_BLOCK_WALK_FLAG_UNALLOC | TSK_FS_BLOCK_WALK_FLAG_AONLY),
+                          addGapBlock, &gaps))
+    {
+      tsk_error_reset(); // write what it got to
+    }
+    processUnallocatedFragment(gaps.Beg, gaps.End, fieldWidth, name);
+    return;
+  }
+
   TSK_DADDR_T start = (Fs->first_block * Fs->block_size) + Fs->offset;
 
 //  std::cerr << "processing unallocated" << std::endl;
-  const auto& partition = std::get<3>(AllocatedRuns[NumVols]);
+  if (MaxMemory) {
+    spillRuns(); // the fragments are read from the spills, so that spilling more as we go is safe
+  }
   // iterate over the allocated extents
   // start is the end of the last allocated extent, end is the beginning of the next,
   // so we need to do one more round after the loop completes
-  for (auto nextFrag(partition.begin()); nextFrag != partition.end(); ++nextFrag) {
-    processUnallocatedFragment((start - Fs->offset) / Fs->block_size, (nextFrag->first.lower() - Fs->offset) / Fs->block_size, fieldWidth, name);
-    start = nextFrag->first.upper();
-  }
+  forEachFragment([&](uint32_t, uint64_t beg, uint64_t end, const AttrSet&) {
+    processUnallocatedFragment((start - Fs->offset) / Fs->block_size, (beg - Fs->offset) / Fs->block_size, fieldWidth, name);
+    start = end;
+  }, NumVols);
   processUnallocatedFragment((start - Fs->offset) / Fs->block_size, Fs->last_block, fieldWidth, name);
 //  std::cerr << "done processing unallocated" << std::endl;
 
@@ -837,6 +2124,16 @@ void MetadataWriter::flushUnallocated() {
   // writeSequence(Out, UnallocatedRuns.begin(), UnallocatedRuns.end(), ", ");
   // Out << "]\n";
 }
+
+TSK_WALK_RET_ENUM MetadataWriter::addGapBlock(const TSK_FS_BLOCK* block, void* ptr) {
+  GapWalk& gaps(*static_cast<GapWalk*>(ptr));
+  if (block->addr != gaps.End) {
+    gaps.Walker->processUnallocatedFragment(gaps.Beg, gaps.End, gaps.FieldWidth, *gaps.Name); // does nothing if empty
+    gaps.Beg = block->addr;
+  }
+  gaps.End = block->addr + 1;
+  return TSK_WALK_CONT;
+}
 /*************************************************************************/
 
 FileWriter::FileWriter(std::ostream& out):
@@ -0,0 +1,41 @@
+// Microbenchmark of TimestampFormatter against the formatting it replaced:
+// a directory's worth of files sharing a few timestamps. Not part of the
+// tests; build it with "scons build/test/bench_timestamp".
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "legacytimestamp.h"
+#include "util.h"
+
+int main() {
+  const unsigned int n = 1000000;
+  const uint32_t base = 1340828652;
+
+  auto start = std::chrono::steady_clock::now();
+  size_t legacyBytes = 0;
+  for (unsigned int i = 0; i < n; ++i) {
+    legacyBytes += legacyTimestamp(base + i / 64, (i % 7) * 1000100).size();
+  }
+  auto legacyTime = std::chrono::steady_clock::now() - start;
+
+  TimestampFormatter fmt;
+  char buf[TimestampFormatter::MAX_SIZE];
+  start = std::chrono::steady_clock::now();
+  size_t newBytes = 0;
+  for (unsigned int i = 0; i < n; ++i) {
+    newBytes += fmt.format(buf, base + i / 64, (i % 7) * 1000100);
+  }
+  auto newTime = std::chrono::steady_clock::now() - start;
+
+  std::cout << "timestamps: legacy "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(legacyTime).count() / n << "ns/call, "
+            << "TimestampFormatter "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(newTime).count() / n << "ns/call" << std::endl;
+  if (legacyBytes != newBytes) {
+    std::cerr << "output differs: " << legacyBytes << " bytes, then " << newBytes << std::endl;
+    return 1;
+  }
+  return 0;
+}
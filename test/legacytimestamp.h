@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <sstream>
+#include <string>
+
+// the strftime/stringstream implementation formatTimestamp() used to have
+inline std::string legacyTimestamp(uint32_t unix, uint32_t ns) {
+  std::string ret;
+  time_t ts = unix;
+  tm* tmPtr = gmtime(&ts);
+  char tbuf[100];
+  size_t len = strftime(tbuf, 100, "%FT%T", tmPtr);
+  if (len) {
+    ret.append(tbuf);
+    if (ns) {
+      std::stringstream buf;
+      buf.setf(std::ios::fixed, std::ios::floatfield);
+      buf.precision(8);
+      buf << double(ns)/1000000000;
+      std::string frac = buf.str();
+      frac.erase(0, 1);
+      std::string::iterator zeroItr(frac.end());
+      --zeroItr;
+      while (zeroItr != frac.begin() && *zeroItr == '0') {
+        --zeroItr;
+      }
+      ++zeroItr;
+      frac.erase(zeroItr, frac.end());
+      ret.append(frac);
+    }
+    ret.append("Z");
+  }
+  return ret;
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+// A MetadataWriter fed made-up TSK structures, for the tests of what it
+// writes, without an image or TSK behind it.
+
+#include "walkers.h"
+
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct SyntheticFile {
+  TSK_FS_FILE     File;
+  TSK_FS_NAME     Name;
+  TSK_FS_META     Meta;
+  TSK_FS_ATTRLIST AttrList;
+  TSK_FS_ATTR     Attrs[2];
+  TSK_FS_ATTR_RUN Runs[3];
+  unsigned char   RdBuf[32];
+  std::string     NameStr,
+                  ShrtName,
+                  AttrName,
+                  Link;
+};
+
+inline void makeFile(SyntheticFile& x, TSK_FS_INFO* fs, const std::string& name, bool dir, uint64_t addr, unsigned int seed) {
+  x.NameStr = name;
+  x.ShrtName = name.substr(0, 8);
+  x.File.fs_info = fs;
+  x.File.name = &x.Name;
+  x.Name.name = const_cast<char*>(x.NameStr.c_str());
+  x.Name.name_size = x.NameStr.size();
+  x.Name.shrt_name = const_cast<char*>(x.ShrtName.c_str());
+  x.Name.shrt_name_size = x.ShrtName.size();
+  x.Name.meta_addr = addr;
+  x.Name.meta_seq = seed % 7 == 6 ? seed + 1: seed; // the inode's been reused since
+  x.Name.par_addr = 5;
+  x.Name.par_seq = 1;
+  x.Name.type = dir ? TSK_FS_NAME_TYPE_DIR: TSK_FS_NAME_TYPE_REG;
+  x.Name.flags = seed % 5 == 4 ? TSK_FS_NAME_FLAG_UNALLOC: TSK_FS_NAME_FLAG_ALLOC;
+  if (seed % 9 == 8) {
+    return; // name only, no metadata
+  }
+  x.File.meta = &x.Meta;
+  x.Meta.addr = addr;
+  x.Meta.type = dir ? TSK_FS_META_TYPE_DIR: TSK_FS_META_TYPE_REG;
+  x.Meta.flags = (TSK_FS_META_FLAG_ENUM)((seed % 5 == 4 ? TSK_FS_META_FLAG_UNALLOC: TSK_FS_META_FLAG_ALLOC) | TSK_FS_META_FLAG_USED);
+  x.Meta.mode = (TSK_FS_META_MODE_ENUM)0755;
+  x.Meta.nlink = 1 + seed % 2;
+  x.Meta.size = 1000 + seed * 77;
+  x.Meta.uid = seed;
+  x.Meta.gid = 7;
+  x.Meta.atime = 1344312000 + seed;
+  x.Meta.atime_nano = seed * 123456789u % 1000000000u;
+  x.Meta.mtime = 1340828652;
+  x.Meta.mtime_nano = (seed % 4) * 250000000u;
+  x.Meta.crtime = 1340828653 + seed * 86400 * 33;
+  x.Meta.time2.ext2.dtime = seed % 2 ? 1400000000: 0;
+  x.Meta.time2.ext2.dtime_nano = 5;
+  x.Meta.seq = seed;
+  x.Meta.content_len = 8;
+  if (seed % 4 == 3) {
+    x.Link = "../target";
+    x.Meta.link = const_cast<char*>(x.Link.c_str());
+  }
+  x.Meta.attr = &x.AttrList;
+  x.Meta.attr_state = TSK_FS_META_ATTR_STUDIED;
+  x.AttrList.head = &x.Attrs[0];
+
+  TSK_FS_ATTR& res(x.Attrs[0]);
+  res.flags = (TSK_FS_ATTR_FLAG_ENUM)(TSK_FS_ATTR_INUSE | TSK_FS_ATTR_RES);
+  res.type = (TSK_FS_ATTR_TYPE_ENUM)48;
+  res.id = 1;
+  res.size = 20 + seed % 10;
+  for (unsigned int i = 0; i < sizeof(x.RdBuf); ++i) {
+    x.RdBuf[i] = i * 37 + seed;
+  }
+  res.rd.buf = x.RdBuf;
+  res.rd.buf_size = sizeof(x.RdBuf);
+  res.next = &x.Attrs[1];
+
+  TSK_FS_ATTR& nonres(x.Attrs[1]);
+  nonres.flags = (TSK_FS_ATTR_FLAG_ENUM)(TSK_FS_ATTR_INUSE | TSK_FS_ATTR_NONRES);
+  nonres.type = (TSK_FS_ATTR_TYPE_ENUM)128;
+  nonres.id = 3;
+  if (seed % 2) {
+    x.AttrName = "stream";
+    nonres.name = const_cast<char*>(x.AttrName.c_str());
+  }
+  nonres.size = nonres.nrd.initsize = x.Meta.size;
+  nonres.nrd.allocsize = 4096 * 3;
+  nonres.nrd.skiplen = seed % 4 == 1 ? 100: 0;
+  nonres.nrd.run = &x.Runs[0];
+  x.Runs[0].addr = 100 + seed * 10;
+  x.Runs[0].len = 1;
+  x.Runs[0].next = &x.Runs[1];
+  x.Runs[1].addr = 5000 + seed * 10;
+  x.Runs[1].len = 2;
+  x.Runs[1].offset = 1;
+  x.Runs[1].flags = seed % 6 == 5 ? TSK_FS_ATTR_RUN_FLAG_SPARSE: TSK_FS_ATTR_RUN_FLAG_NONE;
+  x.Runs[1].next = &x.Runs[2];
+  x.Runs[2].len = 1;
+  x.Runs[2].offset = 3;
+  x.Runs[2].flags = TSK_FS_ATTR_RUN_FLAG_FILLER;
+}
+
+struct Listing {
+  Listing(const std::string& path, const std::string& name, bool dir, bool noAddr = false):
+    Path(path), Name(name), Dir(dir), NoAddr(noAddr) {}
+
+  std::string Path;
+  std::string Name;
+  bool        Dir;
+  bool        NoAddr; // a deleted name TSK gives as meta_addr 0, for the walks of SyntheticWalker
+};
+
+// a small tree, in the depth-first order TSK walks it
+const Listing TREE[] = {
+  {"", "Documents", true},
+  {"Documents/", "notes.txt", false},
+  {"Documents/", "sub", true},
+  {"Documents/sub/", "a", false},
+  {"Documents/sub/", "b", false},
+  {"Documents/", "after", false},
+  {"", "f0", false},
+  {"", "f1", false},
+  {"", "f2", false},
+  {"", "f3", false},
+  {"", "f4", false},
+  {"", "f5", false}
+};
+
+// drives MetadataWriter directly, without an image behind it
+class SyntheticWalker: public MetadataWriter {
+public:
+  SyntheticWalker(std::ostream& out, TSK_IMG_INFO* img, OUTPUT_FORMAT format, unsigned int fields = Fields::ALL): MetadataWriter(out) {
+    m_img_info = img;
+    DiskSize = img->size;
+    SectorSize = img->sector_size;
+    resetPartitionRange();
+    setFields(fields);
+    setOutputFormat(format);
+  }
+
+  template<size_t N>
+  void setTree(const Listing (&tree)[N]) {
+    Tree = tree;
+    TreeSize = N;
+  }
+
+  // as TSK's walk of fs would, in the tree of setTree(), unless
+  // TreeWalk or the inode scan does it
+  void walkFs(TSK_FS_INFO& fs) {
+    if (TSK_FILTER_CONT == filterFs(&fs)) {
+      std::string path;
+      std::vector<TSK_INUM_T> seen{fs.root_inum};
+      walkDirAt(fs.root_inum, path, seen);
+    }
+  }
+
+protected:
+  SyntheticWalker(std::ostream& out, const SyntheticWalker& parent): MetadataWriter(out, parent), Tree(parent.Tree), TreeSize(parent.TreeSize) {}
+
+  const Listing* Tree = TREE;
+  size_t TreeSize = sizeof(TREE) / sizeof(TREE[0]);
+
+  void makeEntry(SyntheticFile& x, unsigned int seed) const {
+    const Listing& l(Tree[seed]);
+    makeFile(x, Fs, l.Name, l.Dir, l.NoAddr ? 0: 100 + seed, seed);
+  }
+
+  virtual void walkDirAt(TSK_INUM_T, std::string& path, std::vector<TSK_INUM_T>& seen) {
+    std::deque<SyntheticFile> files;
+    for (unsigned int seed = 0; seed < TreeSize; ++seed) {
+      if (Tree[seed].Path == path) {
+        files.emplace_back();
+        SyntheticFile& x(files.back());
+        makeEntry(x, seed);
+        if (x.File.meta && ((!x.Name.meta_addr && !(x.Name.flags & TSK_FS_NAME_FLAG_ALLOC)) || x.Meta.seq != x.Name.meta_seq)) {
+          x.File.meta = nullptr; // as tsk_fs_dir_get() gives it
+        }
+        walkFile(&x.File, path, seen);
+      }
+    }
+  }
+
+  virtual bool walkNamesAt(TSK_INUM_T addr, const TSK_FS_NAME* n, std::string& path, std::vector<TSK_INUM_T>& seen, NameList& names) {
+    if (n) {
+      SyntheticFile dir{};
+      makeEntry(dir, addr - 100);
+      if (!dir.File.meta) {
+        return false;
+      }
+      if (!entersDir(n, dir.File.meta)) {
+        return true;
+      }
+    }
+    std::deque<SyntheticFile> files;
+    uint32_t dirIndex = NO_DIR;
+    for (unsigned int seed = 0; seed < TreeSize; ++seed) {
+      if (Tree[seed].Path == path) {
+        files.emplace_back();
+        makeEntry(files.back(), seed);
+        walkName(&files.back().Name, path, seen, names, dirIndex);
+      }
+    }
+    return true;
+  }
+
+  virtual bool walkInodes(TSK_FS_INFO*, TSK_INUM_T first, TSK_INUM_T last, NameList& names) {
+    // the ones without metadata are left for tsk_fs_file_open_meta(), which can't load them either
+    for (unsigned int seed = 0; seed < TreeSize; ++seed) {
+      if (Tree[seed].NoAddr || 100 + seed < first || 100 + seed > last) {
+        continue;
+      }
+      SyntheticFile x{};
+      makeEntry(x, seed);
+      x.File.name = nullptr;
+      if (x.File.meta && TSK_WALK_STOP == joinInode(&x.File, &names)) {
+        break;
+      }
+    }
+    return true;
+  }
+
+  virtual MetadataWriter* newWorker(std::ostream& out) const { return new SyntheticWalker(out, *this); }
+  virtual TSK_FS_INFO* openFs(TSK_OFF_T, TSK_FS_TYPE_ENUM) const { return Fs; } // made-up, so it can be shared
+  virtual void closeFs(TSK_FS_INFO*) const {}
+};
+
+inline void initImage(TSK_IMG_INFO& img, TSK_FS_INFO& fs) {
+  std::memset(&img, 0, sizeof(img));
+  img.size = 1ull << 30;
+  img.sector_size = 512;
+  std::memset(&fs, 0, sizeof(fs));
+  fs.img_info = &img;
+  fs.offset = 1048576;
+  fs.block_size = 4096;
+  fs.block_count = 100000;
+  fs.last_block = 99999;
+  fs.ftype = TSK_FS_TYPE_EXT4;
+  fs.fs_id_used = 4;
+  fs.fs_id[0] = 0xf7;
+  fs.fs_id[1] = 0x0c;
+  fs.fs_id[2] = 0xb6;
+  fs.fs_id[3] = 0x28;
+}
+
+template<size_t N>
+void walkTree(SyntheticWalker& walker, TSK_FS_INFO& fs, const Listing (&tree)[N]) {
+  walker.filterFs(&fs);
+  std::deque<SyntheticFile> files;
+  unsigned int seed = 0;
+  for (const Listing& l: tree) {
+    files.emplace_back();
+    makeFile(files.back(), &fs, l.Name, l.Dir, 100 + seed, seed);
+    walker.processFile(&files.back().File, l.Path.c_str());
+    ++seed;
+  }
+}
+
+inline void walkTree(SyntheticWalker& walker, TSK_FS_INFO& fs) {
+  walkTree(walker, fs, TREE);
+}
+
+inline std::string walkTree(TSK_IMG_INFO& img, TSK_FS_INFO& fs, LbtTskAuto::OUTPUT_FORMAT format, unsigned int fields = Fields::ALL) {
+  std::stringstream out;
+  SyntheticWalker walker(out, &img, format, fields);
+  walkTree(walker, fs);
+  return out.str();
+}
@@ -0,0 +1,108 @@
+#include <scope/test.h>
+
+#include "avro.h"
+
+#include <limits>
+#include <sstream>
+
+namespace {
+  std::string encoded(int64_t v) {
+    AvroWriter out;
+    out.num(v);
+    return std::string(reinterpret_cast<const char*>(out.data()), out.size());
+  }
+
+  int64_t readLong(const std::string& s, size_t& pos) {
+    uint64_t zz = 0;
+    unsigned int shift = 0;
+    unsigned char b;
+    do {
+      b = s[pos++];
+      zz |= uint64_t(b & 0x7f) << shift;
+      shift += 7;
+    } while (b & 0x80);
+    return static_cast<int64_t>(zz >> 1) ^ -static_cast<int64_t>(zz & 1);
+  }
+
+  std::string readString(const std::string& s, size_t& pos) {
+    const int64_t len = readLong(s, pos);
+    std::string ret(s.substr(pos, len));
+    pos += len;
+    return ret;
+  }
+}
+
+SCOPE_TEST(testAvroLongEncoding) {
+  SCOPE_ASSERT_EQUAL(std::string("\x00", 1), encoded(0));
+  SCOPE_ASSERT_EQUAL("\x01", encoded(-1));
+  SCOPE_ASSERT_EQUAL("\x02", encoded(1));
+  SCOPE_ASSERT_EQUAL("\x7f", encoded(-64));
+  SCOPE_ASSERT_EQUAL("\x80\x01", encoded(64));
+  SCOPE_ASSERT_EQUAL("\xfe\xff\xff\xff\x0f", encoded(2147483647));
+  SCOPE_ASSERT_EQUAL("\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", encoded(std::numeric_limits<int64_t>::min()));
+
+  // unsigned values keep their bits
+  AvroWriter out;
+  out.num(std::numeric_limits<uint64_t>::max());
+  SCOPE_ASSERT_EQUAL("\x01", std::string(reinterpret_cast<const char*>(out.data()), out.size()));
+}
+
+SCOPE_TEST(testAvroStringsAndArrays) {
+  AvroWriter out;
+  out.str("foo").str(nullptr).boolean(true).beginArray(2).num(3).num(4).endArray().beginArray(0).endArray();
+  SCOPE_ASSERT_EQUAL(std::string("\x06" "foo" "\x00" "\x01" "\x04\x06\x08\x00" "\x00", 11),
+                     std::string(reinterpret_cast<const char*>(out.data()), out.size()));
+}
+
+SCOPE_TEST(testAvroContainer) {
+  const std::string schema("{\"type\":\"long\"}");
+  std::stringstream buf;
+  {
+    AvroContainer avro(buf, schema, 16);
+    for (int64_t i = 0; i < 100; ++i) {
+      avro.record().num(i * 1000);
+      avro.endRecord();
+    }
+  }
+  const std::string s(buf.str());
+  SCOPE_ASSERT_EQUAL(std::string("Obj\x01"), s.substr(0, 4));
+
+  size_t pos = 4;
+  SCOPE_ASSERT_EQUAL(2, readLong(s, pos));
+  SCOPE_ASSERT_EQUAL("avro.schema", readString(s, pos));
+  SCOPE_ASSERT_EQUAL(schema, readString(s, pos));
+  SCOPE_ASSERT_EQUAL("avro.codec", readString(s, pos));
+  SCOPE_ASSERT_EQUAL("null", readString(s, pos));
+  SCOPE_ASSERT_EQUAL(0, readLong(s, pos));
+  const std::string sync(s.substr(pos, 16));
+  pos += 16;
+
+  int64_t expected = 0;
+  unsigned int blocks = 0;
+  while (pos < s.size()) {
+    const int64_t count = readLong(s, pos),
+                  size = readLong(s, pos);
+    const size_t  end = pos + size;
+    for (int64_t i = 0; i < count; ++i) {
+      SCOPE_ASSERT_EQUAL(expected, readLong(s, pos));
+      expected += 1000;
+    }
+    SCOPE_ASSERT_EQUAL(end, pos);
+    SCOPE_ASSERT_EQUAL(sync, s.substr(pos, 16));
+    pos += 16;
+    ++blocks;
+  }
+  SCOPE_ASSERT_EQUAL(100000, expected);
+  SCOPE_ASSERT(blocks > 1);
+}
+
+SCOPE_TEST(testAvroContainerEmpty) {
+  std::stringstream buf;
+  {
+    AvroContainer avro(buf, INODE_MAP_SCHEMA);
+  }
+  const std::string s(buf.str());
+  // header only, with no empty blocks
+  SCOPE_ASSERT_EQUAL(s.size() - 16, s.rfind(s.substr(s.size() - 16)));
+  SCOPE_ASSERT_EQUAL(std::string("Obj\x01"), s.substr(0, 4));
+}
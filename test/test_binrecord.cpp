@@ -0,0 +1,216 @@
+#include <scope/test.h>
+
+#include "synthetic.h"
+#include "binrecord.h"
+
+#include <cstring>
+#include <deque>
+#include <sstream>
+
+namespace {
+  std::string asHex(const std::string& bytes) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data());
+    return bytesAsString(p, p + bytes.size());
+  }
+
+  // TSK structures rebuilt from a decoded record
+  struct RebuiltFile {
+    TSK_FS_FILE                  File;
+    TSK_FS_NAME                  Name;
+    TSK_FS_META                  Meta;
+    TSK_FS_ATTRLIST              AttrList;
+    std::vector<TSK_FS_ATTR>     Attrs;
+    std::deque<TSK_FS_ATTR_RUN>  Runs;
+  };
+
+  void rebuild(const BinRecord::FileInfo& rec, TSK_FS_INFO* fs, RebuiltFile& x) {
+    std::memset(&x.File, 0, sizeof(x.File));
+    std::memset(&x.Name, 0, sizeof(x.Name));
+    std::memset(&x.Meta, 0, sizeof(x.Meta));
+    std::memset(&x.AttrList, 0, sizeof(x.AttrList));
+    x.File.fs_info = fs;
+    if (rec.Contents & BinRecord::HAS_NAME) {
+      const BinRecord::NameInfo& n(rec.Name);
+      x.File.name = &x.Name;
+      x.Name.flags = (TSK_FS_NAME_FLAG_ENUM)n.Flags;
+      x.Name.meta_addr = n.MetaAddr;
+      x.Name.meta_seq = n.MetaSeq;
+      x.Name.name = const_cast<char*>(n.Name.c_str());
+      x.Name.name_size = n.Name.size();
+      x.Name.par_addr = n.ParAddr;
+      x.Name.par_seq = n.ParSeq;
+      x.Name.shrt_name = const_cast<char*>(n.ShrtName.c_str());
+      x.Name.shrt_name_size = n.ShrtName.size();
+      x.Name.type = (TSK_FS_NAME_TYPE_ENUM)n.Type;
+    }
+    if (rec.Contents & BinRecord::HAS_META) {
+      const BinRecord::MetaInfo& m(rec.Meta);
+      x.File.meta = &x.Meta;
+      x.Meta.addr = m.Addr;
+      x.Meta.atime = m.Atime;
+      x.Meta.atime_nano = m.AtimeNano;
+      x.Meta.content_len = m.ContentLen;
+      x.Meta.crtime = m.Crtime;
+      x.Meta.crtime_nano = m.CrtimeNano;
+      x.Meta.ctime = m.Ctime;
+      x.Meta.ctime_nano = m.CtimeNano;
+      // meta is only written when it's usable, which without its flags it wouldn't be
+      x.Meta.flags = (m.Contents & BinRecord::HAS_FIELDS) ? (TSK_FS_META_FLAG_ENUM)m.Flags: TSK_FS_META_FLAG_USED;
+      x.Meta.gid = m.Gid;
+      if (m.Contents & BinRecord::HAS_LINK) {
+        x.Meta.link = const_cast<char*>(m.Link.c_str());
+      }
+      fs->ftype = (m.Contents & BinRecord::HAS_DTIME) ? TSK_FS_TYPE_EXT4: TSK_FS_TYPE_NTFS;
+      x.Meta.time2.ext2.dtime = m.Time2;
+      x.Meta.time2.ext2.dtime_nano = m.Time2Nano;
+      x.Meta.mode = (TSK_FS_META_MODE_ENUM)m.Mode;
+      x.Meta.mtime = m.Mtime;
+      x.Meta.mtime_nano = m.MtimeNano;
+      x.Meta.nlink = m.Nlink;
+      x.Meta.seq = m.Seq;
+      x.Meta.size = m.Size;
+      x.Meta.type = (TSK_FS_META_TYPE_ENUM)m.Type;
+      x.Meta.uid = m.Uid;
+      x.Meta.attr = &x.AttrList;
+      x.Meta.attr_state = TSK_FS_META_ATTR_STUDIED;
+
+      x.Attrs.assign(m.Attrs.size(), TSK_FS_ATTR());
+      x.Runs.clear();
+      for (unsigned int i = 0; i < m.Attrs.size(); ++i) {
+        const BinRecord::AttrInfo& a(m.Attrs[i]);
+        TSK_FS_ATTR& attr(x.Attrs[i]);
+        attr.flags = (TSK_FS_ATTR_FLAG_ENUM)a.Flags;
+        attr.id = a.ID;
+        attr.name = a.Name.empty() ? nullptr: const_cast<char*>(a.Name.c_str());
+        attr.size = a.Size;
+        attr.type = (TSK_FS_ATTR_TYPE_ENUM)a.Type;
+        attr.rd.buf_size = a.RdBufSize;
+        attr.nrd.allocsize = a.NrdAllocSize;
+        attr.nrd.compsize = a.NrdCompSize;
+        attr.nrd.initsize = a.NrdInitSize;
+        attr.nrd.skiplen = a.NrdSkipLen;
+        if (a.Contents & BinRecord::HAS_RD_BUF) {
+          attr.rd.buf = reinterpret_cast<uint8_t*>(const_cast<char*>(a.RdBuf.data()));
+        }
+        TSK_FS_ATTR_RUN* prev = nullptr;
+        for (const BinRecord::RunInfo& r: a.Runs) {
+          x.Runs.emplace_back();
+          TSK_FS_ATTR_RUN& run(x.Runs.back());
+          run.addr = r.Addr;
+          run.flags = (TSK_FS_ATTR_RUN_FLAG_ENUM)r.Flags;
+          run.len = r.Len;
+          run.offset = r.Offset;
+          run.next = nullptr;
+          if (prev) {
+            prev->next = &run;
+          }
+          else {
+            attr.nrd.run = &run;
+          }
+          prev = &run;
+        }
+        attr.next = i + 1 < m.Attrs.size() ? &x.Attrs[i + 1]: nullptr;
+      }
+      x.AttrList.head = x.Attrs.empty() ? nullptr: &x.Attrs[0];
+    }
+  }
+}
+
+// decodes the binary output and feeds it back through the JSON writer, which
+// should come up with the same JSON as the original walk
+void checkRoundTrip(unsigned int fields) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  const std::string json = walkTree(img, fs, LbtTskAuto::JSON, fields),
+                    binary = walkTree(img, fs, LbtTskAuto::BINARY, fields);
+  SCOPE_ASSERT(binary.size() < json.size());
+
+  TSK_IMG_INFO decodedImg;
+  TSK_FS_INFO  decodedFs;
+  initImage(decodedImg, decodedFs);
+
+  std::stringstream out;
+  SyntheticWalker   replay(out, &decodedImg, LbtTskAuto::JSON, fields);
+  RebuiltFile       file;
+
+  BinRecord::Reader reader(binary.data(), binary.size());
+  SCOPE_ASSERT(reader.next());
+  SCOPE_ASSERT_EQUAL(BinRecord::FS, reader.type());
+  const BinRecord::FsInfo& fsRec(reader.fs());
+  SCOPE_ASSERT_EQUAL(fs.offset, fsRec.ByteOffset);
+  SCOPE_ASSERT_EQUAL(fs.block_size, fsRec.BlockSize);
+  SCOPE_ASSERT_EQUAL(std::string("\xf7\x0c\xb6\x28", 4), fsRec.FsID);
+  SCOPE_ASSERT_EQUAL(0u, fsRec.VolIndex);
+  decodedFs.offset = fsRec.ByteOffset;
+  decodedFs.block_size = fsRec.BlockSize;
+  replay.filterFs(&decodedFs);
+
+  unsigned int num = 0;
+  while (reader.next()) {
+    SCOPE_ASSERT_EQUAL(BinRecord::FILE, reader.type());
+    const BinRecord::FileInfo& rec(reader.file());
+    SCOPE_ASSERT_EQUAL(rec.Path, TREE[num].Path);
+    rebuild(rec, &decodedFs, file);
+    replay.processFile(&file.File, rec.Path.c_str());
+    ++num;
+  }
+  SCOPE_ASSERT_EQUAL(sizeof(TREE) / sizeof(TREE[0]), num);
+  SCOPE_ASSERT_EQUAL(json, out.str());
+}
+
+SCOPE_TEST(testBinaryRecordRoundTrip) {
+  checkRoundTrip(Fields::ALL);
+}
+
+SCOPE_TEST(testBinaryRecordFieldsRoundTrip) {
+  checkRoundTrip(Fields::NAME | Fields::META | Fields::TIMES);
+  checkRoundTrip(Fields::TIMES | Fields::ATTRS);
+  checkRoundTrip(Fields::META | Fields::ATTRS | Fields::RUNS);
+  checkRoundTrip(Fields::ATTRS | Fields::RD_BUF);
+  checkRoundTrip(0);
+}
+
+SCOPE_TEST(testBinaryRecordIDs) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  const std::string binary = walkTree(img, fs, LbtTskAuto::BINARY);
+  BinRecord::Reader reader(binary.data(), binary.size());
+  SCOPE_ASSERT(reader.next()); // FS
+  SCOPE_ASSERT(reader.next()); // Documents
+  SCOPE_ASSERT_EQUAL("000000", asHex(reader.file().ID));
+  SCOPE_ASSERT_EQUAL("0000", asHex(reader.file().Parent));
+  SCOPE_ASSERT(reader.next()); // Documents/notes.txt
+  SCOPE_ASSERT_EQUAL("00010000", asHex(reader.file().ID));
+  SCOPE_ASSERT_EQUAL("000000", asHex(reader.file().Parent));
+}
+
+SCOPE_TEST(testBinaryRecordTruncated) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  const std::string binary = walkTree(img, fs, LbtTskAuto::BINARY);
+  for (size_t len = 0; len < binary.size(); len += 7) {
+    BinRecord::Reader reader(binary.data(), len);
+    unsigned int num = 0;
+    while (reader.next()) {
+      ++num;
+    }
+    SCOPE_ASSERT(num <= sizeof(TREE) / sizeof(TREE[0]));
+  }
+}
+
+SCOPE_TEST(testBinaryTombstone) {
+  const unsigned char data[] = {4, BinRecord::TOMBSTONE, 1, 20, 3, 5, BinRecord::TOMBSTONE, 1, 20, 3, 0};
+  BinRecord::Reader reader(data, sizeof(data));
+  SCOPE_ASSERT(reader.next());
+  SCOPE_ASSERT_EQUAL(BinRecord::TOMBSTONE, reader.type());
+  SCOPE_ASSERT_EQUAL(1u, reader.tombstone().VolIndex);
+  SCOPE_ASSERT_EQUAL(20u, reader.tombstone().Addr);
+  SCOPE_ASSERT_EQUAL(3u, reader.tombstone().Seq);
+  SCOPE_ASSERT(!reader.next()); // trailing byte
+}
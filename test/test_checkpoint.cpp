@@ -0,0 +1,37 @@
+#include <scope/test.h>
+
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+
+SCOPE_TEST(testCheckpointRoundTrip) {
+  Checkpoint cp;
+  cp.Records = 123456789012ull;
+  cp.DataWritten = 98765;
+  cp.Offset = 99999;
+  cp.NumVols = 3;
+  cp.LastID = std::string("\x01\x02\x00\xff\x10", 5);
+  cp.Path = "my docs/new\nline/";
+  cp.Dirs.emplace_back("", 4);
+  cp.Dirs.emplace_back("part-0-2/", 7);
+  cp.Dirs.emplace_back("part-0-2/my docs/new\nline/", 0);
+
+  const std::string file("test_checkpoint.tmp");
+  SCOPE_ASSERT(cp.save(file));
+
+  Checkpoint got;
+  SCOPE_ASSERT(got.load(file));
+  SCOPE_ASSERT_EQUAL(cp.Records, got.Records);
+  SCOPE_ASSERT_EQUAL(cp.DataWritten, got.DataWritten);
+  SCOPE_ASSERT_EQUAL(cp.Offset, got.Offset);
+  SCOPE_ASSERT_EQUAL(cp.NumVols, got.NumVols);
+  SCOPE_ASSERT(cp.LastID == got.LastID);
+  SCOPE_ASSERT_EQUAL(cp.Path, got.Path);
+  SCOPE_ASSERT(cp.Dirs == got.Dirs);
+
+  std::ofstream(file.c_str()) << "fsrip-checkpoint 1\nrecords 5\n";
+  SCOPE_ASSERT(!got.load(file));
+  std::remove(file.c_str());
+  SCOPE_ASSERT(!got.load(file));
+}
@@ -59,3 +59,18 @@ SCOPE_TEST(testAttrFlags) {
   SCOPE_ASSERT_EQUAL("Recovered", attrFlags(128));
   SCOPE_ASSERT_EQUAL("In Use, Non-resident", attrFlags(3));
 }
+
+SCOPE_TEST(testFlagCombinations) {
+  SCOPE_ASSERT_EQUAL("", metaFlags(0));
+  SCOPE_ASSERT_EQUAL("Allocated, Deleted, Used, Unused, Compressed, Orphan", metaFlags(63));
+  SCOPE_ASSERT_EQUAL("", nameFlags(0));
+  SCOPE_ASSERT_EQUAL("Allocated, Deleted", nameFlags(3));
+  SCOPE_ASSERT_EQUAL("In Use, Non-resident, Resident, Encrypted, Compressed, Sparse, Recovered", attrFlags(0xff));
+}
+
+SCOPE_TEST(testUnnamedFlagBitsIgnored) {
+  SCOPE_ASSERT_EQUAL("Allocated, Used", metaFlags(5 | 64 | 0x80000000));
+  SCOPE_ASSERT_EQUAL("Deleted", nameFlags(2 | 4));
+  SCOPE_ASSERT_EQUAL("In Use", attrFlags(1 | 8));
+  SCOPE_ASSERT_EQUAL("Resident", attrFlags(4 | 256));
+}
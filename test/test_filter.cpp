@@ -0,0 +1,138 @@
+#include <scope/test.h>
+
+#include "filter.h"
+
+#include <cstring>
+
+namespace {
+  struct FilterFile {
+    TSK_FS_FILE File;
+    TSK_FS_NAME Name;
+    TSK_FS_META Meta;
+    std::string NameStr;
+
+    FilterFile(const std::string& name, TSK_FS_NAME_TYPE_ENUM type, bool alloc, TSK_OFF_T size, time_t mtime): NameStr(name) {
+      std::memset(&File, 0, sizeof(File));
+      std::memset(&Name, 0, sizeof(Name));
+      std::memset(&Meta, 0, sizeof(Meta));
+      File.name = &Name;
+      File.meta = &Meta;
+      Name.name = const_cast<char*>(NameStr.c_str());
+      Name.name_size = NameStr.size();
+      Name.type = type;
+      Name.flags = alloc ? TSK_FS_NAME_FLAG_ALLOC: TSK_FS_NAME_FLAG_UNALLOC;
+      Meta.flags = (TSK_FS_META_FLAG_ENUM)((alloc ? TSK_FS_META_FLAG_ALLOC: TSK_FS_META_FLAG_UNALLOC) | TSK_FS_META_FLAG_USED);
+      Meta.size = size;
+      Meta.mtime = mtime;
+      Meta.atime = mtime + 100;
+    }
+  };
+}
+
+SCOPE_TEST(testGlobMatch) {
+  SCOPE_ASSERT(RecordFilter::globMatch("*.doc", "a.doc"));
+  SCOPE_ASSERT(!RecordFilter::globMatch("*.doc", "a.docx"));
+  SCOPE_ASSERT(!RecordFilter::globMatch("*.doc", "dir/a.doc"));
+  SCOPE_ASSERT(RecordFilter::globMatch("home/*/a.doc", "home/joe/a.doc"));
+  SCOPE_ASSERT(!RecordFilter::globMatch("home/*/a.doc", "home/joe/x/a.doc"));
+  SCOPE_ASSERT(RecordFilter::globMatch("home/**/a.doc", "home/joe/x/a.doc"));
+  SCOPE_ASSERT(RecordFilter::globMatch("home/**/a.doc", "home/a.doc"));
+  SCOPE_ASSERT(RecordFilter::globMatch("home/**", "home/joe"));
+  SCOPE_ASSERT(RecordFilter::globMatch("??.txt", "ab.txt"));
+  SCOPE_ASSERT(!RecordFilter::globMatch("??.txt", "a.txt"));
+  SCOPE_ASSERT(RecordFilter::globMatch("[a-c]x", "bx"));
+  SCOPE_ASSERT(!RecordFilter::globMatch("[a-c]x", "dx"));
+  SCOPE_ASSERT(RecordFilter::globMatch("[!a-c]x", "dx"));
+  SCOPE_ASSERT(RecordFilter::globMatch("[]]", "]"));
+  SCOPE_ASSERT(RecordFilter::globMatch("a[b", "a[b"));
+}
+
+SCOPE_TEST(testGlobPrefixMatch) {
+  SCOPE_ASSERT(RecordFilter::globMatch("home/*/a.doc", "home/", true));
+  SCOPE_ASSERT(RecordFilter::globMatch("home/*/a.doc", "home/joe/", true));
+  SCOPE_ASSERT(!RecordFilter::globMatch("home/*/a.doc", "etc/", true));
+  SCOPE_ASSERT(!RecordFilter::globMatch("home/*/a.doc", "home/joe/x/", true));
+  SCOPE_ASSERT(RecordFilter::globMatch("home/**/a.doc", "home/joe/x/", true));
+  SCOPE_ASSERT(RecordFilter::globMatch("**/a.doc", "anything/", true));
+}
+
+SCOPE_TEST(testParseTypes) {
+  unsigned int types;
+  SCOPE_ASSERT(RecordFilter::parseTypes("file", types));
+  SCOPE_ASSERT_EQUAL(unsigned(RecordFilter::FILES), types);
+  SCOPE_ASSERT(RecordFilter::parseTypes("dir,link,other", types));
+  SCOPE_ASSERT_EQUAL(unsigned(RecordFilter::DIRS | RecordFilter::LINKS | RecordFilter::OTHERS), types);
+  SCOPE_ASSERT(!RecordFilter::parseTypes("file,", types));
+  SCOPE_ASSERT(!RecordFilter::parseTypes("files", types));
+}
+
+SCOPE_TEST(testParseTime) {
+  int64_t t;
+  SCOPE_ASSERT(RecordFilter::parseTime("1340828652", t));
+  SCOPE_ASSERT_EQUAL(1340828652, t);
+  SCOPE_ASSERT(RecordFilter::parseTime("2012-06-27T20:24:12Z", t));
+  SCOPE_ASSERT_EQUAL(1340828652, t);
+  SCOPE_ASSERT(RecordFilter::parseTime("2012-06-27", t));
+  SCOPE_ASSERT_EQUAL(1340755200, t);
+  SCOPE_ASSERT(RecordFilter::parseTime("1969-12-31", t));
+  SCOPE_ASSERT_EQUAL(-86400, t);
+  SCOPE_ASSERT(!RecordFilter::parseTime("2012-13-01", t));
+  SCOPE_ASSERT(!RecordFilter::parseTime("2012-06-27T20:24", t));
+  SCOPE_ASSERT(!RecordFilter::parseTime("yesterday", t));
+  SCOPE_ASSERT(!RecordFilter::parseTime("", t));
+}
+
+SCOPE_TEST(testRecordFilterMatches) {
+  FilterFile doc("a.doc", TSK_FS_NAME_TYPE_REG, true, 5000, 1340828652),
+             dir("docs", TSK_FS_NAME_TYPE_DIR, true, 4096, 1300000000),
+             gone("b.doc", TSK_FS_NAME_TYPE_REG, false, 10, 1340828652);
+
+  RecordFilter none;
+  SCOPE_ASSERT(none.empty());
+  SCOPE_ASSERT(none.matches(&doc.File, "home/"));
+
+  RecordFilter glob;
+  glob.setPathGlob("home/**/*.doc");
+  SCOPE_ASSERT(!glob.empty());
+  SCOPE_ASSERT(glob.prunesPaths());
+  SCOPE_ASSERT(glob.matches(&doc.File, "home/joe/"));
+  SCOPE_ASSERT(!glob.matches(&doc.File, "etc/"));
+  SCOPE_ASSERT(glob.mayMatchBelow("home/joe/"));
+  SCOPE_ASSERT(!glob.mayMatchBelow("etc/"));
+
+  RecordFilter name;
+  name.setPathGlob("*.doc");
+  SCOPE_ASSERT(!name.prunesPaths());
+  SCOPE_ASSERT(name.matches(&doc.File, "anywhere/at/all/"));
+  SCOPE_ASSERT(name.mayMatchBelow("etc/"));
+
+  RecordFilter types;
+  types.setTypes(RecordFilter::DIRS);
+  SCOPE_ASSERT(types.matches(&dir.File, ""));
+  SCOPE_ASSERT(!types.matches(&doc.File, ""));
+
+  RecordFilter size;
+  size.setSizeRange(100, 5000);
+  SCOPE_ASSERT(size.matches(&doc.File, ""));
+  SCOPE_ASSERT(!size.matches(&gone.File, ""));
+
+  RecordFilter window;
+  window.setTimeWindow(RecordFilter::MODIFIED, 1340000000, 1340828652);
+  SCOPE_ASSERT(!window.matches(&doc.File, ""));
+  window.setTimeWindow(RecordFilter::MODIFIED, 1340000000, 1340828653);
+  SCOPE_ASSERT(window.matches(&doc.File, ""));
+  SCOPE_ASSERT(!window.matches(&dir.File, ""));
+  window.setTimeWindow(RecordFilter::ACCESSED, 1340828700, 1340828800);
+  SCOPE_ASSERT(window.matches(&doc.File, ""));
+  window.setTimeWindow(RecordFilter::ANY_TIME, 1340828600, 1340828700);
+  SCOPE_ASSERT(window.matches(&doc.File, ""));
+
+  RecordFilter alloc;
+  alloc.setAllocState(RecordFilter::UNALLOCATED);
+  SCOPE_ASSERT(alloc.matches(&gone.File, ""));
+  SCOPE_ASSERT(!alloc.matches(&doc.File, ""));
+
+  doc.File.meta = 0;
+  SCOPE_ASSERT(!size.matches(&doc.File, ""));
+  SCOPE_ASSERT(name.matches(&doc.File, ""));
+}
@@ -0,0 +1,99 @@
+#include <scope/test.h>
+
+#include "gzipbuf.h"
+
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include <zlib.h>
+
+namespace {
+  // inflates every gzip member in s, returning the concatenated data and
+  // the number of members
+  std::string gunzip(const std::string& s, unsigned int& members) {
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    inflateInit2(&strm, 16 + 15);
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(s.data()));
+    strm.avail_in = s.size();
+
+    std::string ret;
+    char buf[64 * 1024];
+    members = 0;
+    while (strm.avail_in) {
+      strm.next_out = reinterpret_cast<Bytef*>(buf);
+      strm.avail_out = sizeof(buf);
+      const int err = inflate(&strm, Z_NO_FLUSH);
+      ret.append(buf, sizeof(buf) - strm.avail_out);
+      if (err == Z_STREAM_END) {
+        ++members;
+        inflateReset(&strm);
+      }
+      else if (err != Z_OK) {
+        break;
+      }
+    }
+    inflateEnd(&strm);
+    return ret;
+  }
+
+  std::string testData(size_t len) {
+    std::string ret;
+    unsigned int i = 0;
+    while (ret.size() < len) {
+      ret += "{\"id\":\"" + std::to_string(i * 2654435761u) + "\", \"path\":\"some/path/\"}\n";
+      ++i;
+    }
+    ret.resize(len);
+    return ret;
+  }
+
+  std::string compress(const std::string& data, int level, unsigned int threads, size_t blockSize, size_t chunk) {
+    std::stringbuf dest;
+    {
+      ParallelGzipBuf gz(&dest, level, threads, blockSize);
+      std::ostream out(&gz);
+      for (size_t i = 0; i < data.size(); i += chunk) {
+        out.write(data.data() + i, std::min(chunk, data.size() - i));
+      }
+    }
+    return dest.str();
+  }
+}
+
+SCOPE_TEST(testGzipBufSingleThread) {
+  const std::string data(testData(100000));
+  const std::string gz(compress(data, -1, 1, 16 * 1024, 1000));
+  unsigned int members;
+  SCOPE_ASSERT_EQUAL(data, gunzip(gz, members));
+  SCOPE_ASSERT_EQUAL(7u, members);
+  SCOPE_ASSERT(gz.size() < data.size());
+}
+
+SCOPE_TEST(testGzipBufThreadsKeepOrder) {
+  const std::string data(testData(1000003));
+  for (unsigned int threads = 2; threads <= 8; threads *= 2) {
+    const std::string gz(compress(data, 1, threads, 10000, 333));
+    unsigned int members;
+    SCOPE_ASSERT_EQUAL(data, gunzip(gz, members));
+    SCOPE_ASSERT_EQUAL(101u, members);
+  }
+}
+
+SCOPE_TEST(testGzipBufFlush) {
+  std::stringbuf dest;
+  ParallelGzipBuf gz(&dest, 9, 4);
+  std::ostream out(&gz);
+  out << "hello" << std::flush;
+  unsigned int members;
+  SCOPE_ASSERT_EQUAL("hello", gunzip(dest.str(), members));
+  out << " world" << std::flush;
+  out << std::flush; // nothing buffered, so no empty member
+  SCOPE_ASSERT_EQUAL("hello world", gunzip(dest.str(), members));
+  SCOPE_ASSERT_EQUAL(2u, members);
+}
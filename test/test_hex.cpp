@@ -0,0 +1,50 @@
+#include <scope/test.h>
+
+#include <string>
+#include <vector>
+
+#include "hex.h"
+#include "util.h"
+
+std::string hex(const std::vector<unsigned char>& bytes, bool scalar) {
+  std::string ret(2 * bytes.size(), 'X');
+  if (scalar) {
+    hexEncodeScalar(&ret[0], bytes.data(), bytes.data() + bytes.size());
+  }
+  else {
+    hexEncode(&ret[0], bytes.data(), bytes.data() + bytes.size());
+  }
+  return ret;
+}
+
+SCOPE_TEST(testHexEncodeScalar) {
+  SCOPE_ASSERT_EQUAL("", hex({}, true));
+  SCOPE_ASSERT_EQUAL("00ff7fa0", hex({0x00, 0xff, 0x7f, 0xa0}, true));
+}
+
+SCOPE_TEST(testHexEncodeAllLengths) {
+  // covers the 32- and 16-byte vector loops and their scalar tails
+  std::vector<unsigned char> bytes;
+  for (unsigned int len = 0; len < 300; ++len) {
+    SCOPE_ASSERT_EQUAL(hex(bytes, true), hex(bytes, false));
+    bytes.push_back((len * 151 + 7) & 0xff);
+  }
+}
+
+SCOPE_TEST(testHexEncodeEveryByte) {
+  std::vector<unsigned char> bytes;
+  for (unsigned int i = 0; i < 256; ++i) {
+    bytes.push_back(i);
+  }
+  std::string s = hex(bytes, false);
+  SCOPE_ASSERT_EQUAL("000102", s.substr(0, 6));
+  SCOPE_ASSERT_EQUAL("9a9b9c", s.substr(2 * 0x9a, 6));
+  SCOPE_ASSERT_EQUAL("fdfeff", s.substr(2 * 0xfd, 6));
+  SCOPE_ASSERT_EQUAL(hex(bytes, true), s);
+}
+
+SCOPE_TEST(testRecordIDs) {
+  SCOPE_ASSERT_EQUAL("01000000030000000000abcdef", makeInodeID(3, 0xabcdef));
+  SCOPE_ASSERT_EQUAL("02ffffffffffffffff", makeDiskMapID(0xffffffffffffffffull));
+  SCOPE_ASSERT_EQUAL("0a0b", bytesAsString((const unsigned char*)"\x0a\x0b", (const unsigned char*)"\x0a\x0b" + 2));
+}
@@ -0,0 +1,42 @@
+#include <scope/test.h>
+
+#include "inodeindex.h"
+
+#include <cstdio>
+#include <fstream>
+
+SCOPE_TEST(testInodeIndexRoundTrip) {
+  std::vector<InodeIndex::Entry> entries;
+  entries.push_back(InodeIndex::Entry{20, 1, 3, 1340828652, 1340828653, 4096});
+  entries.push_back(InodeIndex::Entry{5, 2, 1, -1, 0, 0});
+  entries.push_back(InodeIndex::Entry{5, 1, 7, 100, 200, 300});
+  entries.push_back(InodeIndex::Entry{20, 1, 9, 0, 0, 0}); // a second link; dropped
+
+  const std::string file("test_inodeindex.tmp");
+  SCOPE_ASSERT(InodeIndex::write(file, entries));
+
+  InodeIndex index;
+  SCOPE_ASSERT(index.open(file));
+  SCOPE_ASSERT_EQUAL(3u, index.size());
+  SCOPE_ASSERT_EQUAL(5u, index.begin()->Addr);
+  SCOPE_ASSERT_EQUAL(1u, index.begin()->Vol);
+
+  const InodeIndex::Entry* e = index.find(1, 20);
+  SCOPE_ASSERT(e);
+  SCOPE_ASSERT_EQUAL(3u, e->Seq);
+  SCOPE_ASSERT_EQUAL(1340828652, e->MTime);
+  SCOPE_ASSERT_EQUAL(1340828653, e->CTime);
+  SCOPE_ASSERT_EQUAL(4096u, e->Size);
+
+  e = index.find(2, 5);
+  SCOPE_ASSERT(e);
+  SCOPE_ASSERT_EQUAL(-1, e->MTime);
+
+  SCOPE_ASSERT(!index.find(2, 20));
+  SCOPE_ASSERT(!index.find(0, 5));
+
+  std::ofstream(file.c_str()) << "not an index";
+  SCOPE_ASSERT(!index.open(file));
+  std::remove(file.c_str());
+  SCOPE_ASSERT(!index.open(file));
+}
@@ -0,0 +1,50 @@
+#include <scope/test.h>
+
+#include <limits>
+#include <string>
+
+#include "jsonwriter.h"
+
+std::string str(const JsonWriter& w) {
+  return std::string(w.data(), w.size());
+}
+
+SCOPE_TEST(testJsonWriterPairs) {
+  JsonWriter w;
+  w.beginObject()
+   .pair("a", 1u, true)
+   .pair("b", -17)
+   .pair("c", "str")
+   .pair("d", std::string("x"))
+   .pair("e", true)
+   .pair("f", static_cast<const char*>(nullptr))
+   .endObject();
+  SCOPE_ASSERT_EQUAL("{\"a\":1,\"b\":-17,\"c\":\"str\",\"d\":\"x\",\"e\":1,\"f\":\"\"}", str(w));
+}
+
+SCOPE_TEST(testJsonWriterIntegers) {
+  JsonWriter w;
+  w.value(0u).raw(' ')
+   .value(std::numeric_limits<uint64_t>::max()).raw(' ')
+   .value(std::numeric_limits<int64_t>::min()).raw(' ')
+   .value(static_cast<uint16_t>(65535));
+  SCOPE_ASSERT_EQUAL("0 18446744073709551615 -9223372036854775808 65535", str(w));
+}
+
+SCOPE_TEST(testJsonWriterClearKeepsGrowth) {
+  JsonWriter w(4);
+  std::string big(1000, 'x');
+  w.value(big);
+  SCOPE_ASSERT_EQUAL(1002u, w.size());
+  w.clear();
+  SCOPE_ASSERT_EQUAL(0u, w.size());
+  w.raw("ab");
+  SCOPE_ASSERT_EQUAL("ab", str(w));
+}
+
+SCOPE_TEST(testJsonWriterHex) {
+  JsonWriter w;
+  w.key("id", true).hex(std::string("\x00\x01\xab", 3))
+   .key("none").hex(std::string());
+  SCOPE_ASSERT_EQUAL("\"id\":\"0001ab\",\"none\":\"\"", str(w));
+}
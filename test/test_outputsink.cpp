@@ -0,0 +1,137 @@
+#include <scope/test.h>
+
+#include "outputsink.h"
+
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+namespace {
+  std::string testData(size_t len, unsigned int seed) {
+    std::string ret(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+      ret[i] = 'a' + (i * 7 + seed) % 26;
+    }
+    return ret;
+  }
+
+  // writes in a mix of small pieces, single chars, and pieces larger than
+  // the buffer
+  std::string writeMix(std::ostream& out) {
+    std::string expected;
+    for (unsigned int i = 0; i < 200; ++i) {
+      const std::string s(testData(i % 10 == 9 ? 70000: 1 + i * 37 % 500, i));
+      out.write(s.data(), s.size());
+      out.put('\n');
+      expected += s;
+      expected += '\n';
+    }
+    return expected;
+  }
+
+  std::string readFile(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    std::stringstream buf;
+    buf << in.rdbuf();
+    return buf.str();
+  }
+}
+
+SCOPE_TEST(testOutputSinkFile) {
+  char path[] = "/tmp/fsrip_sinkXXXXXX";
+  close(mkstemp(path));
+
+  std::string expected;
+  uint64_t    written;
+  {
+    OutputSink   sink(path, 64 * 1024);
+    std::ostream out(&sink);
+    expected = writeMix(out);
+    out.flush();
+    written = sink.bytesWritten();
+    SCOPE_ASSERT(!sink.usingSplice());
+  }
+  SCOPE_ASSERT_EQUAL(expected.size(), written);
+  SCOPE_ASSERT_EQUAL(expected, readFile(path));
+  std::remove(path);
+}
+
+SCOPE_TEST(testOutputSinkTruncates) {
+  char path[] = "/tmp/fsrip_sinkXXXXXX";
+  close(mkstemp(path));
+  {
+    std::ofstream f(path);
+    f << "some older, longer contents";
+  }
+  {
+    OutputSink   sink(path);
+    std::ostream out(&sink);
+    out << "new";
+  }
+  SCOPE_ASSERT_EQUAL("new", readFile(path));
+  std::remove(path);
+}
+
+SCOPE_TEST(testOutputSinkPipe) {
+  int fds[2];
+  SCOPE_ASSERT_EQUAL(0, pipe(fds));
+
+  std::string got;
+  std::thread reader([&got, fds]() {
+    char buf[16 * 1024];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+      got.append(buf, n);
+    }
+  });
+
+  std::string expected;
+  uint64_t    written;
+  {
+    OutputSink   sink(fds[1], 256 * 1024);
+    std::ostream out(&sink);
+    for (unsigned int i = 0; i < 5; ++i) {
+      expected += writeMix(out);
+    }
+    out.flush();
+    written = sink.bytesWritten();
+#ifdef __linux__
+    SCOPE_ASSERT(sink.usingSplice());
+#endif
+  }
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+
+  SCOPE_ASSERT_EQUAL(expected.size(), written);
+  SCOPE_ASSERT_EQUAL(expected, got);
+}
+
+SCOPE_TEST(testOutputSinkBadPath) {
+  bool threw = false;
+  try {
+    OutputSink sink("/nonexistent/dir/file");
+  }
+  catch (std::runtime_error&) {
+    threw = true;
+  }
+  SCOPE_ASSERT(threw);
+}
+
+SCOPE_TEST(testSpoolFileCopyTo) {
+  SpoolFile spool(64 * 1024);
+  const std::string expected(writeMix(spool.out()));
+
+  // copied whole, as often as asked
+  std::stringstream dest;
+  spool.copyTo(dest);
+  SCOPE_ASSERT_EQUAL(expected, dest.str());
+  dest.str(std::string());
+  spool.copyTo(dest);
+  SCOPE_ASSERT_EQUAL(expected, dest.str());
+}
@@ -0,0 +1,60 @@
+#include <scope/test.h>
+
+#include "ownerindex.h"
+
+#include <cstdio>
+#include <fstream>
+
+SCOPE_TEST(testOwnerIndexRoundTrip) {
+  const std::string file("test_ownerindex.tmp");
+  {
+    OwnerIndex::Writer w(file, 512);
+    w.fragment(0, 0, 4096);
+    w.owner(OwnerIndex::Owner{7, 0, 0, 1, 0});
+    w.owner(OwnerIndex::Owner{8, 0, 8192, 1, 1});
+    w.fragment(0, 4096, 5000);
+    w.fragment(0, 10000, 10100);
+    w.owner(OwnerIndex::Owner{42, 9000, 4096, 3, 0});
+    w.fragment(1, 2048, 20000); // overlaps the first volume's
+    w.owner(OwnerIndex::Owner{9, 2048, 0, 0, 0});
+    SCOPE_ASSERT(w.close());
+  }
+
+  OwnerIndex index;
+  SCOPE_ASSERT(index.open(file));
+  SCOPE_ASSERT_EQUAL(512u, index.sectorSize());
+  SCOPE_ASSERT_EQUAL(4u, index.size());
+
+  std::vector<const OwnerIndex::Fragment*> found;
+  index.find(100, found);
+  SCOPE_ASSERT_EQUAL(1u, found.size());
+  SCOPE_ASSERT_EQUAL(0u, found[0]->Beg);
+  SCOPE_ASSERT_EQUAL(2, index.ownersEnd(*found[0]) - index.ownersBegin(*found[0]));
+  SCOPE_ASSERT_EQUAL(7u, index.ownersBegin(*found[0])->Addr);
+  SCOPE_ASSERT_EQUAL(8192u, (index.ownersBegin(*found[0]) + 1)->Offset);
+  SCOPE_ASSERT_EQUAL(1u, (index.ownersBegin(*found[0]) + 1)->Slack);
+
+  index.find(4096, found);
+  SCOPE_ASSERT_EQUAL(2u, found.size());
+  SCOPE_ASSERT_EQUAL(4096u, found[0]->Beg);
+  SCOPE_ASSERT(index.ownersBegin(*found[0]) == index.ownersEnd(*found[0]));
+  SCOPE_ASSERT_EQUAL(1u, found[1]->Vol);
+  SCOPE_ASSERT_EQUAL(9u, index.ownersBegin(*found[1])->Addr);
+
+  index.find(10099, found);
+  SCOPE_ASSERT_EQUAL(2u, found.size());
+  SCOPE_ASSERT_EQUAL(42u, index.ownersBegin(*found[0])->Addr);
+  SCOPE_ASSERT_EQUAL(3u, index.ownersBegin(*found[0])->AttrID);
+
+  index.find(5000, found);
+  SCOPE_ASSERT_EQUAL(1u, found.size());
+  SCOPE_ASSERT_EQUAL(1u, found[0]->Vol);
+
+  index.find(20000, found);
+  SCOPE_ASSERT(found.empty());
+
+  std::ofstream(file.c_str()) << "not an index";
+  SCOPE_ASSERT(!index.open(file));
+  std::remove(file.c_str());
+  SCOPE_ASSERT(!index.open(file));
+}
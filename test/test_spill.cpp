@@ -0,0 +1,46 @@
+#include <scope/test.h>
+
+#include "spill.h"
+
+SCOPE_TEST(testSpillFileRuns) {
+  SpillFile spill;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    spill.write(RunRecord{i * 4096, i * 4096 + 512, i, i * 4096, i * 7, uint32_t(i % 3), uint32_t(i % 5), i % 2 == 1});
+  }
+  for (int pass = 0; pass < 2; ++pass) {
+    spill.rewind();
+    RunRecord r;
+    for (uint64_t i = 0; i < 1000; ++i) {
+      SCOPE_ASSERT(spill.read(r));
+      SCOPE_ASSERT_EQUAL(i * 4096, r.Beg);
+      SCOPE_ASSERT_EQUAL(i * 4096 + 512, r.End);
+      SCOPE_ASSERT_EQUAL(i, r.Addr);
+      SCOPE_ASSERT_EQUAL(i * 7, r.Offset);
+      SCOPE_ASSERT_EQUAL(i % 3, r.Vol);
+      SCOPE_ASSERT_EQUAL(i % 5, r.AttrID);
+      SCOPE_ASSERT_EQUAL(i % 2 == 1, r.Slack);
+    }
+    SCOPE_ASSERT(!spill.read(r));
+  }
+}
+
+SCOPE_TEST(testSpillFileInodes) {
+  SpillFile spill;
+  spill.write(InodeRecord{1, 5, "000102"});
+  spill.write(InodeRecord{1, 5, ""});
+  spill.write(InodeRecord{2, 1ull << 40, std::string(300, 'a')});
+  spill.rewind();
+
+  InodeRecord r;
+  SCOPE_ASSERT(spill.read(r));
+  SCOPE_ASSERT_EQUAL(1u, r.Vol);
+  SCOPE_ASSERT_EQUAL(5u, r.Addr);
+  SCOPE_ASSERT_EQUAL("000102", r.ID);
+  SCOPE_ASSERT(spill.read(r));
+  SCOPE_ASSERT_EQUAL("", r.ID);
+  SCOPE_ASSERT(spill.read(r));
+  SCOPE_ASSERT_EQUAL(2u, r.Vol);
+  SCOPE_ASSERT_EQUAL(1ull << 40, r.Addr);
+  SCOPE_ASSERT_EQUAL(std::string(300, 'a'), r.ID);
+  SCOPE_ASSERT(!spill.read(r));
+}
@@ -0,0 +1,57 @@
+#include <scope/test.h>
+
+#include <string>
+
+#include "legacytimestamp.h"
+#include "util.h"
+
+std::string format(TimestampFormatter& fmt, uint32_t unix, uint32_t ns) {
+  char buf[TimestampFormatter::MAX_SIZE];
+  return std::string(buf, fmt.format(buf, unix, ns));
+}
+
+SCOPE_TEST(testTimestampFormatterEdges) {
+  TimestampFormatter fmt;
+  SCOPE_ASSERT_EQUAL("1970-01-01T00:00:00Z", format(fmt, 0, 0));
+  SCOPE_ASSERT_EQUAL("1970-01-01T00:00:00.5Z", format(fmt, 0, 500000000));
+  SCOPE_ASSERT_EQUAL("2000-02-29T23:59:59.000001Z", format(fmt, 951868799, 1000));
+  SCOPE_ASSERT_EQUAL("2106-02-07T06:28:15.12345679Z", format(fmt, 4294967295u, 123456789));
+
+  // sub-10ns values and ones that round up to a whole second leave a bare '.'
+  SCOPE_ASSERT_EQUAL("2012-06-27T20:24:12.Z", format(fmt, 1340828652, 3));
+  SCOPE_ASSERT_EQUAL("2012-06-27T20:24:12.Z", format(fmt, 1340828652, 999999996));
+
+  // exact ties are decided by the double, as %.8f did
+  SCOPE_ASSERT_EQUAL(legacyTimestamp(1, 5), format(fmt, 1, 5));
+  SCOPE_ASSERT_EQUAL(legacyTimestamp(1, 1953125), format(fmt, 1, 1953125));
+  SCOPE_ASSERT_EQUAL(legacyTimestamp(1, 123456785), format(fmt, 1, 123456785));
+}
+
+SCOPE_TEST(testTimestampFormatterMatchesLegacy) {
+  TimestampFormatter fmt;
+  uint64_t state = 88172645463325252ull;
+  for (unsigned int i = 0; i < 200000; ++i) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    const uint32_t unix = state >> 32;
+    uint32_t ns = state % 1000000000;
+    switch (i % 4) {
+      case 0: ns -= ns % 100; break; // NTFS resolution
+      case 1: ns -= ns % 10; ns += 5; break; // ties
+      case 2: ns %= 10; break;
+    }
+    SCOPE_ASSERT_EQUAL(legacyTimestamp(unix, ns), format(fmt, unix, ns));
+  }
+}
+
+SCOPE_TEST(testTimestampFormatterCachedPrefix) {
+  // a directory's worth of files sharing a few timestamps, as the prefix cache sees them
+  TimestampFormatter fmt;
+  const uint32_t base = 1340828652;
+  for (unsigned int i = 0; i < 20000; ++i) {
+    const uint32_t unix = base + i / 64 + (i % 3 == 2 ? 86400: 0),
+                   ns = (i % 7) * 1000100;
+    SCOPE_ASSERT_EQUAL(legacyTimestamp(unix, ns), format(fmt, unix, ns));
+  }
+}
@@ -0,0 +1,115 @@
+#include <scope/test.h>
+
+#include "synthetic.h"
+#include "treewalk.h"
+
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+SCOPE_TEST(testThreadBudget) {
+  ThreadBudget budget(2);
+  SCOPE_ASSERT(budget.available());
+  SCOPE_ASSERT(budget.take());
+  SCOPE_ASSERT(budget.take());
+  SCOPE_ASSERT(!budget.available());
+  SCOPE_ASSERT(!budget.take());
+  budget.give(1);
+  SCOPE_ASSERT(budget.take());
+  SCOPE_ASSERT(!budget.take());
+}
+
+SCOPE_TEST(testSegmentBufSpools) {
+  SegmentBuf buf(10);
+  std::ostream out(&buf);
+  std::string data("left over");
+  std::unique_ptr<SpoolFile> spool;
+
+  // under the limit, the segment stays in memory
+  out << "small";
+  buf.take(data, spool);
+  SCOPE_ASSERT_EQUAL(std::string("small"), data);
+  SCOPE_ASSERT(!spool);
+
+  // past it, all of the segment goes to the spool
+  out << "0123456" << '7' << "89abcdef";
+  buf.take(data, spool);
+  SCOPE_ASSERT(data.empty());
+  SCOPE_ASSERT(spool);
+  std::stringstream copy;
+  spool->copyTo(copy);
+  SCOPE_ASSERT_EQUAL(std::string("0123456789abcdef"), copy.str());
+
+  // and the next starts afresh
+  out << "next";
+  buf.take(data, spool);
+  SCOPE_ASSERT_EQUAL(std::string("next"), data);
+  SCOPE_ASSERT(!spool);
+}
+
+namespace {
+  class CountingWalker: public SyntheticWalker {
+  public:
+    CountingWalker(std::ostream& out, TSK_IMG_INFO* img, OUTPUT_FORMAT format): SyntheticWalker(out, img, format), Workers(0) {}
+
+    std::atomic<unsigned int> Workers;
+
+  protected:
+    virtual MetadataWriter* newWorker(std::ostream& out) const {
+      ++const_cast<CountingWalker*>(this)->Workers;
+      return SyntheticWalker::newWorker(out);
+    }
+  };
+
+  struct Walked {
+    std::string Out;
+    std::vector<std::tuple<uint32_t, uint64_t, uint64_t, size_t>> Fragments;
+    std::vector<std::tuple<uint32_t, uint64_t, std::vector<std::string>>> Inodes;
+    unsigned int Files,
+                 Workers;
+  };
+
+  Walked walkWithThreads(LbtTskAuto::OUTPUT_FORMAT format, unsigned int threads) {
+    TSK_IMG_INFO img;
+    TSK_FS_INFO fs;
+    initImage(img, fs);
+    fs.root_inum = 2;
+
+    std::stringstream out;
+    CountingWalker walker(out, &img, format);
+    walker.setFileFilterFlags((TSK_FS_DIR_WALK_FLAG_ENUM)(TSK_FS_DIR_WALK_FLAG_RECURSE | TSK_FS_DIR_WALK_FLAG_UNALLOC | TSK_FS_DIR_WALK_FLAG_ALLOC));
+    walker.setThreads(threads);
+    walker.walkFs(fs);
+
+    Walked w;
+    w.Out = out.str();
+    walker.forEachFragment([&w](uint32_t vol, uint64_t beg, uint64_t end, const MetadataWriter::AttrSet& owners) {
+      w.Fragments.emplace_back(vol, beg, end, owners.size());
+    });
+    walker.forEachInode([&w](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+      w.Inodes.emplace_back(vol, addr, ids);
+    });
+    w.Files = walker.NumFiles;
+    w.Workers = walker.Workers;
+    return w;
+  }
+}
+
+SCOPE_TEST(testTreeWalkSameAsSerial) {
+  // the first directory is always handed off, so the output comes in several segments
+  for (LbtTskAuto::OUTPUT_FORMAT format: {LbtTskAuto::JSON, LbtTskAuto::BINARY}) {
+    const Walked serial(walkWithThreads(format, 1)),
+                 parallel(walkWithThreads(format, 4));
+    SCOPE_ASSERT_EQUAL(0u, serial.Workers);
+    SCOPE_ASSERT(parallel.Workers > 1);
+    SCOPE_ASSERT_EQUAL(12u, serial.Files);
+    SCOPE_ASSERT_EQUAL(serial.Files, parallel.Files);
+    SCOPE_ASSERT_EQUAL(serial.Out, parallel.Out);
+    SCOPE_ASSERT(!serial.Fragments.empty());
+    SCOPE_ASSERT(serial.Fragments == parallel.Fragments);
+    SCOPE_ASSERT(!serial.Inodes.empty());
+    SCOPE_ASSERT(serial.Inodes == parallel.Inodes);
+  }
+}
@@ -1,6 +1,11 @@
 #include <scope/test.h>
 
-#include "walkers.h"
+#include "synthetic.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <tuple>
 
 SCOPE_TEST(testDirInfoNewChild) {
   DirInfo gpa;
@@ -53,6 +58,32 @@ SCOPE_TEST(testDirInfoNewChild) {
   SCOPE_ASSERT_EQUAL("00010101", dad.lastChild());
 }
 
+namespace {
+  std::string asHex(const std::string& bytes) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data());
+    return bytesAsString(p, p + bytes.size());
+  }
+}
+
+SCOPE_TEST(testDirInfoBinaryIDs) {
+  DirInfo root;
+  root.incCount();
+  DirInfo dir = root.newChild("dir/");
+  for (unsigned int i = 0; i < 200; ++i) {
+    dir.incCount();
+  }
+
+  std::string id, last, children;
+  dir.appendID(id);
+  dir.appendLastChild(last);
+  dir.appendLastChildsChildren(children);
+
+  SCOPE_ASSERT_EQUAL(dir.id(), asHex(id));
+  SCOPE_ASSERT_EQUAL(dir.lastChild(), asHex(last));
+  SCOPE_ASSERT_EQUAL(dir.newChild("").lastChild(), asHex(children));
+  SCOPE_ASSERT_EQUAL(dir.newChild("").id(), dir.lastChild());
+}
+
 SCOPE_TEST(testMakeUnallocatedDataRun) {
   TSK_FS_ATTR_RUN         extent;
   TSK_DADDR_T             start(20),
@@ -64,3 +95,372 @@ SCOPE_TEST(testMakeUnallocatedDataRun) {
   SCOPE_ASSERT_EQUAL(10, extent.len);
   SCOPE_ASSERT_EQUAL(0, extent.offset);
 }
+
+SCOPE_TEST(testFieldsSkipOutput) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  const std::string all = walkTree(img, fs, LbtTskAuto::JSON),
+                    some = walkTree(img, fs, LbtTskAuto::JSON, Fields::NAME | Fields::META | Fields::TIMES),
+                    none = walkTree(img, fs, LbtTskAuto::JSON, 0);
+  SCOPE_ASSERT(all.find("\"attrs\"") != std::string::npos);
+  SCOPE_ASSERT(all.find("\"rd_buf\"") != std::string::npos);
+  SCOPE_ASSERT(all.find("\"nrd_runs\"") != std::string::npos);
+
+  SCOPE_ASSERT(some.find("\"attrs\"") == std::string::npos);
+  SCOPE_ASSERT(some.find("\"shrt_name\"") != std::string::npos);
+  SCOPE_ASSERT(some.find("\"modified\"") != std::string::npos);
+  SCOPE_ASSERT(some.find("\"size\"") != std::string::npos);
+
+  SCOPE_ASSERT(none.find("\"name\"") == std::string::npos);
+  SCOPE_ASSERT(none.find("\"modified\"") == std::string::npos);
+  SCOPE_ASSERT(none.find("\"size\"") == std::string::npos);
+  SCOPE_ASSERT(none.find("\"addr\"") != std::string::npos);
+  SCOPE_ASSERT(none.find("\"__link\"") != std::string::npos);
+  SCOPE_ASSERT(none.size() < some.size() && some.size() < all.size());
+}
+
+SCOPE_TEST(testFieldsKeepDiskMap) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  std::stringstream out;
+  SyntheticWalker   full(out, &img, LbtTskAuto::JSON);
+  walkTree(full, fs);
+  SCOPE_ASSERT(!std::get<3>(full.diskMap().at(0)).empty());
+
+  const unsigned int projections[] = {
+    Fields::NAME | Fields::META | Fields::TIMES,
+    Fields::ATTRS,
+    Fields::ATTRS | Fields::RD_BUF,
+    Fields::META | Fields::RUNS,
+    0
+  };
+  for (unsigned int fields: projections) {
+    SyntheticWalker projected(out, &img, LbtTskAuto::BINARY, fields);
+    walkTree(projected, fs);
+    SCOPE_ASSERT(full.diskMap() == projected.diskMap());
+  }
+
+  SyntheticWalker noMap(out, &img, LbtTskAuto::BINARY, Fields::ALL);
+  noMap.setBuildDiskMap(false);
+  walkTree(noMap, fs);
+  SCOPE_ASSERT(std::get<3>(noMap.diskMap().at(0)).empty());
+}
+
+SCOPE_TEST(testFilterKeepsIDs) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  std::stringstream all;
+  SyntheticWalker   full(all, &img, LbtTskAuto::JSON);
+  walkTree(full, fs);
+
+  RecordFilter filter;
+  filter.setPathGlob("Documents/**");
+  filter.setTypes(RecordFilter::FILES);
+
+  std::stringstream some;
+  SyntheticWalker   filtered(some, &img, LbtTskAuto::JSON);
+  filtered.setFilter(filter);
+  walkTree(filtered, fs);
+
+  // the filtered records are exactly those in the full output, IDs and all
+  std::vector<std::string> expected;
+  std::string line;
+  while (std::getline(all, line)) {
+    if (line.find("\"path\":\"Documents/") != std::string::npos && line.find("\"type\":\"File\"") != std::string::npos) {
+      expected.push_back(line);
+    }
+  }
+  std::vector<std::string> got;
+  while (std::getline(some, line)) {
+    got.push_back(line);
+  }
+  SCOPE_ASSERT_EQUAL(4u, got.size());
+  SCOPE_ASSERT(expected == got);
+
+  // what's filtered out is still in the disk map
+  SCOPE_ASSERT(full.diskMap() == filtered.diskMap());
+  SCOPE_ASSERT(full.reverseMap() != filtered.reverseMap());
+}
+
+SCOPE_TEST(testDirStackIDs) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  // down three levels, straight back up to the root, and down again
+  const Listing deep[] = {
+    {"", "a", true},
+    {"a/", "b", true},
+    {"a/b/", "c", true},
+    {"a/b/c/", "x", false},
+    {"", "y", false},
+    {"", "z", true},
+    {"z/", "w", false}
+  };
+  const char* expected[][2] = {
+    {"000000", "0000"},
+    {"00010000", "000000"},
+    {"0002000000", "00010000"},
+    {"000300000000", "0002000000"},
+    {"000001", "0000"},
+    {"000002", "0000"},
+    {"00010200", "000002"}
+  };
+
+  std::stringstream out;
+  SyntheticWalker   walker(out, &img, LbtTskAuto::JSON);
+  walkTree(walker, fs, deep);
+
+  std::string line;
+  unsigned int i = 0;
+  while (std::getline(out, line)) {
+    SCOPE_ASSERT(i < 7);
+    SCOPE_ASSERT(line.find(std::string("{\"id\":\"") + expected[i][0] + "\",\"parent\":\"" + expected[i][1] + "\"") == 0);
+    ++i;
+  }
+  SCOPE_ASSERT_EQUAL(7u, i);
+}
+
+namespace {
+  class RunWalker: public SyntheticWalker {
+  public:
+    RunWalker(std::ostream& out, TSK_IMG_INFO* img, TSK_FS_INFO* fs): SyntheticWalker(out, img, JSON) {
+      setFsInfo(fs, 0, img->size / img->sector_size);
+    }
+
+    void mark(uint64_t beg, uint64_t end, TSK_INUM_T addr) {
+      markDataRun(beg, end, 0, addr, 3, false);
+      limitMemory();
+    }
+
+    std::string fragments() {
+      std::stringstream buf;
+      forEachFragment([&](uint32_t vol, uint64_t beg, uint64_t end, const AttrSet& owners) {
+        buf << vol << ':' << beg << '-' << end;
+        for (const AttrRunInfo& o: owners) {
+          buf << ' ' << std::get<0>(o) << '@' << std::get<3>(o);
+        }
+        buf << '\n';
+      });
+      return buf.str();
+    }
+  };
+}
+
+SCOPE_TEST(testDiskMapFragments) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  const std::string expected =
+    "0:0-50 7@0\n"
+    "0:50-100 7@0 8@50\n"
+    "0:100-150 8@50\n"
+    "0:150-200 9@150\n"
+    "0:300-400 7@300\n";
+  for (uint64_t maxMemory: {0, 1, 100}) {
+    std::stringstream out;
+    RunWalker w(out, &img, &fs);
+    w.setMaxMemory(maxMemory);
+    w.mark(300, 400, 7);
+    w.mark(50, 150, 8);
+    w.mark(0, 100, 7);
+    w.mark(0, 100, 7); // a hard link's
+    w.mark(150, 200, 9);
+    SCOPE_ASSERT_EQUAL(expected, w.fragments());
+    SCOPE_ASSERT_EQUAL(expected, w.fragments()); // the same again, spilled or not
+  }
+}
+
+SCOPE_TEST(testInodeSink) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  typedef std::tuple<uint32_t, uint64_t, std::vector<std::string>> Row;
+  std::vector<Row> all;
+  std::stringstream out;
+  SyntheticWalker full(out, &img, LbtTskAuto::JSON);
+  walkTree(full, fs);
+  full.forEachInode([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+    all.emplace_back(vol, addr, ids);
+  });
+
+  std::vector<Row> sunk, rest;
+  SyntheticWalker streamed(out, &img, LbtTskAuto::JSON);
+  streamed.setInodeSink([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+    sunk.emplace_back(vol, addr, ids);
+  });
+  walkTree(streamed, fs);
+  streamed.forEachInode([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+    rest.emplace_back(vol, addr, ids);
+  });
+
+  // the allocated files with one link, f0 and f4, in walk order
+  SCOPE_ASSERT_EQUAL(2u, sunk.size());
+  SCOPE_ASSERT_EQUAL(106u, std::get<1>(sunk[0]));
+  SCOPE_ASSERT_EQUAL(110u, std::get<1>(sunk[1]));
+
+  // and between them, the same rows as ever
+  std::vector<Row> both(sunk);
+  both.insert(both.end(), rest.begin(), rest.end());
+  std::sort(both.begin(), both.end());
+  SCOPE_ASSERT(all == both);
+}
+
+SCOPE_TEST(testInodeSinkDeletedName) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  std::vector<uint64_t> sunk;
+  std::stringstream out;
+  SyntheticWalker walker(out, &img, LbtTskAuto::JSON);
+  walker.setInodeSink([&](uint32_t, uint64_t addr, const std::vector<std::string>&) {
+    sunk.push_back(addr);
+  });
+  walker.filterFs(&fs);
+
+  // f0's inode, under deleted names before and after its own
+  SyntheticFile before{}, live{}, after{};
+  makeFile(before, &fs, "old", false, 106, 4);
+  makeFile(live, &fs, "f0", false, 106, 6);
+  makeFile(after, &fs, "older", false, 106, 14);
+  walker.processFile(&before.File, "");
+  walker.processFile(&live.File, "");
+  walker.processFile(&after.File, "");
+
+  std::vector<std::vector<std::string>> rows;
+  walker.forEachInode([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+    SCOPE_ASSERT_EQUAL(106u, addr);
+    SCOPE_ASSERT(walker.sunk(vol, addr));
+    rows.push_back(ids);
+  });
+
+  // its row was written when f0 was found; the deleted names get it another
+  SCOPE_ASSERT_EQUAL(1u, sunk.size());
+  SCOPE_ASSERT_EQUAL(106u, sunk[0]);
+  SCOPE_ASSERT_EQUAL(1u, rows.size());
+  SCOPE_ASSERT_EQUAL(2u, rows[0].size());
+  SCOPE_ASSERT(!walker.sunk(0, 105));
+}
+
+SCOPE_TEST(testResumeSinceInodeMap) {
+  TSK_IMG_INFO img;
+  TSK_FS_INFO  fs;
+  initImage(img, fs);
+
+  // the files of TREE as a previous dump saw them, every other one changed since
+  std::vector<InodeIndex::Entry> entries;
+  for (unsigned int seed = 0; seed < sizeof(TREE) / sizeof(TREE[0]); ++seed) {
+    entries.push_back(InodeIndex::Entry{100 + seed, 0, seed, 1340828652, 0, 1000 + seed * 77 + seed % 2});
+  }
+  const std::string indexFile("test_walkers_since.tmp"),
+                    checkpointFile("test_walkers_checkpoint.tmp");
+  SCOPE_ASSERT(InodeIndex::write(indexFile, entries));
+
+  typedef std::tuple<uint32_t, uint64_t, std::vector<std::string>> Row;
+  std::vector<Row> fullRows, resumedRows;
+
+  std::stringstream fullOut;
+  SyntheticWalker full(fullOut, &img, LbtTskAuto::JSON);
+  SCOPE_ASSERT(full.setSince(indexFile));
+  walkTree(full, fs);
+  full.forEachInode([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+    fullRows.emplace_back(vol, addr, ids);
+  });
+
+  // interrupted partway, with checkpoints along the way
+  const Listing partial[] = {TREE[0], TREE[1], TREE[2], TREE[3], TREE[4], TREE[5], TREE[6]};
+  std::stringstream partialOut;
+  SyntheticWalker interrupted(partialOut, &img, LbtTskAuto::JSON);
+  SCOPE_ASSERT(interrupted.setSince(indexFile));
+  interrupted.setCheckpoints(checkpointFile, 2);
+  walkTree(interrupted, fs, partial);
+
+  Checkpoint cp;
+  SCOPE_ASSERT(cp.load(checkpointFile));
+  SCOPE_ASSERT(cp.Records > 1 && cp.Records < 7);
+
+  std::stringstream resumedOut;
+  SyntheticWalker resumed(resumedOut, &img, LbtTskAuto::JSON);
+  SCOPE_ASSERT(resumed.setSince(indexFile));
+  resumed.setCheckpoints(checkpointFile, 2);
+  SCOPE_ASSERT(resumed.resume(checkpointFile));
+  walkTree(resumed, fs);
+  resumed.forEachInode([&](uint32_t vol, uint64_t addr, const std::vector<std::string>& ids) {
+    resumedRows.emplace_back(vol, addr, ids);
+  });
+
+  SCOPE_ASSERT_EQUAL(fullOut.str(), partialOut.str().substr(0, cp.Offset) + resumedOut.str());
+  SCOPE_ASSERT(!fullRows.empty());
+  SCOPE_ASSERT(fullRows == resumedRows);
+
+  std::remove(indexFile.c_str());
+  std::remove(checkpointFile.c_str());
+}
+
+namespace {
+  // TREE, with the names TSK gives no inode for
+  const Listing REUSED[] = {
+    {"", "Documents", true},
+    {"Documents/", "notes.txt", false},
+    {"Documents/", "sub", true},
+    {"Documents/sub/", "a", false},
+    {"Documents/sub/", "gone", false, true}, // deleted, with meta_addr 0
+    {"Documents/", "after", false},
+    {"", "stale", true}, // the directory's inode has been reused
+    {"stale/", "x", false},
+    {"", "f8", false}, // no inode
+    {"", "f9", false},
+    {"", "f10", false},
+    {"", "f11", false},
+    {"", "f12", false},
+    {"", "f13", false} // a file whose inode has been reused
+  };
+
+  std::vector<std::string> scanInOrder(LbtTskAuto::SCAN_ORDER order, std::vector<std::tuple<uint32_t, uint64_t, uint64_t>>& fragments) {
+    TSK_IMG_INFO img;
+    TSK_FS_INFO fs;
+    initImage(img, fs);
+    fs.root_inum = 2;
+    fs.first_inum = 1;
+    fs.last_inum = 1000;
+
+    std::stringstream out;
+    SyntheticWalker walker(out, &img, LbtTskAuto::JSON);
+    walker.setFileFilterFlags((TSK_FS_DIR_WALK_FLAG_ENUM)(TSK_FS_DIR_WALK_FLAG_RECURSE | TSK_FS_DIR_WALK_FLAG_UNALLOC | TSK_FS_DIR_WALK_FLAG_ALLOC));
+    walker.setScanOrder(order);
+    walker.setTree(REUSED);
+    walker.walkFs(fs);
+    walker.forEachFragment([&](uint32_t vol, uint64_t beg, uint64_t end, const MetadataWriter::AttrSet&) {
+      fragments.emplace_back(vol, beg, end);
+    });
+
+    std::vector<std::string> records;
+    std::string line;
+    while (std::getline(out, line)) {
+      records.push_back(line);
+    }
+    std::sort(records.begin(), records.end());
+    return records;
+  }
+}
+
+SCOPE_TEST(testScanOrderSameRecords) {
+  std::vector<std::tuple<uint32_t, uint64_t, uint64_t>> dirFragments,
+                                                        inodeFragments;
+  const std::vector<std::string> dirOrder(scanInOrder(LbtTskAuto::DIRECTORY, dirFragments)),
+                                 inodeOrder(scanInOrder(LbtTskAuto::INODE, inodeFragments));
+  // all but what's below stale
+  SCOPE_ASSERT_EQUAL(sizeof(REUSED) / sizeof(REUSED[0]) - 1, dirOrder.size());
+  SCOPE_ASSERT(dirOrder == inodeOrder);
+  SCOPE_ASSERT(!dirFragments.empty());
+  SCOPE_ASSERT(dirFragments == inodeFragments);
+}